@@ -0,0 +1,118 @@
+#!/bin/sh
+# generate the native benchmark corpus with the ffmpeg cli
+# usage: gen_corpus.sh [output dir] [duration seconds]
+# files whose encoder is not available in the local ffmpeg are skipped.
+
+OUT=${1:-./build/native/corpus}
+DURATION=${2:-30}
+FFMPEG=${FFMPEG:-ffmpeg}
+
+mkdir -p "$OUT" || exit 1
+
+ENCODERS=$("$FFMPEG" -hide_banner -encoders 2>/dev/null)
+
+has_encoder() {
+  echo "$ENCODERS" | grep -q " $1 "
+}
+
+VIDEO_IN="-f lavfi -i testsrc2=size=1280x720:rate=30:duration=$DURATION"
+AUDIO_IN="-f lavfi -i sine=frequency=440:sample_rate=48000:duration=$DURATION"
+
+gen() {
+  name=$1
+  vcodec=$2
+  acodec=$3
+  shift 3
+
+  if ! has_encoder "$vcodec" || ! has_encoder "$acodec"; then
+    echo "skip $name ($vcodec/$acodec not available)" >&2
+    return
+  fi
+
+  echo "generate $name" >&2
+  # shellcheck disable=SC2086
+  "$FFMPEG" -hide_banner -loglevel error -y $VIDEO_IN $AUDIO_IN \
+    -c:v "$vcodec" -g 60 -c:a "$acodec" "$@" "$OUT/$name" || echo "failed $name" >&2
+}
+
+gen h264-aac.mp4 libx264 aac -movflags +faststart
+gen h264-aac-frag.mp4 libx264 aac -movflags +frag_keyframe+empty_moov
+gen hevc-aac.mp4 libx265 aac -tag:v hvc1
+gen h264-aac.mkv libx264 aac
+gen vp8-vorbis.webm libvpx libvorbis -deadline realtime
+gen vp9-opus.webm libvpx-vp9 libopus -deadline realtime -row-mt 1
+gen h264-aac.flv libx264 aac
+gen h264-mp3.avi libx264 libmp3lame
+gen h264-mp2.mpg libx264 mp2 -f mpeg
+gen h264-aac.asf libx264 aac
+
+# many tracks: 1 video, 6 audio and 20 subtitle tracks (a cue every 2s)
+gen_many_tracks() {
+  name=h264-6aac-20srt.mkv
+
+  if ! has_encoder libx264 || ! has_encoder aac || ! has_encoder srt; then
+    echo "skip $name (libx264/aac/srt not available)" >&2
+    return
+  fi
+
+  srt="$OUT/cues.srt"
+  : > "$srt"
+  i=0
+  while [ $((i * 2)) -lt "$DURATION" ]; do
+    printf '%d\n00:%02d:%02d,000 --> 00:%02d:%02d,500\ncue %d\n\n' \
+      $((i + 1)) $((i * 2 / 60)) $((i * 2 % 60)) $((i * 2 / 60)) $((i * 2 % 60 + 1)) $((i + 1)) >> "$srt"
+    i=$((i + 1))
+  done
+
+  maps="-map 0:v"
+  for _ in 1 2 3 4 5 6; do maps="$maps -map 1:a"; done
+  for _ in $(seq 20); do maps="$maps -map 2:s"; done
+
+  echo "generate $name" >&2
+  # shellcheck disable=SC2086
+  "$FFMPEG" -hide_banner -loglevel error -y $VIDEO_IN $AUDIO_IN -i "$srt" $maps \
+    -c:v libx264 -g 60 -c:a aac -c:s srt "$OUT/$name" || echo "failed $name" >&2
+  rm -f "$srt"
+}
+
+gen_many_tracks
+
+# big endian 64 bit integer
+be64() {
+  bits=56
+  while [ $bits -ge 0 ]; do
+    # shellcheck disable=SC2059
+    printf "\\$(printf '%03o' $((($1 >> bits) & 255)))"
+    bits=$((bits - 8))
+  done
+}
+
+# larger than 4GB with a few MB on disk: a fragmented mp4 whose offsets are
+# relative to each moof (default_base_moof, no mfra index) behind a 5GB sparse
+# free box, so every box and packet lies past 4GB. needs sparse file support.
+gen_sparse() {
+  name=h264-aac-5g-sparse.mp4
+  base="$OUT/sparse-base.mp4"
+  gap=$((5 * 1024 * 1024 * 1024))
+
+  if ! has_encoder libx264 || ! has_encoder aac; then
+    echo "skip $name (libx264/aac not available)" >&2
+    return
+  fi
+
+  echo "generate $name" >&2
+  # shellcheck disable=SC2086
+  if ! "$FFMPEG" -hide_banner -loglevel error -y $VIDEO_IN $AUDIO_IN -c:v libx264 -g 60 -c:a aac \
+    -movflags +frag_keyframe+empty_moov+default_base_moof+skip_trailer "$base"; then
+    echo "failed $name" >&2
+    return
+  fi
+
+  # free box with a 64 bit size (size 1, then largesize) spanning the gap
+  { printf '\000\000\000\001free'; be64 "$gap"; } > "$OUT/$name"
+  dd if=/dev/null of="$OUT/$name" bs=1 seek="$gap" 2>/dev/null
+  cat "$base" >> "$OUT/$name"
+  rm -f "$base"
+}
+
+gen_sparse
@@ -0,0 +1,465 @@
+/**
+ * native benchmark of the demux core (lib/web-demuxer/web_demuxer_core.cpp)
+ *
+ * usage: web-demuxer-bench [--iterations N] [--seeks N] [--read-seconds S] file...
+ *
+ * for every file it measures
+ *   open:  open_input + gen_web_stream of all streams (what a session load does,
+ *          i.e. time to first metadata) for each probe policy
+ *   seek:  seek_stream + read_stream_packet + gen_web_packet at pseudo random
+ *          times (what get_av_packet does)
+ *   batch seek: get_packets_at + gen_web_packet of the same times in one call
+ *          (what get_av_packets_at does), total ms and distinct packets
+ *   frame: get_frame_packets + gen_web_packet of the gop up to the same times
+ *          (what get_frame_packets does for a video stream)
+ *   all streams: the packet of every stream at the same times, with one seek
+ *          and scan (get_stream_packets_at, what get_av_packets does) and
+ *          with one seek and scan per stream (its previous implementation)
+ *   read:  a linear read with gen_web_packet of the best video (or audio) stream
+ *          (what read_av_packet does), in packets/s and MB/s
+ *   max_pos: the largest packet byte position seen by the seeks and the read,
+ *          e.g. past 4GB for the sparse corpus file (see gen_corpus.sh)
+ *   index: build_packet_index of that stream
+ * and prints one JSON object per file (JSON lines) on stdout, logs go to stderr.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "web_demuxer_core.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+typedef struct BenchOptions
+{
+    int iterations = 10;
+    int seeks = 50;
+    double read_seconds = 0;
+    std::vector<std::string> files;
+} BenchOptions;
+
+typedef struct Summary
+{
+    double min;
+    double median;
+    double mean;
+    double p95;
+} Summary;
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static Summary summarize(std::vector<double> samples)
+{
+    Summary summary = {NAN, NAN, NAN, NAN};
+
+    if (samples.empty())
+    {
+        return summary;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0;
+
+    for (double sample : samples)
+    {
+        total += sample;
+    }
+
+    summary.min = samples.front();
+    summary.median = samples[samples.size() / 2];
+    summary.mean = total / samples.size();
+    summary.p95 = samples[std::min(samples.size() - 1, (size_t)(samples.size() * 0.95))];
+
+    return summary;
+}
+
+static std::string json_string(const std::string &value)
+{
+    std::string out = "\"";
+
+    for (unsigned char c : value)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+
+    return out + "\"";
+}
+
+static std::string json_number(double value)
+{
+    if (std::isnan(value) || std::isinf(value))
+    {
+        return "null";
+    }
+
+    char number[32];
+    snprintf(number, sizeof(number), "%.6g", value);
+
+    return number;
+}
+
+static std::string json_summary(const Summary &summary)
+{
+    return "{\"min\":" + json_number(summary.min) +
+           ",\"median\":" + json_number(summary.median) +
+           ",\"mean\":" + json_number(summary.mean) +
+           ",\"p95\":" + json_number(summary.p95) + "}";
+}
+
+static const struct
+{
+    const char *name;
+    int policy;
+} probe_policies[] = {
+    {"fast", WEB_PROBE_FAST},
+    {"default", WEB_PROBE_DEFAULT},
+    {"thorough", WEB_PROBE_THOROUGH},
+};
+
+static void open_file(AVFormatContext **fmt_ctx, const std::string &file, std::vector<WebAVStream> &streams, int probe_policy = WEB_PROBE_DEFAULT)
+{
+    open_input(fmt_ctx, file.c_str(), NULL, probe_policy);
+
+    streams = std::vector<WebAVStream>((*fmt_ctx)->nb_streams);
+
+    for (unsigned int i = 0; i < (*fmt_ctx)->nb_streams; i++)
+    {
+        gen_web_stream(streams[i], (*fmt_ctx)->streams[i], *fmt_ctx);
+    }
+}
+
+static int find_bench_stream(AVFormatContext *fmt_ctx)
+{
+    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+
+    if (stream_index < 0)
+    {
+        stream_index = find_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1);
+    }
+
+    return stream_index;
+}
+
+// baseline for get_stream_packets_at: seek and scan once per stream
+static void seek_each_stream(AVFormatContext *fmt_ctx, double timestamp, AVPacket *packet)
+{
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++)
+    {
+        if (seek_stream(fmt_ctx, i, timestamp, AVSEEK_FLAG_BACKWARD) >= 0 &&
+            read_stream_packet(fmt_ctx, i, packet) >= 0)
+        {
+            WebAVPacket web_packet;
+
+            gen_web_packet(web_packet, packet, fmt_ctx->streams[i]);
+        }
+        av_packet_unref(packet);
+    }
+}
+
+static std::string bench_file(const std::string &file, const BenchOptions &options)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    std::vector<WebAVStream> streams;
+    std::string open_result;
+
+    for (const auto &probe : probe_policies)
+    {
+        std::vector<double> open_samples;
+
+        for (int i = 0; i < options.iterations; i++)
+        {
+            bench_clock::time_point start = bench_clock::now();
+
+            open_file(&fmt_ctx, file, streams, probe.policy);
+            open_samples.push_back(elapsed_ms(start));
+            avformat_close_input(&fmt_ctx);
+        }
+
+        open_result += std::string(open_result.empty() ? "" : ",") + "\"" + probe.name + "\":" + json_summary(summarize(open_samples));
+    }
+
+    open_file(&fmt_ctx, file, streams);
+
+    int stream_index = find_bench_stream(fmt_ctx);
+    AVStream *stream = fmt_ctx->streams[stream_index];
+    double duration = fmt_ctx->duration > 0 ? fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q) : 0;
+    AVPacket *packet = av_packet_alloc();
+
+    if (!packet)
+    {
+        avformat_close_input(&fmt_ctx);
+        throw std::runtime_error("Cannot allocate packet");
+    }
+
+    // seek latency, fixed seed so runs are comparable
+    std::vector<double> seek_samples;
+    std::vector<double> seek_times;
+    int seek_failures = 0;
+    int64_t seek_max_pos = -1;
+    unsigned int seed = 1;
+
+    for (int i = 0; i < options.seeks && duration > 0; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+
+        double timestamp = duration * ((seed >> 8) % 10000) / 10000.0;
+        bench_clock::time_point start = bench_clock::now();
+
+        seek_times.push_back(timestamp);
+
+        if (seek_stream(fmt_ctx, stream_index, timestamp, AVSEEK_FLAG_BACKWARD) < 0 ||
+            read_stream_packet(fmt_ctx, stream_index, packet) < 0)
+        {
+            seek_failures++;
+            continue;
+        }
+
+        WebAVPacket web_packet;
+
+        gen_web_packet(web_packet, packet, stream);
+        seek_max_pos = std::max(seek_max_pos, packet->pos);
+        av_packet_unref(packet);
+        seek_samples.push_back(elapsed_ms(start));
+    }
+
+    // the same targets resolved in one call
+    int batch_packets = 0;
+    bench_clock::time_point batch_start = bench_clock::now();
+
+    get_packets_at(fmt_ctx, stream_index, seek_times, AVSEEK_FLAG_BACKWARD, [&](AVPacket *batch_packet)
+                   {
+        WebAVPacket web_packet;
+
+        gen_web_packet(web_packet, batch_packet, stream);
+        batch_packets++; });
+
+    double batch_ms = elapsed_ms(batch_start);
+
+    // gops up to the same times
+    std::vector<double> frame_samples;
+    int64_t frame_packets = 0;
+
+    for (double timestamp : seek_times)
+    {
+        if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+        {
+            break;
+        }
+
+        std::vector<AVPacketPtr> gop;
+        bench_clock::time_point start = bench_clock::now();
+
+        try
+        {
+            get_frame_packets(fmt_ctx, stream_index, timestamp, gop);
+        }
+        catch (const std::runtime_error &)
+        {
+            continue;
+        }
+
+        for (const AVPacketPtr &gop_packet : gop)
+        {
+            WebAVPacket web_packet;
+
+            gen_web_packet(web_packet, gop_packet.get(), stream);
+        }
+        frame_samples.push_back(elapsed_ms(start));
+        frame_packets += gop.size();
+    }
+
+    // packets of all streams at the same times
+    std::vector<double> each_stream_samples;
+    std::vector<double> single_scan_samples;
+
+    for (double timestamp : seek_times)
+    {
+        bench_clock::time_point start = bench_clock::now();
+
+        seek_each_stream(fmt_ctx, timestamp, packet);
+        each_stream_samples.push_back(elapsed_ms(start));
+
+        std::vector<AVPacketPtr> stream_packets;
+
+        start = bench_clock::now();
+        try
+        {
+            get_stream_packets_at(fmt_ctx, timestamp, AVSEEK_FLAG_BACKWARD, stream_packets);
+        }
+        catch (const std::runtime_error &)
+        {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < stream_packets.size(); i++)
+        {
+            if (stream_packets[i]->buf)
+            {
+                WebAVPacket web_packet;
+
+                gen_web_packet(web_packet, stream_packets[i].get(), fmt_ctx->streams[i]);
+            }
+        }
+        single_scan_samples.push_back(elapsed_ms(start));
+    }
+
+    // linear read from the start
+    seek_stream(fmt_ctx, stream_index, 0, AVSEEK_FLAG_BACKWARD);
+
+    int64_t read_packets = 0;
+    int64_t read_bytes = 0;
+    int64_t read_max_pos = -1;
+    bench_clock::time_point read_start = bench_clock::now();
+
+    while (av_read_frame(fmt_ctx, packet) >= 0)
+    {
+        if (packet->stream_index == stream_index)
+        {
+            if (options.read_seconds > 0 && packet->pts != AV_NOPTS_VALUE &&
+                packet->pts * av_q2d(stream->time_base) > options.read_seconds)
+            {
+                av_packet_unref(packet);
+                break;
+            }
+
+            WebAVPacket web_packet;
+
+            gen_web_packet(web_packet, packet, stream);
+            read_packets++;
+            read_bytes += packet->size;
+            read_max_pos = std::max(read_max_pos, packet->pos);
+        }
+        av_packet_unref(packet);
+    }
+
+    double read_ms = elapsed_ms(read_start);
+
+    // packet index
+    WebPacketIndex packet_index;
+    bench_clock::time_point index_start = bench_clock::now();
+
+    build_packet_index(packet_index, fmt_ctx, stream);
+
+    double index_ms = elapsed_ms(index_start);
+
+    std::string result = "{\"file\":" + json_string(file) +
+                         ",\"format\":" + json_string(fmt_ctx->iformat->name) +
+                         ",\"stream\":{\"index\":" + std::to_string(stream_index) +
+                         ",\"codec\":" + json_string(streams[stream_index].codec_string) + "}" +
+                         ",\"duration\":" + json_number(duration) +
+                         ",\"open_ms\":{" + open_result + "}" +
+                         ",\"seek_ms\":" + json_summary(summarize(seek_samples)) +
+                         ",\"seek_failures\":" + std::to_string(seek_failures) +
+                         ",\"max_pos\":{\"seek\":" + std::to_string(seek_max_pos) +
+                         ",\"read\":" + std::to_string(read_max_pos) + "}" +
+                         ",\"batch_seek\":{\"targets\":" + std::to_string(seek_times.size()) +
+                         ",\"packets\":" + std::to_string(batch_packets) +
+                         ",\"ms\":" + json_number(batch_ms) + "}" +
+                         ",\"frame\":{\"ms\":" + json_summary(summarize(frame_samples)) +
+                         ",\"mean_packets\":" + json_number(frame_samples.empty() ? NAN : (double)frame_packets / frame_samples.size()) + "}" +
+                         ",\"all_streams_ms\":{\"streams\":" + std::to_string(fmt_ctx->nb_streams) +
+                         ",\"seek_each_stream\":" + json_summary(summarize(each_stream_samples)) +
+                         ",\"single_scan\":" + json_summary(summarize(single_scan_samples)) + "}" +
+                         ",\"read\":{\"packets\":" + std::to_string(read_packets) +
+                         ",\"bytes\":" + std::to_string(read_bytes) +
+                         ",\"ms\":" + json_number(read_ms) +
+                         ",\"packets_per_sec\":" + json_number(read_ms > 0 ? read_packets * 1000 / read_ms : NAN) +
+                         ",\"mb_per_sec\":" + json_number(read_ms > 0 ? read_bytes / 1048.576 / read_ms : NAN) + "}" +
+                         ",\"index\":{\"entries\":" + std::to_string(packet_index.pts.size()) +
+                         ",\"ms\":" + json_number(index_ms) + "}}";
+
+    av_packet_free(&packet);
+    avformat_close_input(&fmt_ctx);
+
+    return result;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: web-demuxer-bench [--iterations N] [--seeks N] [--read-seconds S] file...\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+        {
+            options.iterations = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--seeks") && i + 1 < argc)
+        {
+            options.seeks = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--read-seconds") && i + 1 < argc)
+        {
+            options.read_seconds = atof(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else
+        {
+            options.files.push_back(argv[i]);
+        }
+    }
+
+    if (options.files.empty())
+    {
+        usage();
+        return 2;
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    int failures = 0;
+
+    for (const std::string &file : options.files)
+    {
+        try
+        {
+            printf("%s\n", bench_file(file, options).c_str());
+            fflush(stdout);
+        }
+        catch (const std::runtime_error &e)
+        {
+            fprintf(stderr, "%s: %s\n", file.c_str(), e.what());
+            printf("{\"file\":%s,\"error\":%s}\n", json_string(file).c_str(), json_string(e.what()).c_str());
+            failures++;
+        }
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+// Serves one file over HTTP with Range support, a fixed latency before each
+// response and a bandwidth cap per connection, to benchmark URL sources
+// against a slow origin. Used by the "URL Fetch" section of bench/index.html.
+//
+// usage: node bench/throttle-server.mjs <file> [--port 8090] [--latency 100] [--bandwidth 1024]
+//   --latency    ms before each response, default 100
+//   --bandwidth  KB/s per connection, default 1024 (0 for no cap)
+import { createServer } from 'node:http'
+import { createReadStream, statSync } from 'node:fs'
+import { parseArgs } from 'node:util'
+
+const { values, positionals } = parseArgs({
+  allowPositionals: true,
+  options: {
+    port: { type: 'string', default: '8090' },
+    latency: { type: 'string', default: '100' },
+    bandwidth: { type: 'string', default: '1024' },
+  },
+})
+
+if (positionals.length !== 1) {
+  console.error('usage: node bench/throttle-server.mjs <file> [--port 8090] [--latency 100] [--bandwidth 1024]')
+  process.exit(1)
+}
+
+const file = positionals[0]
+const { size, mtimeMs } = statSync(file)
+const latency = Number(values.latency)
+const bytesPerSecond = Number(values.bandwidth) * 1024
+const etag = `"${size.toString(16)}-${Math.floor(mtimeMs).toString(16)}"`
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms))
+
+// the page is on another origin (and cross origin isolated), so allow CORS and
+// expose Content-Range, which the demuxer checks against the requested position
+const corsHeaders = {
+  'Access-Control-Allow-Origin': '*',
+  'Access-Control-Allow-Headers': 'Range',
+  'Access-Control-Expose-Headers': 'Content-Range, Content-Length, ETag',
+  'Cross-Origin-Resource-Policy': 'cross-origin',
+}
+
+// writes [start, end] in 16 KB chunks, pacing them to bytesPerSecond
+async function send(response, start, end) {
+  const stream = createReadStream(file, { start, end, highWaterMark: 16 * 1024 })
+  const began = Date.now()
+  let sent = 0
+
+  response.on('close', () => stream.destroy())
+
+  for await (const chunk of stream) {
+    if (!response.write(chunk)) {
+      await new Promise((resolve) => response.once('drain', resolve))
+    }
+
+    sent += chunk.length
+
+    if (bytesPerSecond > 0) {
+      await sleep(sent / bytesPerSecond * 1000 - (Date.now() - began))
+    }
+  }
+
+  response.end()
+}
+
+createServer(async (request, response) => {
+  if (request.method === 'OPTIONS') {
+    response.writeHead(204, { ...corsHeaders, 'Access-Control-Allow-Methods': 'GET, HEAD' })
+    response.end()
+    return
+  }
+
+  const range = /^bytes=(\d+)-(\d*)$/.exec(request.headers.range || '')
+  const start = range ? Number(range[1]) : 0
+  const end = range && range[2] ? Math.min(Number(range[2]), size - 1) : size - 1
+
+  await sleep(latency)
+
+  if (range && start >= size) {
+    response.writeHead(416, { ...corsHeaders, 'Content-Range': `bytes */${size}` })
+    response.end()
+    return
+  }
+
+  response.writeHead(range ? 206 : 200, {
+    ...corsHeaders,
+    'Accept-Ranges': 'bytes',
+    'Content-Type': 'application/octet-stream',
+    'Content-Length': end - start + 1,
+    ETag: etag,
+    ...(range ? { 'Content-Range': `bytes ${start}-${end}/${size}` } : {}),
+  })
+
+  if (request.method === 'HEAD') {
+    response.end()
+    return
+  }
+
+  await send(response, start, end)
+}).listen(Number(values.port), () => {
+  console.log(`serving ${file} (${size} bytes) on http://localhost:${values.port}/ with ${latency} ms latency, ${values.bandwidth} KB/s per connection`)
+})
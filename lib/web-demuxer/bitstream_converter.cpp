@@ -0,0 +1,250 @@
+#include <cstring>
+#include "bitstream_converter.h"
+
+enum
+{
+    H264_NAL_SPS = 7,
+    H264_NAL_PPS = 8,
+};
+
+bool is_annexb_extradata(const uint8_t *data, int size)
+{
+    return size >= 3 && data[0] == 0 && data[1] == 0 && (data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1));
+}
+
+/** position of the next 00 00 01 at or after p, end if there is none */
+static const uint8_t *next_start_code(const uint8_t *p, const uint8_t *end)
+{
+    for (; p + 2 < end; p++)
+    {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+        {
+            return p;
+        }
+    }
+
+    return end;
+}
+
+/** call on_nal(nal, size) for every NAL unit of an annex-b buffer */
+template <typename F>
+static void for_each_nal(const uint8_t *data, int size, F on_nal)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *p = next_start_code(data, end);
+
+    while (p < end)
+    {
+        const uint8_t *nal = p + 3;
+        const uint8_t *next = next_start_code(nal, end);
+        const uint8_t *nal_end = next;
+
+        // zeros before a start code are the leading byte of a 4 byte start code or trailing padding
+        while (nal_end > nal && nal_end[-1] == 0)
+        {
+            nal_end--;
+        }
+
+        if (nal_end > nal)
+        {
+            on_nal(nal, (int)(nal_end - nal));
+        }
+        p = next;
+    }
+}
+
+BitstreamConverter::BitstreamConverter(AVStream *stream, int format)
+{
+    AVCodecParameters *par = stream->codecpar;
+    bool h264 = par->codec_id == AV_CODEC_ID_H264;
+    bool hevc = par->codec_id == AV_CODEC_ID_HEVC;
+
+    if (format == WEB_BITSTREAM_KEEP || (!h264 && !hevc))
+    {
+        return;
+    }
+
+    bool annexb = par->extradata_size == 0 || is_annexb_extradata(par->extradata, par->extradata_size);
+
+    if (format == WEB_BITSTREAM_ANNEXB)
+    {
+        const AVBitStreamFilter *filter = av_bsf_get_by_name(h264 ? "h264_mp4toannexb" : "hevc_mp4toannexb");
+        int ret;
+
+        if (!filter)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Annex-B bitstream filter is not available\n");
+            throw std::runtime_error("Annex-B bitstream filter is not available");
+        }
+
+        if ((ret = av_bsf_alloc(filter, &bsf_ctx)) < 0 ||
+            (ret = avcodec_parameters_copy(bsf_ctx->par_in, par)) < 0 ||
+            ((bsf_ctx->time_base_in = stream->time_base), (ret = av_bsf_init(bsf_ctx))) < 0)
+        {
+            av_bsf_free(&bsf_ctx);
+            av_log(NULL, AV_LOG_ERROR, "Cannot initialize Annex-B bitstream filter\n");
+            throw std::runtime_error("Cannot initialize Annex-B bitstream filter");
+        }
+        return;
+    }
+
+    if (!annexb)
+    {
+        // already length prefixed, the stream extradata is the record
+        return;
+    }
+
+    if (hevc)
+    {
+        av_log(NULL, AV_LOG_ERROR, "AVCC output is not supported for Annex-B hevc, use Annex-B\n");
+        throw std::runtime_error("AVCC output is not supported for Annex-B hevc, use Annex-B");
+    }
+
+    rewrite_nals = true;
+
+    if (par->extradata_size > 0)
+    {
+        for_each_nal(par->extradata, par->extradata_size, [this](const uint8_t *nal, int size)
+                     { add_parameter_set(nal, size); });
+    }
+}
+
+BitstreamConverter::~BitstreamConverter()
+{
+    av_bsf_free(&bsf_ctx);
+}
+
+void BitstreamConverter::add_parameter_set(const uint8_t *nal, int size)
+{
+    int type = nal[0] & 0x1f;
+    std::vector<std::vector<uint8_t>> *sets = type == H264_NAL_SPS ? &sps : type == H264_NAL_PPS ? &pps : NULL;
+
+    // an SPS needs profile, constraints and level for the record
+    if (!sets || (type == H264_NAL_SPS && size < 4))
+    {
+        return;
+    }
+
+    std::vector<uint8_t> set(nal, nal + size);
+
+    for (const std::vector<uint8_t> &known : *sets)
+    {
+        if (known == set)
+        {
+            return;
+        }
+    }
+
+    // a new SPS / PPS replaces the previous ones (resolution or profile change)
+    if (type == H264_NAL_SPS && !sps.empty())
+    {
+        sps.clear();
+        pps.clear();
+    }
+    sets->push_back(set);
+    record_changed = true;
+}
+
+/** AVCDecoderConfigurationRecord (ISO/IEC 14496-15 5.3.3.1) with 4 byte NAL lengths */
+std::vector<uint8_t> BitstreamConverter::avcc_record() const
+{
+    std::vector<uint8_t> record = {1, sps[0][1], sps[0][2], sps[0][3], 0xff, (uint8_t)(0xe0 | sps.size())};
+
+    for (const std::vector<uint8_t> &set : sps)
+    {
+        record.push_back(set.size() >> 8);
+        record.push_back(set.size() & 0xff);
+        record.insert(record.end(), set.begin(), set.end());
+    }
+
+    record.push_back(pps.size());
+
+    for (const std::vector<uint8_t> &set : pps)
+    {
+        record.push_back(set.size() >> 8);
+        record.push_back(set.size() & 0xff);
+        record.insert(record.end(), set.begin(), set.end());
+    }
+
+    return record;
+}
+
+std::vector<uint8_t> BitstreamConverter::output_extradata() const
+{
+    if (!rewrite_nals || sps.empty() || pps.empty())
+    {
+        return std::vector<uint8_t>();
+    }
+
+    return avcc_record();
+}
+
+int BitstreamConverter::convert(AVPacket *packet)
+{
+    int ret;
+
+    if (bsf_ctx)
+    {
+        // mp4toannexb emits exactly one packet per input packet
+        if ((ret = av_bsf_send_packet(bsf_ctx, packet)) < 0)
+        {
+            return ret;
+        }
+
+        return av_bsf_receive_packet(bsf_ctx, packet);
+    }
+
+    if (!rewrite_nals || packet->size == 0)
+    {
+        return 0;
+    }
+
+    std::vector<uint8_t> out;
+
+    out.reserve(packet->size + 16);
+    for_each_nal(packet->data, packet->size, [this, &out](const uint8_t *nal, int size)
+                 {
+        add_parameter_set(nal, size);
+        out.push_back(size >> 24);
+        out.push_back((size >> 16) & 0xff);
+        out.push_back((size >> 8) & 0xff);
+        out.push_back(size & 0xff);
+        out.insert(out.end(), nal, nal + size); });
+
+    AVPacket *converted = av_packet_alloc();
+
+    if (!converted)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = av_new_packet(converted, out.size())) < 0 ||
+        (ret = av_packet_copy_props(converted, packet)) < 0)
+    {
+        av_packet_free(&converted);
+        return ret;
+    }
+
+    memcpy(converted->data, out.data(), out.size());
+
+    if (record_changed && !sps.empty() && !pps.empty())
+    {
+        std::vector<uint8_t> record = avcc_record();
+        uint8_t *side_data = av_packet_new_side_data(converted, AV_PKT_DATA_NEW_EXTRADATA, record.size());
+
+        if (!side_data)
+        {
+            av_packet_free(&converted);
+            return AVERROR(ENOMEM);
+        }
+
+        memcpy(side_data, record.data(), record.size());
+        record_changed = false;
+    }
+
+    av_packet_unref(packet);
+    av_packet_move_ref(packet, converted);
+    av_packet_free(&converted);
+
+    return 0;
+}
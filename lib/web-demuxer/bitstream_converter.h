@@ -0,0 +1,86 @@
+/**
+ * h264 / hevc bitstream conversion for WebCodecs, part of the demux core.
+ */
+#ifndef BITSTREAM_CONVERTER_H
+#define BITSTREAM_CONVERTER_H
+
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavformat/avformat.h>
+};
+
+/**
+ * packet bitstream format of h264 / hevc streams
+ *   KEEP: as demuxed
+ *   ANNEXB: start code prefixed NAL units with in-band parameter sets,
+ *     decoded by WebCodecs without a description
+ *   AVCC: length prefixed NAL units, decoded with the avcC / hvcC record
+ *     as description
+ */
+enum WebBitstreamFormat
+{
+    WEB_BITSTREAM_KEEP = 0,
+    WEB_BITSTREAM_ANNEXB = 1,
+    WEB_BITSTREAM_AVCC = 2,
+};
+
+/** whether extradata is annex-b (start code prefixed) instead of an avcC / hvcC record */
+bool is_annexb_extradata(const uint8_t *data, int size);
+
+/**
+ * BitstreamConverter rewrites the packets of one h264 / hevc stream in place:
+ *   ANNEXB: FFmpeg's h264_mp4toannexb / hevc_mp4toannexb bitstream filters,
+ *     which pass annex-b input through
+ *   AVCC: avcC / hvcC input is passed through, annex-b h264 is rewritten to
+ *     4 byte length prefixes by a NAL scanner and its avcC record is
+ *     synthesized from the SPS / PPS found in the extradata or the packets
+ * whenever the output record is created or changes, the packet gets it as
+ * AV_PKT_DATA_NEW_EXTRADATA side data, to (re)configure the decoder with.
+ * other codecs and KEEP are passed through (active() is false).
+ */
+class BitstreamConverter
+{
+public:
+    /** throws std::runtime_error if the conversion is not supported for the stream */
+    BitstreamConverter(AVStream *stream, int format);
+    ~BitstreamConverter();
+
+    BitstreamConverter(const BitstreamConverter &) = delete;
+    BitstreamConverter &operator=(const BitstreamConverter &) = delete;
+
+    bool active() const
+    {
+        return bsf_ctx != NULL || rewrite_nals;
+    }
+
+    /** whether annex-b h264 is rewritten to AVCC with a synthesized avcC record */
+    bool synthesizes_record() const
+    {
+        return rewrite_nals;
+    }
+
+    /** the synthesized avcC record from the parameter sets seen so far, empty if incomplete */
+    std::vector<uint8_t> output_extradata() const;
+
+    /** convert packet in place, returns 0 or a negative AVERROR */
+    int convert(AVPacket *packet);
+
+private:
+    AVBSFContext *bsf_ctx = NULL;
+    bool rewrite_nals = false;
+    /** parameter sets of the synthesized avcC, and whether it changed since the last packet */
+    std::vector<std::vector<uint8_t>> sps;
+    std::vector<std::vector<uint8_t>> pps;
+    bool record_changed = false;
+
+    void add_parameter_set(const uint8_t *nal, int size);
+    std::vector<uint8_t> avcc_record() const;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "fragment_muxer.h"
+#include "web_demuxer_core.h"
+
+// fragments are cut by flush (frag_custom), the moov is written with the header and no mfra index at the end
+static const char *fragment_movflags = "frag_custom+empty_moov+default_base_moof+skip_trailer";
+
+FragmentMuxer::FragmentMuxer(AVFormatContext *in_ctx, const std::vector<int> &stream_indexes, const char *format)
+{
+    if (avformat_alloc_output_context2(&out_ctx, NULL, format, NULL) < 0 || !out_ctx)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find muxer %s\n", format);
+        throw std::runtime_error("Cannot find muxer");
+    }
+
+    stream_map = std::vector<int>(in_ctx->nb_streams, -1);
+    time_bases = std::vector<AVRational>(in_ctx->nb_streams);
+
+    for (int stream_index : stream_indexes)
+    {
+        if (stream_index < 0 || stream_index >= (int)in_ctx->nb_streams || stream_map[stream_index] >= 0)
+        {
+            close();
+            av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
+            throw std::runtime_error("Cannot find wanted stream in the input file");
+        }
+
+        AVStream *in_stream = in_ctx->streams[stream_index];
+        AVStream *out_stream = avformat_new_stream(out_ctx, NULL);
+
+        if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) < 0)
+        {
+            close();
+            av_log(NULL, AV_LOG_ERROR, "Cannot allocate output stream\n");
+            throw std::runtime_error("Cannot allocate output stream");
+        }
+
+        // the input container's tag may not be valid in the output one
+        out_stream->codecpar->codec_tag = 0;
+        out_stream->time_base = in_stream->time_base;
+        stream_map[stream_index] = out_stream->index;
+        time_bases[stream_index] = in_stream->time_base;
+    }
+
+    if (avio_open_dyn_buf(&out_ctx->pb) < 0)
+    {
+        close();
+        av_log(NULL, AV_LOG_ERROR, "Cannot allocate output buffer\n");
+        throw std::runtime_error("Cannot allocate output buffer");
+    }
+}
+
+FragmentMuxer::~FragmentMuxer()
+{
+    close();
+}
+
+void FragmentMuxer::close()
+{
+    if (out_ctx && out_ctx->pb)
+    {
+        uint8_t *buffer = NULL;
+
+        avio_close_dyn_buf(out_ctx->pb, &buffer);
+        av_free(buffer);
+        out_ctx->pb = NULL;
+    }
+
+    avformat_free_context(out_ctx);
+    out_ctx = NULL;
+    av_freep(&segment);
+    size = 0;
+}
+
+int FragmentMuxer::take_segment()
+{
+    av_freep(&segment);
+    size = avio_close_dyn_buf(out_ctx->pb, &segment);
+    out_ctx->pb = NULL;
+
+    return avio_open_dyn_buf(&out_ctx->pb);
+}
+
+int FragmentMuxer::set_extradata(int stream_index, const uint8_t *data, size_t size)
+{
+    if (stream_index < 0 || stream_index >= (int)stream_map.size() || stream_map[stream_index] < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+
+    return set_stream_extradata(out_ctx->streams[stream_map[stream_index]], data, size);
+}
+
+int FragmentMuxer::write_header()
+{
+    AVDictionary *options = NULL;
+    int ret;
+
+    // muxers other than mov / mp4 leave the option unused
+    av_dict_set(&options, "movflags", fragment_movflags, 0);
+    ret = avformat_write_header(out_ctx, &options);
+    av_dict_free(&options);
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    return take_segment();
+}
+
+int FragmentMuxer::write(AVPacket *packet)
+{
+    int stream_index = packet->stream_index;
+    int ret = 0;
+
+    if (stream_index >= 0 && stream_index < (int)stream_map.size() && stream_map[stream_index] >= 0)
+    {
+        AVStream *out_stream = out_ctx->streams[stream_map[stream_index]];
+
+        // the muxer may have changed the output time base in write_header
+        av_packet_rescale_ts(packet, time_bases[stream_index], out_stream->time_base);
+        packet->stream_index = out_stream->index;
+        packet->pos = -1;
+        ret = av_write_frame(out_ctx, packet);
+    }
+
+    av_packet_unref(packet);
+
+    return ret;
+}
+
+int FragmentMuxer::flush()
+{
+    int ret = av_write_frame(out_ctx, NULL);
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    return take_segment();
+}
+
+int FragmentMuxer::finish()
+{
+    int ret = av_write_trailer(out_ctx);
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    return take_segment();
+}
@@ -0,0 +1,82 @@
+/**
+ * in memory remux to fragmented mp4, part of the demux core.
+ */
+#ifndef FRAGMENT_MUXER_H
+#define FRAGMENT_MUXER_H
+
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+};
+
+/**
+ * FragmentMuxer writes packets of some input streams to a muxer (fragmented
+ * mp4 for "mp4") without decoding. each call that completes a segment leaves
+ * it in segment_data() / segment_size() until the next one:
+ *   write_header: the init segment (ftyp + empty moov)
+ *   flush: the fragment (moof + mdat) of the packets written since the last one
+ *   finish: the last fragment
+ */
+class FragmentMuxer
+{
+public:
+    /** throws std::runtime_error if there is no such muxer or a stream cannot be added */
+    FragmentMuxer(AVFormatContext *in_ctx, const std::vector<int> &stream_indexes, const char *format);
+    ~FragmentMuxer();
+
+    FragmentMuxer(const FragmentMuxer &) = delete;
+    FragmentMuxer &operator=(const FragmentMuxer &) = delete;
+
+    /** replace the extradata of the output stream of an input stream, before write_header, returns >= 0 or a negative AVERROR */
+    int set_extradata(int stream_index, const uint8_t *data, size_t size);
+
+    /** returns 0 or a negative AVERROR */
+    int write_header();
+
+    /** write a packet of an input stream (others are ignored), the packet is unreferenced, returns 0 or a negative AVERROR */
+    int write(AVPacket *packet);
+
+    /** returns 0 or a negative AVERROR */
+    int flush();
+
+    /** returns 0 or a negative AVERROR */
+    int finish();
+
+    /** codec parameters of the output stream of an input stream, NULL if it is not muxed */
+    AVCodecParameters *output_codecpar(int stream_index) const
+    {
+        return stream_index >= 0 && stream_index < (int)stream_map.size() && stream_map[stream_index] >= 0
+                   ? out_ctx->streams[stream_map[stream_index]]->codecpar
+                   : NULL;
+    }
+
+    const uint8_t *segment_data() const
+    {
+        return segment;
+    }
+
+    int segment_size() const
+    {
+        return size;
+    }
+
+private:
+    AVFormatContext *out_ctx = NULL;
+    /** per input stream index: output stream index or -1, and the input time base */
+    std::vector<int> stream_map;
+    std::vector<AVRational> time_bases;
+    uint8_t *segment = NULL;
+    int size = 0;
+
+    /** move the bytes written so far into segment and start a new output buffer */
+    int take_segment();
+    void close();
+};
+
+#endif
@@ -1,4 +1,10 @@
+// blocks the worker, without spinning where SharedArrayBuffer is available
 function sleep(duration) {
+  if (typeof SharedArrayBuffer !== 'undefined') {
+    Atomics.wait(new Int32Array(new SharedArrayBuffer(4)), 0, 0, duration);
+    return;
+  }
+
   const start = Date.now();
 
   while (Date.now() - start < duration) {
@@ -6,35 +12,51 @@ function sleep(duration) {
   }
 }
 
-function retry(fn, retries = 3, delay = 500) {
+// up to retries attempts (at least one), waiting delay, 2 * delay, 4 * delay, ... in between
+function retry(fn, retries = 3, delay = 250) {
   let attempt = 0;
 
+  retries = Math.max(retries, 1);
+
   while (attempt < retries) {
     try {
       return fn();
     } catch (error) {
+      // a response with the wrong bytes or a client error would fail again
+      if (error.permanent) {
+        throw error;
+      }
+
       console.warn(`Attempt ${attempt + 1} failed: ${error.message}`);
       attempt++;
       if (attempt >= retries) {
         throw new Error(`Failed after ${retries} attempts`);
       }
-      sleep(delay)
+      sleep(delay * 2 ** (attempt - 1));
     }
   }
 }
 
-function getFileSize(url) {
+function getFileInfo(url) {
   const xhr = new XMLHttpRequest();
   xhr.open('HEAD', url, false);
   xhr.send();
 
   if (xhr.status !== 200) {
-    throw new Error(`getFileSize request failed: ${url}`);
+    throw new Error(`getFileInfo request failed: ${url}`);
   }
 
-  const size = parseInt(xhr.getResponseHeader('Content-Length'));
+  const size = Number(xhr.getResponseHeader('Content-Length'));
+
+  if (!Number.isSafeInteger(size) || size < 0) {
+    throw new Error(`getFileInfo no valid Content-Length: ${url}`);
+  }
 
-  return size;
+  return {
+    size,
+    // identifies the version of the resource, empty if the server sends neither
+    validator: xhr.getResponseHeader('ETag') || xhr.getResponseHeader('Last-Modified') || '',
+  };
 }
 
 function fetchArrayBuffer(url, position, length) {
@@ -46,59 +68,809 @@ function fetchArrayBuffer(url, position, length) {
   xhr.send();
 
   if (xhr.status !== 206 && xhr.status !== 200) {
-    throw new Error(`fetchArrayBuffer request failed: ${url}`);
+    const error = new Error(`fetchArrayBuffer request failed: ${url}`);
+
+    // client errors other than timeouts and rate limits do not go away
+    error.permanent = xhr.status >= 400 && xhr.status < 500 && xhr.status !== 408 && xhr.status !== 429;
+    throw error;
+  }
+
+  // a server ignoring Range sends the file from its start, a server or proxy
+  // with 32 bit offsets may send another range, both would be read as the
+  // bytes at position. Content-Range is only readable if exposed by CORS
+  const contentRange = xhr.status === 206 ? xhr.getResponseHeader('Content-Range') : null;
+  const rangeStart = contentRange ? Number((/^bytes (\d+)-/.exec(contentRange) || [])[1]) : xhr.status === 200 ? 0 : position;
+
+  if (rangeStart !== position) {
+    const error = new Error(`fetchArrayBuffer got bytes from ${rangeStart} instead of ${position}: ${url}`);
+
+    error.permanent = true;
+    throw error;
   }
 
   return xhr.response;
 }
 
-class WorkerFile {
-  constructor(source) {
-    let file
+// slot states of FetchEngine, the same values are used in fetchWorkerMain
+const FETCH_IDLE = 0;
+const FETCH_PENDING = 1;
+const FETCH_DONE = 2;
+const FETCH_FAILED = 3;
+const FETCH_WRONG_RANGE = -2;
+
+/**
+ * Runs in the helper worker of a FetchEngine: each request is a ranged fetch()
+ * retried with exponential backoff (with jitter), whose bytes are written into
+ * its slot of the shared buffer before the slot state is set and notified.
+ * results[slot] is the byte count, or -1 (network error), -2 (another range
+ * was sent) or -status. started from its source text, so it only uses its own scope.
+ */
+function fetchWorkerMain() {
+  const DONE = 2;
+  const FAILED = 3;
+  let states, results, data, slotSize;
+
+  async function fetchRange({ url, position, length, retries, retryDelay }, view) {
+    for (let attempt = 0; ; attempt++) {
+      let result = -1;
+
+      try {
+        const response = await fetch(url, { headers: { Range: `bytes=${position}-${position + length - 1}` } });
+
+        if (response.status === 206 || response.status === 200) {
+          // see fetchArrayBuffer, a 200 is the file from its start
+          const contentRange = response.status === 206 ? response.headers.get('Content-Range') : null;
+          const start = contentRange ? Number((/^bytes (\d+)-/.exec(contentRange) || [])[1]) : response.status === 200 ? 0 : position;
+
+          if (start !== position) {
+            response.body && response.body.cancel();
+            return -2;
+          }
+
+          const reader = response.body.getReader();
+          let written = 0;
+
+          while (written < length) {
+            const { done, value } = await reader.read();
 
-    if (typeof source === 'string') {
-      file = new File([], encodeURIComponent(source)); // create a placeholder file
+            if (done) break;
 
-      // rewrite WORKERFS.stream_ops.read to support read from url
-      // https://github.com/emscripten-core/emscripten/blob/main/src/library_workerfs.js#L127-L133
-      FS.filesystems.WORKERFS.stream_ops.read = function read(stream, buffer, offset, length, position) {
-        const url = decodeURIComponent(stream.node.contents.name);
+            const size = Math.min(value.byteLength, length - written);
 
-        if (stream.node.size === 0) {
-          stream.node.size = retry(() => getFileSize(url)) // rewrite the size
+            view.set(value.subarray(0, size), written);
+            written += size;
+          }
+
+          // a server ignoring Range sends more than asked for
+          reader.cancel();
+
+          return written;
+        }
+
+        response.body && response.body.cancel();
+        result = -response.status;
+
+        // client errors other than timeouts and rate limits do not go away
+        if (response.status >= 400 && response.status < 500 && response.status !== 408 && response.status !== 429) {
+          return result;
         }
+      } catch (e) {
+        // network error, retried
+      }
+
+      if (attempt + 1 >= retries) {
+        return result;
+      }
+
+      await new Promise((resolve) => setTimeout(resolve, retryDelay * 2 ** attempt * (0.5 + Math.random())));
+    }
+  }
 
-        if (position >= stream.node.size) return 0;
+  self.onmessage = async ({ data: message }) => {
+    if (message.type === 'init') {
+      states = new Int32Array(message.states);
+      results = new Int32Array(message.results);
+      data = message.data;
+      slotSize = message.slotSize;
+      self.postMessage({ type: 'ready' });
+      return;
+    }
 
-        const ab = retry(() => fetchArrayBuffer(url, position, length));
-        const byteLength = ab.byteLength;
+    const { slot } = message;
+    const result = await fetchRange(message, new Uint8Array(data, slot * slotSize, message.length));
 
-        buffer.set(new Uint8Array(ab), offset);
+    results[slot] = result;
+    Atomics.store(states, slot, result >= 0 ? DONE : FAILED);
+    Atomics.notify(states, slot);
+  };
+}
 
-        return byteLength;
+/**
+ * FetchEngine keeps up to concurrency ranged fetches of at most slotSize bytes
+ * in flight in a helper worker (fetchWorkerMain), so the synchronous read
+ * callback can start read-ahead ranges in parallel and wait with Atomics.wait,
+ * without spinning, only for the range it needs.
+ * needs SharedArrayBuffer, i.e. a cross origin isolated page.
+ */
+class FetchEngine {
+  constructor(concurrency, slotSize) {
+    this.concurrency = concurrency;
+    this.slotSize = slotSize;
+    this.states = new Int32Array(new SharedArrayBuffer(concurrency * 4));
+    this.results = new Int32Array(new SharedArrayBuffer(concurrency * 4));
+    this.data = new SharedArrayBuffer(concurrency * slotSize);
+    this.worker = new Worker(URL.createObjectURL(new Blob([`(${fetchWorkerMain})()`], { type: 'text/javascript' })));
+  }
+
+  // the helper only starts while this worker is idle, so it must not be waited for synchronously before
+  start() {
+    return new Promise((resolve, reject) => {
+      this.worker.onmessage = () => resolve(this);
+      this.worker.onerror = (e) => reject(new Error("fetch engine failed to start: " + e.message));
+      this.worker.postMessage({
+        type: 'init',
+        states: this.states.buffer,
+        results: this.results.buffer,
+        data: this.data,
+        slotSize: this.slotSize,
+      });
+    });
+  }
+
+  terminate() {
+    this.worker.terminate();
+  }
+
+  // a free slot, -1 if all are in flight
+  freeSlot() {
+    for (let slot = 0; slot < this.concurrency; slot++) {
+      if (Atomics.load(this.states, slot) === FETCH_IDLE) {
+        return slot;
       }
-    } else {
-      file = source;
     }
 
-    this.mountPoint = "/data";
-    this.mountOpts = {
-      files: [file],
+    return -1;
+  }
+
+  fetch(slot, url, position, length, retries, retryDelay) {
+    Atomics.store(this.states, slot, FETCH_PENDING);
+    this.worker.postMessage({ slot, url, position, length, retries, retryDelay });
+  }
+
+  done(slot) {
+    return Atomics.load(this.states, slot) !== FETCH_PENDING;
+  }
+
+  // wait for the fetch of slot and free it, returns its bytes, valid until the slot is fetched into again
+  wait(slot) {
+    while (Atomics.load(this.states, slot) === FETCH_PENDING) {
+      Atomics.wait(this.states, slot, FETCH_PENDING);
+    }
+
+    const state = Atomics.load(this.states, slot);
+    const result = this.results[slot];
+    const bytes = state === FETCH_DONE ? new Uint8Array(this.data, slot * this.slotSize, result) : undefined;
+
+    Atomics.store(this.states, slot, FETCH_IDLE);
+
+    if (!bytes) {
+      const error = new Error(
+        result === FETCH_WRONG_RANGE ? "fetch got another range than requested" : `fetch failed${result < -1 ? " with status " + -result : ""}`
+      );
+
+      error.permanent = result === FETCH_WRONG_RANGE;
+      throw error;
+    }
+
+    return bytes;
+  }
+}
+
+/**
+ * Block aligned LRU cache for url range reads, shared by every UrlSource of
+ * the worker so repeated calls on the same url reuse fetched blocks, as long
+ * as the file info requested on each load of the url is unchanged.
+ * sequential reads grow an adaptive read-ahead window (in blocks). with a
+ * FetchEngine the window is fetched as up to concurrency parallel requests and
+ * a read only waits for the blocks it needs, otherwise by one sync XHR.
+ */
+class UrlBlockCache {
+  constructor(options = {}) {
+    this.blocks = new Map(); // `${url}:${blockIndex}` => Uint8Array, in LRU order
+    this.fileInfos = new Map(); // url => { size, validator }
+    this.readStates = new Map(); // url => { lastBlock, readAhead }
+    this.inflight = new Map(); // `${url}:${blockIndex}` => fetch of the engine that brings the block
+    this.fetches = []; // { slot, url, fromBlock, toBlock } in flight, oldest first
+    this.engine = undefined;
+    this.memory = 0;
+    this.stats = {
+      hits: 0,
+      misses: 0,
+      requests: 0,
+      bytesFetched: 0,
+    };
+    // the engine is started by setUrlCacheOptions, it cannot start synchronously
+    this.setOptions(options, false);
+  }
+
+  setOptions({
+    // 0 is a valid value except for blockSize
+    blockSize = this.blockSize || 256 * 1024,
+    maxMemory = this.maxMemory ?? 64 * 1024 * 1024,
+    maxReadAhead = this.maxReadAhead ?? 16,
+    concurrency = this.concurrency ?? 4,
+    retries = this.retries ?? 3,
+    retryDelay = this.retryDelay ?? 250,
+  } = {}, start = true) {
+    const restart = start && (
+      !this.engineStarted || blockSize !== this.blockSize || maxReadAhead !== this.maxReadAhead || concurrency !== this.concurrency
+    );
+
+    if (blockSize !== this.blockSize) {
+      this.clear();
+    }
+
+    this.blockSize = blockSize;
+    this.maxMemory = maxMemory;
+    this.maxReadAhead = maxReadAhead;
+    this.concurrency = concurrency;
+    this.retries = retries;
+    this.retryDelay = retryDelay;
+    this.evict();
+
+    return restart ? this.startEngine() : this.engineStarted;
+  }
+
+  // reads use sync XHR until the engine is ready, or if it cannot run here
+  startEngine() {
+    this.drain();
+    this.engine?.terminate();
+    this.engine = undefined;
+
+    if (this.concurrency <= 1 || typeof SharedArrayBuffer === 'undefined' || !self.crossOriginIsolated || typeof Worker === 'undefined') {
+      this.engineStarted = Promise.resolve();
+      return this.engineStarted;
+    }
+
+    const blocksPerFetch = Math.max(1, Math.ceil(this.maxReadAhead / this.concurrency));
+    let engine;
+
+    try {
+      engine = new FetchEngine(this.concurrency, blocksPerFetch * this.blockSize);
+    } catch (e) {
+      this.engineStarted = Promise.resolve();
+      return this.engineStarted;
+    }
+
+    const started = engine.start().then(
+      () => {
+        // options changed again while starting
+        if (this.engineStarted === started) {
+          this.engine = engine;
+        } else {
+          engine.terminate();
+        }
+      },
+      () => engine.terminate()
+    );
+
+    this.engineStarted = started;
+
+    return started;
+  }
+
+  getStats() {
+    return {
+      ...this.stats,
+      memory: this.memory,
+      blocks: this.blocks.size,
+      concurrency: this.engine ? this.engine.concurrency : 1,
+      inflight: this.fetches.length,
     };
-    this.filePath = this.mountPoint + "/" + file.name;
   }
 
-  mount() {
-    FS.mkdir(this.mountPoint);
-    FS.mount(FS.filesystems.WORKERFS, this.mountOpts, this.mountPoint);
+  clear() {
+    this.drain();
+    this.blocks.clear();
+    this.readStates.clear();
+    this.memory = 0;
+  }
+
+  getFileInfo(url) {
+    return this.fileInfos.get(url) || this.revalidate(url);
+  }
+
+  // request the file info again (each time the url is loaded), what is cached of another
+  // version of the file is dropped. without a validator a change cannot be told
+  revalidate(url) {
+    const info = retry(() => getFileInfo(url));
+    const cached = this.fileInfos.get(url);
+
+    if (cached && (cached.size !== info.size || cached.validator !== info.validator || !info.validator)) {
+      this.drop(url);
+    }
+
+    this.fileInfos.set(url, info);
+
+    return info;
+  }
+
+  // drop the blocks and read state of url, waiting for its fetches in flight
+  drop(url) {
+    for (const fetch of this.fetches.filter((fetch) => fetch.url === url)) {
+      this.fetches.splice(this.fetches.indexOf(fetch), 1);
+
+      for (let blockIndex = fetch.fromBlock; blockIndex <= fetch.toBlock; blockIndex++) {
+        this.inflight.delete(url + ":" + blockIndex);
+      }
+
+      try {
+        this.engine.wait(fetch.slot);
+      } catch (e) {
+        // dropped
+      }
+    }
+
+    const prefix = url + ":";
+
+    for (const [key, block] of this.blocks) {
+      // keys of another url may start with this one
+      if (key.startsWith(prefix) && /^\d+$/.test(key.slice(prefix.length))) {
+        this.blocks.delete(key);
+        this.memory -= block.byteLength;
+      }
+    }
+
+    this.readStates.delete(url);
+  }
+
+  getFileSize(url) {
+    return this.getFileInfo(url).size;
+  }
+
+  read(url, buffer, offset, length, position) {
+    const size = this.getFileSize(url);
+
+    if (position >= size) return 0;
+
+    this.harvest();
+
+    length = Math.min(length, size - position);
+
+    const blockSize = this.blockSize;
+    const firstBlock = Math.floor(position / blockSize);
+    const lastBlock = Math.floor((position + length - 1) / blockSize);
+    const readAhead = this.updateReadAhead(url, firstBlock, lastBlock);
+    let written = 0;
+
+    for (let blockIndex = firstBlock; blockIndex <= lastBlock; blockIndex++) {
+      let block = this.getBlock(url, blockIndex);
+
+      if (!block && this.inflight.has(url + ":" + blockIndex)) {
+        // read ahead, already requested. if it failed the block is requested again below
+        try {
+          this.completeFetch(this.inflight.get(url + ":" + blockIndex));
+        } catch (e) {
+          // dropped
+        }
+        block = this.getBlock(url, blockIndex);
+      }
+
+      if (block) {
+        this.stats.hits++;
+      } else {
+        this.stats.misses++;
+        block = this.fetchBlocks(url, blockIndex, Math.max(lastBlock, blockIndex + readAhead), size);
+      }
+
+      const blockStart = blockIndex * blockSize;
+      const start = Math.max(position, blockStart) - blockStart;
+      const end = Math.min(position + length - blockStart, block.byteLength);
+
+      buffer.set(block.subarray(start, end), offset + written);
+      written += end - start;
+
+      // a response cut short mid-file, the next block does not follow these bytes
+      if (block.byteLength < blockSize && blockStart + block.byteLength < size) {
+        if (written > 0) break;
+
+        throw new Error(`UrlBlockCache read got ${block.byteLength} bytes of block ${blockIndex}: ${url}`);
+      }
+    }
+
+    return written;
+  }
+
+  getBlock(url, blockIndex) {
+    const key = url + ":" + blockIndex;
+    const block = this.blocks.get(key);
+
+    if (block) {
+      // move to the most recently used end
+      this.blocks.delete(key);
+      this.blocks.set(key, block);
+    }
+
+    return block;
+  }
+
+  updateReadAhead(url, firstBlock, lastBlock) {
+    const state = this.readStates.get(url) || { lastBlock: -2, readAhead: 0 };
+    const sequential = firstBlock === state.lastBlock || firstBlock === state.lastBlock + 1;
+
+    state.readAhead = sequential
+      ? Math.min(Math.max(state.readAhead * 2, 1), this.maxReadAhead)
+      : 0;
+    state.lastBlock = lastBlock;
+    this.readStates.set(url, state);
+
+    return state.readAhead;
+  }
+
+  has(url, blockIndex) {
+    const key = url + ":" + blockIndex;
+
+    return this.blocks.has(key) || this.inflight.has(key);
+  }
+
+  // fetch [fromBlock, toBlock] in one range request, stopping at the first cached block,
+  // returns fromBlock
+  fetchBlocks(url, fromBlock, toBlock, size) {
+    const blockSize = this.blockSize;
+    const maxBlock = Math.ceil(size / blockSize) - 1;
+
+    toBlock = Math.min(toBlock, maxBlock);
+
+    if (this.engine) {
+      return this.fetchBlocksConcurrently(url, fromBlock, toBlock, size);
+    }
+
+    for (let blockIndex = fromBlock + 1; blockIndex <= toBlock; blockIndex++) {
+      if (this.blocks.has(url + ":" + blockIndex)) {
+        toBlock = blockIndex - 1;
+        break;
+      }
+    }
+
+    const position = fromBlock * blockSize;
+    const length = Math.min((toBlock + 1) * blockSize, size) - position;
+    const data = new Uint8Array(retry(() => fetchArrayBuffer(url, position, length), this.retries, this.retryDelay));
+
+    return this.addBlocks(url, fromBlock, toBlock, data);
+  }
+
+  // fetch [fromBlock, toBlock] as requests of at most one engine slot each, skipping cached or
+  // requested blocks, and wait only for the one with fromBlock. read-ahead takes free slots only
+  fetchBlocksConcurrently(url, fromBlock, toBlock, size) {
+    const blocksPerFetch = this.engine.slotSize / this.blockSize;
+    let first;
+
+    for (let start = fromBlock; start <= toBlock; ) {
+      let end = start;
+
+      while (end < toBlock && end - start + 1 < blocksPerFetch && !this.has(url, end + 1)) {
+        end++;
+      }
+
+      if (this.engine.freeSlot() < 0) {
+        if (first) break;
+
+        this.completeOldest();
+      }
+
+      const fetch = this.startFetch(url, start, end, size);
+
+      first = first || fetch;
+
+      for (start = end + 1; start <= toBlock && this.has(url, start); start++);
+    }
+
+    return this.completeFetch(first);
+  }
+
+  startFetch(url, fromBlock, toBlock, size) {
+    const position = fromBlock * this.blockSize;
+    const length = Math.min((toBlock + 1) * this.blockSize, size) - position;
+    const fetch = { slot: this.engine.freeSlot(), url, fromBlock, toBlock };
+
+    this.engine.fetch(fetch.slot, url, position, length, this.retries, this.retryDelay);
+    this.fetches.push(fetch);
+
+    for (let blockIndex = fromBlock; blockIndex <= toBlock; blockIndex++) {
+      this.inflight.set(url + ":" + blockIndex, fetch);
+    }
+
+    return fetch;
+  }
+
+  // wait for a fetch and cache its blocks, returns its first block, throws if it failed
+  completeFetch(fetch) {
+    this.fetches.splice(this.fetches.indexOf(fetch), 1);
+
+    for (let blockIndex = fetch.fromBlock; blockIndex <= fetch.toBlock; blockIndex++) {
+      this.inflight.delete(fetch.url + ":" + blockIndex);
+    }
+
+    return this.addBlocks(fetch.url, fetch.fromBlock, fetch.toBlock, this.engine.wait(fetch.slot));
+  }
+
+  // cache read-ahead that has arrived, a failed one is requested again when read
+  harvest() {
+    if (!this.engine) return;
+
+    for (const fetch of this.fetches.filter((fetch) => this.engine.done(fetch.slot))) {
+      try {
+        this.completeFetch(fetch);
+      } catch (e) {
+        // dropped
+      }
+    }
+  }
+
+  // free a slot for the block a read waits for
+  completeOldest() {
+    try {
+      this.completeFetch(this.fetches[0]);
+    } catch (e) {
+      // dropped
+    }
+  }
+
+  // wait for every fetch in flight, dropping its bytes
+  drain() {
+    for (const fetch of this.fetches) {
+      try {
+        this.engine.wait(fetch.slot);
+      } catch (e) {
+        // dropped
+      }
+    }
+
+    this.fetches = [];
+    this.inflight.clear();
+  }
+
+  // returns the block at fromBlock, a block cut short mid-file is not cached
+  addBlocks(url, fromBlock, toBlock, data) {
+    const blockSize = this.blockSize;
+    const size = this.getFileSize(url);
+    let first;
+
+    this.stats.requests++;
+    this.stats.bytesFetched += data.byteLength;
+
+    for (let blockIndex = fromBlock; blockIndex <= toBlock; blockIndex++) {
+      const start = (blockIndex - fromBlock) * blockSize;
+
+      if (start >= data.byteLength) break;
+
+      // copy out so a single evicted block does not pin the whole response
+      const block = data.slice(start, start + blockSize);
+
+      first = first || block;
+
+      if (block.byteLength < blockSize && blockIndex * blockSize + block.byteLength < size) {
+        break;
+      }
+
+      this.blocks.set(url + ":" + blockIndex, block);
+      this.memory += block.byteLength;
+    }
+
+    this.evict();
+
+    return first || new Uint8Array(0);
+  }
+
+  evict() {
+    for (const [key, block] of this.blocks) {
+      if (this.memory <= this.maxMemory) break;
+
+      this.blocks.delete(key);
+      this.memory -= block.byteLength;
+    }
+  }
+}
+
+const urlBlockCache = new UrlBlockCache();
+
+/**
+ * Byte sources read synchronously by the AVIOContext callbacks in
+ * web_demuxer.cpp (WebIOContext): size() returns the total size in bytes,
+ * read(position, view) fills view and returns the bytes written, 0 at end.
+ */
+class FileSource {
+  constructor(file) {
+    this.file = file;
+    this.reader = new FileReaderSync();
+  }
+
+  size() {
+    return this.file.size;
+  }
+
+  // Blobs without a name (e.g. collected from a stream) have no identity
+  identity() {
+    const { name, size, lastModified } = this.file;
+
+    return name !== undefined ? `file:${name}:${size}:${lastModified}` : undefined;
+  }
+
+  read(position, view) {
+    if (position >= this.file.size) return 0;
+
+    const ab = this.reader.readAsArrayBuffer(this.file.slice(position, position + view.length));
+
+    view.set(new Uint8Array(ab));
+
+    return ab.byteLength;
+  }
+}
+
+class UrlSource {
+  constructor(url) {
+    this.url = url;
+  }
+
+  size() {
+    return urlBlockCache.getFileSize(this.url);
+  }
+
+  identity() {
+    const { validator } = urlBlockCache.getFileInfo(this.url);
+
+    return validator ? `url:${this.url}:${validator}` : undefined;
   }
 
-  unmount() {
-    FS.unmount(this.mountPoint);
-    FS.rmdir(this.mountPoint);
+  read(position, view) {
+    return urlBlockCache.read(this.url, view, 0, view.length, position);
   }
 }
 
+class MemorySource {
+  constructor(buffer) {
+    this.data = ArrayBuffer.isView(buffer)
+      ? new Uint8Array(buffer.buffer, buffer.byteOffset, buffer.byteLength)
+      : new Uint8Array(buffer);
+  }
+
+  size() {
+    return this.data.byteLength;
+  }
+
+  read(position, view) {
+    if (position >= this.data.byteLength) return 0;
+
+    const chunk = this.data.subarray(position, position + view.length);
+
+    view.set(chunk);
+
+    return chunk.byteLength;
+  }
+}
+
+// layout of the control buffer, shared with PushSource in src/push-source.ts
+const PUSH_WRITE_SEQ = 0;
+const PUSH_READ_SEQ = 1;
+const PUSH_ENDED = 2;
+const PUSH_WRITTEN = 2;
+const PUSH_RELEASED = 3;
+
+/**
+ * Bytes appended on the main thread into a SharedArrayBuffer ring, read in
+ * order: read() waits with Atomics.wait until bytes at position arrive or the
+ * source ends. Consumed bytes are released to the writer, except for a margin
+ * behind the read position for short backward seeks of the demuxer.
+ * The size is unknown, so the io context is not seekable.
+ */
+class PushSource {
+  constructor({ buffer, control }) {
+    this.data = new Uint8Array(buffer);
+    this.state = new Int32Array(control);
+    this.positions = new Float64Array(control);
+    this.keepBehind = Math.min(1024 * 1024, buffer.byteLength >> 2);
+  }
+
+  size() {
+    return -1;
+  }
+
+  read(position, view) {
+    const { data, state, positions } = this;
+    const capacity = data.byteLength;
+    let written;
+
+    while (true) {
+      const writeSeq = Atomics.load(state, PUSH_WRITE_SEQ);
+
+      written = positions[PUSH_WRITTEN];
+
+      if (position < positions[PUSH_RELEASED]) {
+        throw new Error("push source position " + position + " was already released");
+      }
+
+      if (position < written) break;
+
+      if (Atomics.load(state, PUSH_ENDED)) return 0;
+
+      Atomics.wait(state, PUSH_WRITE_SEQ, writeSeq);
+    }
+
+    const length = Math.min(view.length, written - position);
+    const start = position % capacity;
+    const head = Math.min(length, capacity - start);
+
+    view.set(data.subarray(start, start + head));
+    view.set(data.subarray(0, length - head), head);
+
+    const released = position + length - this.keepBehind;
+
+    if (released > positions[PUSH_RELEASED]) {
+      positions[PUSH_RELEASED] = released;
+      Atomics.add(state, PUSH_READ_SEQ, 1);
+      Atomics.notify(state, PUSH_READ_SEQ);
+    }
+
+    return length;
+  }
+}
+
+function createSource(source) {
+  if (source && source.buffer instanceof SharedArrayBuffer && source.control instanceof SharedArrayBuffer) {
+    return new PushSource(source);
+  }
+
+  if (typeof source === 'string') {
+    return new UrlSource(source);
+  }
+
+  if (source instanceof Blob) {
+    return new FileSource(source);
+  }
+
+  if (source instanceof ArrayBuffer || ArrayBuffer.isView(source)) {
+    return new MemorySource(source);
+  }
+
+  throw new Error("unsupported source type");
+}
+
+function getSourceIdentity(source) {
+  try {
+    return source.identity ? source.identity() : undefined;
+  } catch(e) {
+    return undefined;
+  }
+}
+
+// errors thrown in js must not unwind through libavformat, report them as io errors,
+// reads are counted in stats (see SessionStats)
+function guardSource(source, stats) {
+  return {
+    size() {
+      try {
+        return source.size();
+      } catch(e) {
+        console.error("source size failed: " + e.message);
+        return -1;
+      }
+    },
+    read(position, view) {
+      try {
+        const bytes = source.read(position, view);
+
+        stats.readCalls++;
+        stats.bytesRead += Math.max(bytes, 0);
+
+        return bytes;
+      } catch(e) {
+        console.error("source read failed: " + e.message);
+        return -1;
+      }
+    },
+  };
+}
+
 function avStreamToObject(avStream) {
   const extradata = new Uint8Array(avStream.extradata);
   const tags = {};
@@ -147,14 +919,20 @@ function avStreamToObject(avStream) {
 }
 
 function avPacketToObject(avPacket) {
-  const data = new Uint8Array(avPacket.data);
+  // zero copy packets already own a js buffer, others are views on the wasm heap
+  const data = avPacket.zero_copy ? avPacket.data : new Uint8Array(avPacket.data);
 
   const result = {
+    stream_index: avPacket.stream_index,
     keyframe: avPacket.keyframe,
     timestamp: avPacket.timestamp,
+    dts: avPacket.dts,
     duration: avPacket.duration,
+    pos: avPacket.pos,
+    flags: avPacket.flags,
     size: avPacket.size,
-    data
+    data,
+    side_data: avPacket.side_data
   };
 
   avPacket.delete();
@@ -162,196 +940,774 @@ function avPacketToObject(avPacket) {
   return result;
 }
 
-function getAVStream(source, type = 0, streamIndex = -1) {
-  const workerFile = new WorkerFile(source);
+// cached metadata is handed out as copies, extradata buffers are transferred to the caller
+function cloneStreamObject(stream) {
+  return { ...stream, extradata: stream.extradata.slice(), tags: { ...stream.tags } };
+}
 
-  workerFile.mount();
+function cloneMediaInfo(mediaInfo) {
+  return { ...mediaInfo, streams: mediaInfo.streams.map(cloneStreamObject) };
+}
 
-  try {
-    const avStream = Module.get_av_stream(workerFile.filePath, type, streamIndex);
+// annex-b extradata (start code prefixed) is no valid description, the parameter sets are in band
+function isAnnexBExtradata(data) {
+  return data.length >= 3 && data[0] === 0 && data[1] === 0 && (data[2] === 1 || (data[2] === 0 && data[3] === 1));
+}
 
-    return avStreamToObject(avStream);
-  } catch(e) {
-    throw new Error("get_av_stream failed: " + e.message);
-  } finally {
-    workerFile.unmount()
+// VideoDecoderConfig / AudioDecoderConfig shaped object of a stream, null for other media types
+function genDecoderConfig(stream) {
+  const description = stream.extradata.length > 0 && !isAnnexBExtradata(stream.extradata) ? stream.extradata : undefined;
+
+  if (stream.codec_type === 0) {
+    return { codec: stream.codec_string, codedWidth: stream.width, codedHeight: stream.height, description };
+  }
+
+  if (stream.codec_type === 1) {
+    return { codec: stream.codec_string, sampleRate: stream.sample_rate, numberOfChannels: stream.channels, description };
   }
+
+  return null;
 }
 
-function getAVStreams(source) {
-  const workerFile = new WorkerFile(source);
+function cloneDecoderConfig(config) {
+  return config && { ...config, description: config.description && config.description.slice() };
+}
 
-  workerFile.mount();
+const AV_PKT_DATA_NEW_EXTRADATA = 1;
 
-  try {
-    const avStreamList = Module.get_av_streams(workerFile.filePath);
-    const result = [] 
+// ============ stats and trace ============
+// upper bounds in ms of the seek latency histogram, the last bucket counts slower seeks
+const SEEK_LATENCY_BOUNDS = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000];
 
-    for (let i = 0; i < avStreamList.streams.size(); i++) {
-      result.push(avStreamToObject(avStreamList.streams.get(i)));
+let traceEnabled = false;
+
+/**
+ * post a trace event of a phase that ran from start to end (performance.now()
+ * of the worker), startTime is sent on the epoch as the page has another time origin
+ */
+function postTraceEvent(name, start, end, detail) {
+  if (!traceEnabled) return;
+
+  self.postMessage({
+    type: "TraceEvent",
+    result: { name, startTime: performance.timeOrigin + start, duration: end - start, detail },
+  });
+}
+
+/**
+ * Counters of one loaded source, kept by its DemuxSession
+ */
+class SessionStats {
+  constructor(urlStats) {
+    this.probeMs = 0;
+    this.seeks = 0;
+    this.seekMs = 0;
+    this.seekLatency = new Array(SEEK_LATENCY_BOUNDS.length + 1).fill(0);
+    this.readCalls = 0;
+    this.bytesRead = 0;
+    this.packets = 0;
+    this.bytes = 0;
+    // the url block cache is shared by the worker, report what changed since the load
+    this.urlBaseline = urlStats;
+  }
+
+  addSeek(ms) {
+    const bucket = SEEK_LATENCY_BOUNDS.findIndex((bound) => ms <= bound);
+
+    this.seeks++;
+    this.seekMs += ms;
+    this.seekLatency[bucket < 0 ? SEEK_LATENCY_BOUNDS.length : bucket]++;
+  }
+
+  addBatch(batch) {
+    this.packets += batch.size;
+
+    for (let i = 0; i < batch.size; i++) {
+      this.bytes += batch.fields[i * 4 + 3];
     }
+  }
+
+  toObject() {
+    const base = this.urlBaseline;
+    const url = base ? urlBlockCache.getStats() : undefined;
+
+    return {
+      probeMs: this.probeMs,
+      seeks: this.seeks,
+      seekMs: this.seekMs,
+      seekLatency: { bounds: SEEK_LATENCY_BOUNDS.slice(), counts: this.seekLatency.slice() },
+      readCalls: this.readCalls,
+      bytesRead: this.bytesRead,
+      urlRequests: url ? url.requests - base.requests : 0,
+      urlBytesFetched: url ? url.bytesFetched - base.bytesFetched : 0,
+      urlCacheHits: url ? url.hits - base.hits : 0,
+      urlCacheMisses: url ? url.misses - base.misses : 0,
+      packets: this.packets,
+      bytes: this.bytes,
+      heapSize: Module.get_memory_stats().heapSize,
+    };
+  }
+}
+
+const PROBE_POLICIES = { default: 0, fast: 1, thorough: 2 };
+const BITSTREAM_FORMATS = { keep: 0, annexb: 1, avcc: 2 };
+// AVMediaType video, audio, data, subtitle, attachment
+const DEFAULT_STREAM_TYPES = [0, 1, 2, 3, 4];
+
+/**
+ * DemuxSession keeps a native WebDemuxerSession (one probed AVFormatContext
+ * reading from the js source) alive until destroy() is called.
+ * with options.metadata ({ identity, mediaInfo } of an earlier load of the
+ * same source version) stream metadata is served from it and the source is
+ * opened without probing where the container allows it.
+ */
+class DemuxSession {
+  constructor(source, options = {}) {
+    this.activeReads = 0;
+    this.destroyed = false;
 
-    avStreamList.streams.delete();
+    try {
+      const jsSource = createSource(source);
+      const { metadata } = options;
+
+      if (jsSource instanceof UrlSource) {
+        urlBlockCache.revalidate(jsSource.url);
+      }
+
+      this.push = jsSource instanceof PushSource;
+      this.stats = new SessionStats(jsSource instanceof UrlSource ? urlBlockCache.getStats() : undefined);
+      this.identity = options.cacheMetadata ? getSourceIdentity(jsSource) : undefined;
+      this.mediaInfo = metadata && this.identity && metadata.identity === this.identity ? metadata.mediaInfo : undefined;
+      this.source = guardSource(jsSource, this.stats);
+      this.sessionOptions = {
+        zero_copy: options.zeroCopy !== false,
+        io_buffer_size: options.ioBufferSize || 32 * 1024,
+        probe: PROBE_POLICIES[options.probe] || 0,
+        header_only: !!this.mediaInfo,
+        bitstream_format: 0,
+      };
+
+      const start = performance.now();
+
+      this.session = new Module.WebDemuxerSession(this.source, this.sessionOptions);
+
+      if (this.mediaInfo && metadata.defaultStreams) {
+        for (const [type, streamIndex] of Object.entries(metadata.defaultStreams)) {
+          this.session.set_default_stream(Number(type), streamIndex);
+        }
+      }
+
+      const end = performance.now();
+
+      this.stats.probeMs = end - start;
+      postTraceEvent("probe", start, end, { probe: options.probe || "default", headerOnly: this.sessionOptions.header_only });
+    } catch(e) {
+      throw new Error("create session failed: " + e.message);
+    }
+  }
+
+  getStats() {
+    try {
+      return this.stats.toObject();
+    } catch(e) {
+      throw new Error("get_stats failed: " + e.message);
+    }
+  }
+
+  // random access call: counted and timed as one seek (the seek and the reads to the wanted packets)
+  seek(method, fn) {
+    const start = performance.now();
+    const result = fn();
+    const end = performance.now();
+
+    this.stats.addSeek(end - start);
+    postTraceEvent("seek", start, end, { method });
 
     return result;
-  } catch(e) {
-    throw new Error("get_av_streams failed: " + e.message);
-  } finally {
-    workerFile.unmount();
   }
-}
 
-function getMediaInfo(source) {
-  const workerFile = new WorkerFile(source);
+  // metadata to cache for later loads of this source, undefined if it has no identity
+  getMetadata() {
+    if (!this.identity) {
+      return undefined;
+    }
 
-  workerFile.mount();
+    const mediaInfo = this.getMediaInfo();
+    const defaultStreams = {};
 
-  try {
-    const mediaInfo = Module.get_media_info(workerFile.filePath);
+    // a header only open of the cached source resolves streamIndex -1 from these
+    for (const type of DEFAULT_STREAM_TYPES) {
+      try {
+        defaultStreams[type] = this.session.find_stream(type, -1);
+      } catch(e) {
+        // no stream of this type
+      }
+    }
+
+    return { identity: this.identity, mediaInfo, defaultStreams };
+  }
+
+  // stream objects and decoder configs are converted once, and again only for
+  // the streams whose version changed (new in-band extradata)
+  getStreamCache() {
+    const version = this.session.get_streams_version();
+    let cache = this.streamCache;
+
+    if (!cache) {
+      let streams;
+
+      if (this.mediaInfo && version === 0) {
+        streams = this.mediaInfo.streams.slice();
+      } else {
+        const avStreamList = this.session.get_av_streams();
+
+        streams = [];
+
+        for (let i = 0; i < avStreamList.streams.size(); i++) {
+          streams.push(avStreamToObject(avStreamList.streams.get(i)));
+        }
+
+        avStreamList.streams.delete();
+      }
+
+      cache = this.streamCache = {
+        version,
+        versions: streams.map((_, i) => this.session.get_stream_version(i)),
+        streams,
+        configs: streams.map(genDecoderConfig),
+        // per stream index, see getDecoderConfig
+        avccRecords: {},
+      };
+    } else if (cache.version !== version) {
+      for (let i = 0; i < cache.streams.length; i++) {
+        const streamVersion = this.session.get_stream_version(i);
+
+        if (streamVersion !== cache.versions[i]) {
+          cache.streams[i] = avStreamToObject(this.session.get_av_stream_at(i));
+          cache.configs[i] = genDecoderConfig(cache.streams[i]);
+          cache.versions[i] = streamVersion;
+          delete cache.avccRecords[i];
+        }
+      }
+
+      cache.version = version;
+    }
+
+    return cache;
+  }
+
+  getAVStream(type = 0, streamIndex = -1) {
+    try {
+      return cloneStreamObject(this.getStreamCache().streams[this.session.find_stream(type, streamIndex)]);
+    } catch(e) {
+      throw new Error("get_av_stream failed: " + e.message);
+    }
+  }
+
+  getAVStreams() {
+    try {
+      return this.getStreamCache().streams.map(cloneStreamObject);
+    } catch(e) {
+      throw new Error("get_av_streams failed: " + e.message);
+    }
+  }
+
+  // the description follows the bitstream format the packets are read in
+  getDecoderConfig(type = 0, streamIndex = -1, bitstreamFormat = "keep") {
+    try {
+      const index = this.session.find_stream(type, streamIndex);
+      const cache = this.getStreamCache();
+      const config = cloneDecoderConfig(cache.configs[index]);
+
+      if (config && bitstreamFormat === "annexb") {
+        // annex-b packets carry their parameter sets in band
+        config.description = undefined;
+      } else if (config && bitstreamFormat === "avcc" && !config.description) {
+        // annex-b h264 read as avcc, described by the avcC synthesized by the converter
+        if (!(index in cache.avccRecords)) {
+          cache.avccRecords[index] = this.session.get_output_extradata(index, BITSTREAM_FORMATS.avcc);
+        }
+
+        config.description = cache.avccRecords[index] && cache.avccRecords[index].slice();
+      }
+
+      return config;
+    } catch(e) {
+      throw new Error("get_decoder_config failed: " + e.message);
+    }
+  }
+
+  getMediaInfo() {
+    try {
+      if (!this.mediaInfo) {
+        this.mediaInfo = this.convertMediaInfo();
+      }
+
+      // the format info never changes, the streams come from the cache
+      return cloneMediaInfo({ ...this.mediaInfo, streams: this.getStreamCache().streams });
+    } catch(e) {
+      throw new Error("get_media_info failed: " + e.message);
+    }
+  }
+
+  // format info of the session, the streams are those of the stream cache
+  convertMediaInfo() {
+    const mediaInfo = this.session.get_media_info();
     const result = {
       format_name: mediaInfo.format_name,
       duration: mediaInfo.duration,
       bit_rate: mediaInfo.bit_rate,
       start_time: mediaInfo.start_time,
       nb_streams: mediaInfo.nb_streams,
-      streams: []
+      streams: this.getStreamCache().streams.slice()
     };
 
-    for (let i = 0; i < mediaInfo.streams.size(); i++) {
-      result.streams.push(avStreamToObject(mediaInfo.streams.get(i)));
-    }
-
     mediaInfo.streams.delete();
 
     return result;
-  } catch(e) {
-    throw new Error("get_media_info failed: " + e.message);
-  } finally {
-    workerFile.unmount();
   }
-}
 
-function getAVPacket(source, time, type = 0, streamIndex = -1, seekFlag = 1) {
-  const workerFile = new WorkerFile(source);
+  getAVPacket(time, type = 0, streamIndex = -1, seekFlag = 1) {
+    try {
+      const avPacket = this.seek("getAVPacket", () => this.session.get_av_packet(time, type, streamIndex, seekFlag));
 
-  workerFile.mount();
+      this.stats.packets++;
+      this.stats.bytes += avPacket.size;
 
-  try {
-    const avPacket = Module.get_av_packet(workerFile.filePath, time, type, streamIndex, seekFlag);
+      return avPacketToObject(avPacket);
+    } catch(e) {
+      throw new Error("get_av_packet failed: " + e.message);
+    }
+  }
 
-    return avPacketToObject(avPacket);
-  } catch(e) {
-    throw new Error("get_av_packet failed: " + e.message);
-  } finally {
-    workerFile.unmount()
+  getAVPackets(time, seekFlag = 1) {
+    try {
+      const avPacketList = this.seek("getAVPackets", () => this.session.get_av_packets(time, seekFlag));
+      const result = [];
+
+      for (let i = 0; i < avPacketList.packets.size(); i++) {
+        const avPacket = avPacketToObject(avPacketList.packets.get(i));
+
+        // streams without a packet near time get an empty one
+        if (avPacket.size > 0) {
+          this.stats.packets++;
+          this.stats.bytes += avPacket.size;
+        }
+
+        result.push(avPacket);
+      }
+
+      avPacketList.packets.delete();
+
+      return result;
+    } catch(e) {
+      throw new Error("get_av_packets failed: " + e.message);
+    }
   }
-}
 
-function getAVPackets(source, time, seekFlag = 1) {
-  const workerFile = new WorkerFile(source);
+  getAVPacketsAt(times, type = 0, streamIndex = -1, seekFlag = 1) {
+    try {
+      const result = this.seek("getAVPacketsAt", () => this.session.get_av_packets_at(times, type, streamIndex, seekFlag));
 
-  workerFile.mount();
+      this.stats.addBatch(result.packets);
 
-  try {
-    const avPacketList = Module.get_av_packets(workerFile.filePath, time, seekFlag);
-    const result = [];
+      return result;
+    } catch(e) {
+      throw new Error("get_av_packets_at failed: " + e.message);
+    }
+  }
 
-    for (let i = 0; i < avPacketList.packets.size(); i++) {
-      result.push(avPacketToObject(avPacketList.packets.get(i)));
+  getFramePackets(time, streamIndex = -1, withAudio = true) {
+    try {
+      const result = this.seek("getFramePackets", () => this.session.get_frame_packets(time, streamIndex, withAudio));
+
+      this.stats.addBatch(result.video);
+
+      if (result.audio) {
+        this.stats.addBatch(result.audio);
+      }
+
+      return result;
+    } catch(e) {
+      throw new Error("get_frame_packets failed: " + e.message);
     }
+  }
 
-    avPacketList.packets.delete();
+  getPacketIndex(type = 0, streamIndex = -1) {
+    try {
+      return this.session.get_packet_index(type, streamIndex);
+    } catch(e) {
+      throw new Error("get_packet_index failed: " + e.message);
+    }
+  }
 
-    return result;
-  } catch(e) {
-    throw new Error("get_av_packets failed: " + e.message);
-  } finally {
-    workerFile.unmount()
+  setPacketIndex(index) {
+    try {
+      this.session.set_packet_index(index);
+    } catch(e) {
+      throw new Error("set_packet_index failed: " + e.message);
+    }
   }
-}
 
-async function readAVPacket(
-  msgId,
-  source,
-  start = 0,
-  end = 0,
-  type = 0,
-  streamIndex = -1,
-  seekFlag = 1
-) {
-  const workerFile = new WorkerFile(source);
+  // a push source is read once, in order, from the session context (no reprobe),
+  // start, end, seekFlag and bitstreamFormat do not apply
+  createPushReader(streamIndices) {
+    const session = this.session;
 
-  workerFile.mount();
+    return {
+      done: false,
+      next(batchSize, batchBytes) {
+        const batch = session.read_next(streamIndices, batchSize, batchBytes);
 
-  try {
-    const result = await Module.read_av_packet(workerFile.filePath, start, end, type, streamIndex, seekFlag, {
-      sendAVPacket: genSendAVPacket(msgId),
-    });
+        this.done = batch.size === 0;
+
+        return batch;
+      },
+      delete() {},
+    };
+  }
+
+  // forward new in-band extradata seen by a reader to the session streams, before the batch is transferred
+  trackExtradata(batch) {
+    const sideData = batch.side_data;
+
+    for (let i = 0; i < sideData.length; i += 4) {
+      if (sideData[i + 1] === AV_PKT_DATA_NEW_EXTRADATA) {
+        const offset = sideData[i + 2];
 
-    if (result === 0) {
-      throw new Error("return 0");
+        this.session.update_extradata(batch.fields[sideData[i] * 4], batch.data.subarray(offset, offset + sideData[i + 3]));
+      }
     }
-  } catch(e) {
-    throw new Error("read_av_packet failed: " + e.message);
-  } finally {
-    workerFile.unmount()
-  }
-}
-
-// ============ js methods called in c ============
-// eslint-disable-next-line @typescript-eslint/no-unused-vars
-function genSendAVPacket(messageId) {
-  return function sendAVPacket(avPacket) {
-    return new Promise((resolve) => {
-        const postData = {
-          type: "AVPacketStream",
-          msgId: messageId,
-          result: null,
-        };
-
-        if (avPacket === 0) {
-          self.postMessage(postData);
-          resolve(1);
-          return;
+  }
+
+  async readAVPacket(
+    msgId,
+    start = 0,
+    end = 0,
+    type = 0,
+    streamIndex = -1,
+    seekFlag = 1,
+    batchSize = 1,
+    batchBytes = 0,
+    streamIndices = undefined,
+    batched = false,
+    bitstreamFormat = undefined
+  ) {
+    const traceStart = performance.now();
+    const { stats } = this;
+    const packets = stats.packets;
+    const bytes = stats.bytes;
+    let reader;
+
+    if (this.push && this.activeReads > 0) {
+      throw new Error("read_av_packet failed: a push source is read by one stream at a time");
+    }
+
+    this.activeReads++;
+
+    try {
+      const readerOptions = { ...this.sessionOptions, bitstream_format: BITSTREAM_FORMATS[bitstreamFormat] || 0 };
+
+      // with streamIndices all of them are read in one pass, always sent as batches tagged by stream
+      if (this.push) {
+        reader = this.createPushReader(streamIndices || [this.session.find_stream(type, streamIndex)]);
+      } else {
+        reader = streamIndices
+          ? new Module.WebAVPacketReader(this.session, readerOptions, start, end, streamIndices, seekFlag)
+          : new Module.WebAVPacketReader(this.session, readerOptions, start, end, type, streamIndex, seekFlag);
+      }
+
+      const batching = batched || !!streamIndices || batchSize > 1 || batchBytes > 0;
+
+      // the reader is pulled once per ReadNextAVPacket of the consumer
+      while (true) {
+        const batch = reader.next(batching ? batchSize : 1, batching ? batchBytes : 0);
+
+        if (batch.size === 0) {
+          break;
         }
 
-        const result = avPacketToObject(avPacket);
+        stats.addBatch(batch);
 
-        postData.result = result;
-        self.postMessage(postData, [result.data.buffer]);
+        // converted packets carry the extradata of the output format, not of the source
+        if (!this.push && readerOptions.bitstream_format === 0) {
+          this.trackExtradata(batch);
+        }
 
-        const msgListener = (event) => {
-          const { type, msgId } = event.data;
+        if (batching) {
+          postAVPacketBatch(msgId, batch);
+        } else {
+          postAVPacket(msgId, batchToAVPacket(batch));
+        }
 
-          if (msgId === messageId) {
-            if (type === "ReadNextAVPacket") {
-              self.removeEventListener("message", msgListener);
-              resolve(1);
-            } else if (type === "StopReadAVPacket") {
-              self.removeEventListener("message", msgListener);
-              resolve(0);
-            }
-          }
-        };
+        if (reader.done || !(await waitForReadNext(msgId))) {
+          break;
+        }
+      }
 
-        self.addEventListener("message", msgListener);
-      });
+      // end of stream
+      postAVPacket(msgId, null);
+    } catch(e) {
+      throw new Error("read_av_packet failed: " + e.message);
+    } finally {
+      if (reader) {
+        reader.delete();
+      }
+
+      // the packets of concurrent reads are counted in both events
+      postTraceEvent("read", traceStart, performance.now(), { packets: stats.packets - packets, bytes: stats.bytes - bytes });
+
+      this.activeReads--;
+
+      if (this.destroyed && this.activeReads === 0) {
+        this.release();
+      }
+    }
   }
+
+  // best video stream first (it leads the fragments), then the first audio stream
+  getRemuxStreams() {
+    const { streams } = this.getStreamCache();
+    const video = streams.find((stream) => stream.codec_type === 0);
+    const audio = streams.find((stream) => stream.codec_type === 1);
+
+    return [video, audio].filter((stream) => stream).map((stream) => stream.index);
+  }
+
+  // MSE type of the remuxed streams, e.g. video/mp4; codecs="avc1.64001f, mp4a.40.2"
+  // codecs are the codec strings of the output streams (see WebRemuxer::next)
+  getRemuxMimeType(streamIndices, format, codecs) {
+    const { streams } = this.getStreamCache();
+    const remuxed = streamIndices.map((index) => streams[index]);
+    const container = remuxed.some((stream) => stream.codec_type === 0) ? "video" : "audio";
+
+    return `${container}/${format}; codecs="${codecs.join(", ")}"`;
+  }
+
+  async remuxRange(msgId, start = 0, end = 0, streamIndices = undefined, format = "mp4") {
+    const traceStart = performance.now();
+    let segments = 0;
+    let bytes = 0;
+    let remuxer;
+
+    this.activeReads++;
+
+    try {
+      if (this.push) {
+        throw new Error("push sources are only read with readAVPacket");
+      }
+
+      const indices = streamIndices && streamIndices.length > 0 ? streamIndices : this.getRemuxStreams();
+
+      remuxer = new Module.WebRemuxer(this.session, this.sessionOptions, start, end, indices, format);
+
+      // one segment per ReadNextAVPacket of the consumer, the init segment first
+      while (true) {
+        const segment = remuxer.next();
+
+        if (!segment) {
+          break;
+        }
+
+        if (segment.init) {
+          segment.mimeType = this.getRemuxMimeType(indices, format, segment.codecs.filter((codec) => codec));
+          delete segment.codecs;
+        }
+
+        segments++;
+        bytes += segment.data.byteLength;
+        postRemuxSegment(msgId, segment);
+
+        if (!(await waitForReadNext(msgId))) {
+          break;
+        }
+      }
+
+      // end of stream
+      postAVPacket(msgId, null);
+    } catch(e) {
+      throw new Error("remux_range failed: " + e.message);
+    } finally {
+      if (remuxer) {
+        remuxer.delete();
+      }
+
+      postTraceEvent("remux", traceStart, performance.now(), { segments, bytes });
+
+      this.activeReads--;
+
+      if (this.destroyed && this.activeReads === 0) {
+        this.release();
+      }
+    }
+  }
+
+  destroy() {
+    if (this.destroyed) return;
+
+    this.destroyed = true;
+
+    // a pending read stream still uses the native session, release after it ends
+    if (this.activeReads === 0) {
+      this.release();
+    }
+  }
+
+  release() {
+    this.session.delete();
+  }
+}
+
+function createSession(source, options) {
+  return new DemuxSession(source, options);
+}
+
+// ============ packet stream messages ============
+function waitForReadNext(messageId) {
+  return new Promise((resolve) => {
+    const msgListener = (event) => {
+      const { type, msgId } = event.data;
+
+      if (msgId === messageId) {
+        if (type === "ReadNextAVPacket") {
+          self.removeEventListener("message", msgListener);
+          resolve(true);
+        } else if (type === "StopReadAVPacket") {
+          self.removeEventListener("message", msgListener);
+          resolve(false);
+        }
+      }
+    };
+
+    self.addEventListener("message", msgListener);
+  });
+}
+
+const AV_PKT_FLAG_KEY = 1;
+
+// the first record of a batch (see WebAVPacketBatch in web_demuxer.cpp) as a packet
+function batchToAVPacket(batch) {
+  const size = batch.fields[3];
+  const sideData = [];
+
+  for (let i = 0; i < batch.side_data.length; i += 4) {
+    const offset = batch.side_data[i + 2];
+
+    sideData.push({
+      type: batch.side_data[i + 1],
+      data: batch.data.subarray(offset, offset + batch.side_data[i + 3])
+    });
+  }
+
+  return {
+    stream_index: batch.fields[0],
+    keyframe: batch.fields[1] & AV_PKT_FLAG_KEY,
+    timestamp: batch.times[0],
+    dts: batch.times[1],
+    duration: batch.times[2],
+    pos: batch.times[3],
+    flags: batch.fields[1],
+    size,
+    // side data follows the payload in the batch buffer
+    data: sideData.length > 0 ? batch.data.subarray(0, size) : batch.data,
+    side_data: sideData
+  };
+}
+
+// a null packet ends the stream
+function postAVPacket(messageId, packet) {
+  self.postMessage(
+    {
+      type: "AVPacketStream",
+      msgId: messageId,
+      result: packet,
+    },
+    packet ? [packet.data.buffer] : []
+  );
+}
+
+function postAVPacketBatch(messageId, batch) {
+  self.postMessage(
+    {
+      type: "AVPacketBatchStream",
+      msgId: messageId,
+      result: batch,
+    },
+    [batch.times.buffer, batch.fields.buffer, batch.side_data.buffer, batch.data.buffer]
+  );
+}
+
+function postRemuxSegment(messageId, segment) {
+  self.postMessage(
+    {
+      type: "RemuxSegmentStream",
+      msgId: messageId,
+      result: segment,
+    },
+    [segment.data.buffer]
+  );
 }
 
 function setAVLogLevel(level) {
   Module.set_av_log_level(level);
 }
 
+// resolves once the fetch engine for the options is ready
+function setUrlCacheOptions(options) {
+  return urlBlockCache.setOptions(options);
+}
+
+function getUrlCacheStats() {
+  return urlBlockCache.getStats();
+}
+
+// growths of the wasm memory, counted by wrapping its grow (see countHeapGrowths)
+let heapGrowths = 0;
+
+// count every growth of the memory where the runtime grows it, instead of comparing sampled sizes
+function countHeapGrowths(memory) {
+  const grow = memory.grow;
+
+  memory.grow = function (delta) {
+    const result = grow.call(this, delta);
+
+    heapGrowths++;
+
+    return result;
+  };
+}
+
+function getMemoryStats() {
+  return { ...Module.get_memory_stats(), heapGrowths };
+}
+
+// trace events are posted as "TraceEvent" messages, av_log lines become "log" events
+function setTrace(enabled) {
+  traceEnabled = enabled;
+  Module.set_av_log_forwarding(enabled);
+}
+
+// called by forward_av_log in web_demuxer.cpp
+function onAVLog(level, line) {
+  const now = performance.now();
+
+  postTraceEvent("log", now, now, { level, message: line.trimEnd() });
+}
+
 // ============ Module Register ============
-Module.getAVStream = getAVStream;
-Module.getAVStreams = getAVStreams;
-Module.getMediaInfo = getMediaInfo;
-Module.getAVPacket = getAVPacket;
-Module.getAVPackets = getAVPackets;
-Module.readAVPacket = readAVPacket;
+Module.createSession = createSession;
 Module.setAVLogLevel = setAVLogLevel;
+Module.setUrlCacheOptions = setUrlCacheOptions;
+Module.getUrlCacheStats = getUrlCacheStats;
+Module.getMemoryStats = getMemoryStats;
+Module.setTrace = setTrace;
+Module.onAVLog = onAVLog;
 
 Module.onRuntimeInitialized = () => {
+  // wasmMemory is the memory of the module this file is appended to
+  if (typeof wasmMemory !== 'undefined') {
+    countHeapGrowths(wasmMemory);
+  }
+
   self.postMessage({ type: "WASMRuntimeInitialized" });
 };
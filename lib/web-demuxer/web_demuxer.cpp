@@ -1,613 +1,1308 @@
 #include <string>
-#include <sstream>
 #include <cstdint>
 #include <vector>
+#include <map>
+#include <deque>
+#include <cmath>
+#include <cstdarg>
 #include <emscripten.h>
+#include <emscripten/heap.h>
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
 
-using namespace emscripten;
+#include "web_demuxer_core.h"
+#include "bitstream_converter.h"
+#include "fragment_muxer.h"
 
-extern "C"
+typedef struct WebSessionOptions
 {
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavutil/avutil.h>
-#include <libavutil/display.h>
-#include <libavutil/pixdesc.h>
-#include <libavcodec/codec_id.h>
-#include "video_codec_string.h"
-#include "audio_codec_string.h"
-};
-
-typedef struct Tag
+    bool zero_copy;
+    int io_buffer_size;
+    /** WebProbePolicy */
+    int probe;
+    /** stream metadata is served from a cache, open without probing where possible */
+    bool header_only;
+    /** WebBitstreamFormat of h264 / hevc packets, used by readers */
+    int bitstream_format;
+} WebSessionOptions;
+
+/**
+ * zero_copy writes the payload once, from the demuxer's AVPacket buffer into a
+ * Uint8Array allocated on the js heap, which the worker can transfer as is.
+ * otherwise the payload is copied into web_packet.data (and copied again in js).
+ */
+void gen_web_packet(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream, bool zero_copy)
 {
-    std::string key;
-    std::string value;
-} Tag;
+    if (!zero_copy)
+    {
+        gen_web_packet(web_packet, packet, stream);
+        return;
+    }
 
-typedef struct WebAVStream
-{
-    int index;
-    int id;
-    /** Codec Info from codecpar */
-    int codec_type;
-    std::string codec_type_string;
-    std::string codec_name;
-    std::string codec_string;
-    std::string profile;
-    std::string pix_fmt;
-    std::string color_primaries;
-    std::string color_transfer;
-    std::string color_space;
-    std::string color_range;
-    int level;
-    int width;
-    int height;
-    int channels;
-    int sample_rate;
-    std::string sample_fmt;
-    std::string bit_rate;
-    int extradata_size;
-    std::vector<uint8_t> extradata;
-    val get_extradata() const{
-        return val(typed_memory_view(extradata.size(), extradata.data()));
-    }
-    /** Other Info */
-    std::string r_frame_rate;
-    std::string avg_frame_rate;
-    std::string sample_aspect_ratio;
-    std::string display_aspect_ratio;
-    double start_time;
-    double duration;
-    double rotation;
-    std::string nb_frames;
-    std::vector<Tag> tags;
-} WebAVStream;
-
-typedef struct WebAVPacket
-{
-    int keyframe;
-    double timestamp;
-    double duration;
-    int size;
-    std::vector<uint8_t> data;
-    val get_data() const{
-        return val(typed_memory_view(data.size(), data.data()));
+    gen_web_packet_info(web_packet, packet, stream);
+    web_packet.js_data = val::global("Uint8Array").new_(packet->size);
+    if (packet->size > 0)
+    {
+        web_packet.js_data.call<void>("set", val(typed_memory_view(packet->size, packet->data)));
     }
-} WebAVPacket;
+}
 
-typedef struct WebAVStreamList
+/** copy size bytes at data into the js typed array target at offset */
+static void set_js_bytes(val &target, int64_t offset, const uint8_t *data, size_t size)
 {
-    int size;
-    std::vector<WebAVStream> streams;
-} WebAVStreamList;
+    if (size > 0)
+    {
+        target.call<void>("set", val(typed_memory_view(size, data)), (double)offset);
+    }
+}
 
-typedef struct WebAVPacketList
+/**
+ * WebAVPacketBatch collects the packets of one read round trip and hands them
+ * to js as flat records, so no per packet object crosses the binding:
+ *   times:     Float64Array, per packet [pts, dts, duration] in seconds (NaN if
+ *              unknown) and [pos] in bytes (-1 if unknown)
+ *   fields:    Int32Array, per packet [stream_index, flags (AV_PKT_FLAG_*), offset, size]
+ *   side_data: Int32Array, per side data entry [packet, type, offset, size]
+ *   data:      each payload followed by its side data, back to back,
+ *              offset/size locate each one
+ * the whole batch is posted with one message and four transferred buffers.
+ * the packets are referenced in the owner's PacketArena until to_js, which
+ * writes each payload once, straight into the js buffer.
+ */
+class WebAVPacketBatch
 {
-    int size;
-    std::vector<WebAVPacket> packets;
-} WebAVPacketList;
+public:
+    static const int TIME_FIELDS = 4;
+    static const int INT_FIELDS = 4;
+    static const int SIDE_DATA_FIELDS = 4;
 
-typedef struct WebMediaInfo
-{
-    std::string format_name;
-    double start_time;
-    double duration;
-    std::string bit_rate;
-    int nb_streams;
-    int nb_chapters;
-    int flags;
-    std::vector<WebAVStream> streams;
-} WebMediaInfo;
+    explicit WebAVPacketBatch(PacketArena &arena) : arena(arena)
+    {
+        arena.reset();
+    }
+
+    ~WebAVPacketBatch()
+    {
+        arena.reset();
+    }
 
-double get_rotation(AVStream *stream) {
-   for (int i = 0; i < stream->codecpar->nb_coded_side_data; i++) {
-        AVPacketSideData *sd = &stream->codecpar->coded_side_data[i];
+    int add(AVPacket *packet, AVStream *stream)
+    {
+        int64_t offset = arena.size();
+        int ret = arena.add(packet);
 
-        if (sd->type == AV_PKT_DATA_DISPLAYMATRIX && sd->size >= 9*4) {
-            double rotation = av_display_rotation_get((int32_t *)sd->data);
-            if (std::isnan(rotation))
-                rotation = 0;
-            
-            return rotation;
+        if (ret < 0)
+        {
+            return ret;
         }
-    }
 
-    return 0;
-}
+        if (arena.size() > INT32_MAX)
+        {
+            return AVERROR(ENOMEM);
+        }
 
-std::string gen_rational_str(AVRational rational, char sep)
-{
-    std::ostringstream oss;
-    oss << rational.num << sep << rational.den;
-    return oss.str();
-}
+        times.push_back(ts_to_seconds(packet->pts, stream->time_base));
+        times.push_back(ts_to_seconds(packet->dts, stream->time_base));
+        times.push_back(packet->duration * av_q2d(stream->time_base));
+        times.push_back((double)packet->pos);
 
-void gen_web_packet(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream)
-{
-    double packet_timestamp = packet->pts * av_q2d(stream->time_base);
+        int64_t sd_offset = offset + packet->size;
 
-    web_packet.keyframe = packet->flags & AV_PKT_FLAG_KEY;
-    web_packet.timestamp = packet_timestamp;
-    web_packet.duration = packet->duration * av_q2d(stream->time_base);
-    web_packet.size = packet->size;
-    if (packet->size > 0)
+        for (int i = 0; i < packet->side_data_elems; i++)
+        {
+            const AVPacketSideData &sd = packet->side_data[i];
+
+            side_data.push_back(size());
+            side_data.push_back(sd.type);
+            side_data.push_back((int32_t)sd_offset);
+            side_data.push_back((int32_t)sd.size);
+            sd_offset += sd.size;
+        }
+
+        fields.push_back(packet->stream_index);
+        fields.push_back(packet->flags);
+        fields.push_back((int32_t)offset);
+        fields.push_back(packet->size);
+
+        return 0;
+    }
+
+    int size() const
     {
-        web_packet.data = std::vector<uint8_t>(packet->data, packet->data + packet->size);
+        return fields.size() / INT_FIELDS;
     }
-    else
+
+    int64_t byte_size() const
     {
-        web_packet.data = std::vector<uint8_t>();
+        return arena.size();
     }
-}
 
-void gen_web_stream(WebAVStream &web_stream, AVStream *stream, AVFormatContext *fmt_ctx)
-{
-    web_stream.index = stream->index;
-    web_stream.id = stream->id;
+    val to_js() const
+    {
+        val result = val::object();
+        val data = val::global("Uint8Array").new_((double)arena.size());
+        int64_t offset = 0;
 
-    // codecpar info
-    AVCodecParameters *par = stream->codecpar;
-    web_stream.codec_type = (int)par->codec_type;
-    web_stream.codec_type_string = av_get_media_type_string(par->codec_type);
-    web_stream.codec_name = avcodec_descriptor_get(par->codec_id)->name;
+        // the one copy of the payloads, from the referenced packets out of the wasm heap
+        for (int i = 0; i < arena.count(); i++)
+        {
+            const AVPacket *packet = arena.packet(i);
+
+            set_js_bytes(data, offset, packet->data, packet->size);
+            offset += packet->size;
 
-    char codec_string[40];
+            for (int j = 0; j < packet->side_data_elems; j++)
+            {
+                const AVPacketSideData &sd = packet->side_data[j];
 
-    if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+                set_js_bytes(data, offset, sd.data, sd.size);
+                offset += sd.size;
+            }
+        }
+
+        result.set("size", size());
+        result.set("times", val::global("Float64Array").new_(typed_memory_view(times.size(), times.data())));
+        result.set("fields", val::global("Int32Array").new_(typed_memory_view(fields.size(), fields.data())));
+        result.set("side_data", val::global("Int32Array").new_(typed_memory_view(side_data.size(), side_data.data())));
+        result.set("data", data);
+
+        return result;
+    }
+
+private:
+    PacketArena &arena;
+    std::vector<double> times;
+    std::vector<int32_t> fields;
+    std::vector<int32_t> side_data;
+};
+
+/** hand packets of one stream to js as a WebAVPacketBatch object */
+val packets_to_js(const std::vector<AVPacketPtr> &packets, AVStream *stream, PacketArena &arena)
+{
+    WebAVPacketBatch batch(arena);
+
+    for (const AVPacketPtr &packet : packets)
     {
-        web_stream.color_primaries = av_color_primaries_name(par->color_primaries);
-        web_stream.color_transfer = av_color_transfer_name(par->color_trc);
-        web_stream.color_space = av_color_space_name(par->color_space);
-        web_stream.color_range = av_color_range_name(par->color_range);
-        set_video_codec_string(codec_string, sizeof(codec_string), par, &stream->avg_frame_rate);
+        if (batch.add(packet.get(), stream) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+            throw std::runtime_error("Cannot allocate packet");
+        }
     }
-    else if (par->codec_type == AVMEDIA_TYPE_AUDIO)
+
+    return batch.to_js();
+}
+
+/**
+ * WebIOContext adapts a js byte source to an AVIOContext, so libavformat reads
+ * File, url and in-memory sources through its own callbacks instead of the
+ * emscripten FS layer. the source object implements:
+ *   size(): number, total size in bytes or -1 if unknown (not seekable then)
+ *   read(position: number, view: Uint8Array): number, fills view (a view on
+ *     the wasm heap) from position, returns bytes written, 0 at end, -1 on error
+ * positions cross to js as double, exact up to 2^53 bytes.
+ */
+class WebIOContext
+{
+public:
+    WebIOContext(val source, int buffer_size) : source(source)
     {
-        set_audio_codec_string(codec_string, sizeof(codec_string), par);
+        size = (int64_t)source.call<double>("size");
+
+        unsigned char *buffer = (unsigned char *)av_malloc(buffer_size);
+
+        if (!buffer)
+        {
+            throw std::runtime_error("Cannot allocate io buffer");
+        }
+
+        pb = avio_alloc_context(buffer, buffer_size, 0, this, &WebIOContext::read_packet, NULL, &WebIOContext::seek);
+
+        if (!pb)
+        {
+            av_free(buffer);
+            throw std::runtime_error("Cannot allocate io context");
+        }
+
+        // a source of unknown size (e.g. pushed while demuxed) is read in order
+        if (size < 0)
+        {
+            pb->seekable = 0;
+        }
     }
-    else
+
+    ~WebIOContext()
     {
-        strcpy(codec_string, "undf");
+        if (pb)
+        {
+            av_freep(&pb->buffer);
+        }
+        avio_context_free(&pb);
     }
 
-    web_stream.codec_string = codec_string;
-    web_stream.profile = avcodec_profile_name(par->codec_id, par->profile);
-    web_stream.pix_fmt = av_get_pix_fmt_name((AVPixelFormat)par->format);
-    web_stream.level = par->level;
-    web_stream.width = par->width;
-    web_stream.height = par->height;
-    web_stream.channels = par->ch_layout.nb_channels;
-    web_stream.sample_rate = par->sample_rate;
-    web_stream.sample_fmt = av_get_sample_fmt_name((AVSampleFormat)par->format);
-    web_stream.bit_rate = std::to_string(par->bit_rate);
-    web_stream.extradata_size = par->extradata_size;
-    if (par->extradata_size > 0)
+    WebIOContext(const WebIOContext &) = delete;
+    WebIOContext &operator=(const WebIOContext &) = delete;
+
+    AVIOContext *pb = NULL;
+
+private:
+    val source;
+    int64_t position = 0;
+    int64_t size = -1;
+
+    static int read_packet(void *opaque, uint8_t *buf, int buf_size)
     {
-        web_stream.extradata = std::vector<uint8_t>(par->extradata, par->extradata + par->extradata_size);
+        WebIOContext *io = (WebIOContext *)opaque;
+        int bytes = io->source.call<int>("read", (double)io->position, val(typed_memory_view(buf_size, buf)));
+
+        if (bytes < 0)
+        {
+            return AVERROR(EIO);
+        }
+
+        if (bytes == 0)
+        {
+            return AVERROR_EOF;
+        }
+
+        io->position += bytes;
+
+        return bytes;
     }
-    else
+
+    static int64_t seek(void *opaque, int64_t offset, int whence)
     {
-        web_stream.extradata = std::vector<uint8_t>();
+        WebIOContext *io = (WebIOContext *)opaque;
+        int64_t position;
+
+        switch (whence & ~AVSEEK_FORCE)
+        {
+        case AVSEEK_SIZE:
+            return io->size >= 0 ? io->size : AVERROR(ENOSYS);
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = io->position + offset;
+            break;
+        case SEEK_END:
+            if (io->size < 0)
+            {
+                return AVERROR(ENOSYS);
+            }
+            position = io->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+        }
+
+        if (position < 0)
+        {
+            return AVERROR(EINVAL);
+        }
+
+        io->position = position;
+
+        return position;
     }
+};
 
-    // other stream info
-    web_stream.start_time = stream->start_time * av_q2d(stream->time_base);
-    web_stream.duration = stream->duration > 0 ? stream->duration * av_q2d(stream->time_base) : fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q); // TODO: some file type can not get stream duration
-    web_stream.rotation = get_rotation(stream);
+/**
+ * WebAVPacketReader is a resumable read of one or more streams between start
+ * and end in a single demux pass, packets of all read streams are interleaved
+ * in file order and tagged with their stream index. js pulls packets with
+ * next() as the consumer asks for them, so nothing has to suspend the wasm
+ * stack between packets. the session context may be seeked by other api calls
+ * meanwhile, so each reader demuxes from its own format and io context over
+ * the same source, opened without probing again (see open_input_from).
+ */
+class WebDemuxerSession;
+
+class WebAVPacketReader
+{
+public:
+    /** read the stream of type (or wanted_stream_nb) chosen by the session */
+    WebAVPacketReader(WebDemuxerSession &session, WebSessionOptions options, double start, double end, int type, int wanted_stream_nb, int seek_flag);
 
-    int64_t nb_frames = stream->nb_frames;
+    /** read the streams in stream_indexes (an array of stream indexes), seeking on the first one */
+    WebAVPacketReader(WebDemuxerSession &session, WebSessionOptions options, double start, double end, val stream_indexes, int seek_flag);
 
-    // vp8 codec does not have nb_frames
-    if (nb_frames == 0)
+    ~WebAVPacketReader()
     {
-        nb_frames = (fmt_ctx->duration * (double)stream->avg_frame_rate.num) / ((double)stream->avg_frame_rate.den * AV_TIME_BASE);
+        close();
     }
-    web_stream.nb_frames = std::to_string(nb_frames);
-    web_stream.r_frame_rate = gen_rational_str(stream->r_frame_rate, '/');
-    web_stream.avg_frame_rate = gen_rational_str(stream->avg_frame_rate, '/');
-    AVRational sar, dar;
-    sar = av_guess_sample_aspect_ratio(fmt_ctx, stream, NULL);
 
-    if (sar.num)
+    /**
+     * read until max_packets packets or max_bytes payload bytes (0 = no limit)
+     * are collected or the range ends, an empty batch means the read is done
+     */
+    val next(int max_packets, int max_bytes)
     {
-        av_reduce(&dar.num, &dar.den, par->width * sar.num, par->height * sar.den, 1024 * 1024);
-        web_stream.sample_aspect_ratio = gen_rational_str(sar, ':');
-        web_stream.display_aspect_ratio = gen_rational_str(dar, ':');
+        WebAVPacketBatch batch(arena);
+
+        if (max_packets <= 0 && max_bytes <= 0)
+        {
+            max_packets = 1;
+        }
+
+        AVPacket *packet;
+
+        while ((max_packets <= 0 || batch.size() < max_packets) && (max_bytes <= 0 || batch.byte_size() < max_bytes) && (packet = read_packet()))
+        {
+            int ret = batch.add(packet, fmt_ctx->streams[packet->stream_index]);
+
+            av_packet_unref(packet);
+
+            if (ret < 0)
+            {
+                av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+                throw std::runtime_error("Cannot allocate packet");
+            }
+        }
+
+        return batch.to_js();
     }
-    else
+
+    /**
+     * read the next (converted) packet of a read stream within the range, it
+     * is owned by the reader and valid until the next call, NULL when done
+     */
+    AVPacket *read_packet()
     {
-        web_stream.sample_aspect_ratio = std::string("N/A");
-        web_stream.display_aspect_ratio = std::string("N/A");
-    }
+        av_packet_unref(packet);
 
-    AVDictionaryEntry *tag = NULL;
+        while (!done)
+        {
+            if (av_read_frame(fmt_ctx, packet) < 0)
+            {
+                done = true;
+                break;
+            }
 
-    while ((tag = av_dict_get(stream->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
-    {
-        Tag t = {
-            .key = tag->key,
-            .value = tag->value,
-        };
-        web_stream.tags.push_back(t);
-    }
-}
+            int index = packet->stream_index;
 
-WebAVStream get_av_stream(std::string filename, int type, int wanted_stream_nb)
-{
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+            if (index < (int)reading.size() && reading[index])
+            {
+                if (end_timestamps[index] != AV_NOPTS_VALUE && packet->pts > end_timestamps[index])
+                {
+                    // this stream is past the range, the others may not be yet
+                    reading[index] = 0;
+                    done = --remaining == 0;
+                }
+                else if (converters[index] && converters[index]->convert(packet) < 0)
+                {
+                    av_packet_unref(packet);
+                    av_log(NULL, AV_LOG_ERROR, "Cannot convert packet bitstream\n");
+                    throw std::runtime_error("Cannot convert packet bitstream");
+                }
+                else
+                {
+                    return packet;
+                }
+            }
+            av_packet_unref(packet);
+        }
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot open input file");
+        return NULL;
     }
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+    AVFormatContext *get_format_context() const
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find stream information");
+        return fmt_ctx;
     }
 
-    int stream_index = av_find_best_stream(fmt_ctx, (AVMediaType)type, wanted_stream_nb, -1, NULL, 0);
+    bool get_done() const
+    {
+        return done;
+    }
 
-    if (stream_index < 0)
+    void close()
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
+        done = true;
+        converters.clear();
+        av_packet_free(&packet);
         avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find wanted stream in the input file");
     }
 
-    AVStream *stream = fmt_ctx->streams[stream_index];
-    WebAVStream web_stream;
+private:
+    WebIOContext io;
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket *packet = NULL;
+    PacketArena arena;
+    /** per stream index: still read, end of the range in stream time base */
+    std::vector<uint8_t> reading;
+    std::vector<int64_t> end_timestamps;
+    /** per stream index: bitstream converter of a read h264 / hevc stream, or null */
+    std::vector<std::unique_ptr<BitstreamConverter>> converters;
+    int remaining = 0;
+    bool done = false;
+
+    void init(const std::vector<int> &stream_indexes, double start, double end, int seek_flag, int bitstream_format)
+    {
+        int num_streams = fmt_ctx->nb_streams;
 
-    gen_web_stream(web_stream, stream, fmt_ctx);
+        if (stream_indexes.empty())
+        {
+            throw std::runtime_error("No stream to read");
+        }
 
-    avformat_close_input(&fmt_ctx);
+        reading = std::vector<uint8_t>(num_streams, 0);
+        end_timestamps = std::vector<int64_t>(num_streams, AV_NOPTS_VALUE);
+        converters.resize(num_streams);
 
-    return web_stream;
-}
+        for (int stream_index : stream_indexes)
+        {
+            if (stream_index < 0 || stream_index >= num_streams)
+            {
+                av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
+                throw std::runtime_error("Cannot find wanted stream in the input file");
+            }
 
-WebAVStreamList get_av_streams(std::string filename)
-{
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+            if (!reading[stream_index])
+            {
+                reading[stream_index] = 1;
+                remaining++;
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot open input file");
+                std::unique_ptr<BitstreamConverter> converter(new BitstreamConverter(fmt_ctx->streams[stream_index], bitstream_format));
+
+                if (converter->active())
+                {
+                    converters[stream_index] = std::move(converter);
+                }
+            }
+
+            if (end > 0)
+            {
+                end_timestamps[stream_index] = av_rescale_q((int64_t)(end * AV_TIME_BASE), AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
+            }
+        }
+
+        // demuxers skip reading the payload of discarded streams where they can (mov, matroska)
+        for (int i = 0; i < num_streams; i++)
+        {
+            if (!reading[i])
+            {
+                fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+            }
+        }
+
+        packet = av_packet_alloc();
+
+        if (!packet)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+            throw std::runtime_error("Cannot allocate packet");
+        }
+
+        if (start > 0 && seek_stream(fmt_ctx, stream_indexes[0], start, seek_flag) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
+            throw std::runtime_error("Cannot seek to the specified timestamp");
+        }
     }
+};
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+/**
+ * WebRemuxer remuxes a time range of some streams into fragmented mp4 (or the
+ * muxer named by format) for Media Source Extensions, without decoding. the
+ * first stream leads: the read seeks to its keyframe before start, and a new
+ * fragment starts at each of its keyframes once the current one spans
+ * min_fragment_seconds. js pulls one segment per next(), the init segment first.
+ */
+class WebRemuxer
+{
+public:
+    WebRemuxer(WebDemuxerSession &session, WebSessionOptions options, double start, double end, val stream_indexes, std::string format)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find stream information");
-    }
+        std::vector<int> indexes = convertJSArrayToNumberVector<int>(stream_indexes);
 
-    int num_streams = fmt_ctx->nb_streams;
+        // the muxer takes packets as the container stores them, except annex-b h264 (see converters)
+        options.bitstream_format = WEB_BITSTREAM_KEEP;
+        reader.reset(new WebAVPacketReader(session, options, start, end, stream_indexes, AVSEEK_FLAG_BACKWARD));
+        muxer.reset(new FragmentMuxer(reader->get_format_context(), indexes, format.c_str()));
+        remuxed_streams = indexes;
+        lead_index = indexes[0];
 
-    WebAVStreamList stream_list = {
-        .size = num_streams,
-        .streams = std::vector<WebAVStream>(num_streams),
-    };
+        AVFormatContext *fmt_ctx = reader->get_format_context();
 
-    for (int stream_index = 0; stream_index < num_streams; stream_index++)
-    {
-        AVStream *stream = fmt_ctx->streams[stream_index];
+        converters.resize(fmt_ctx->nb_streams);
+        for (int stream_index : indexes)
+        {
+            AVStream *stream = fmt_ctx->streams[stream_index];
+
+            if (stream->codecpar->codec_id == AV_CODEC_ID_H264)
+            {
+                std::unique_ptr<BitstreamConverter> converter(new BitstreamConverter(stream, WEB_BITSTREAM_AVCC));
 
-        gen_web_stream(stream_list.streams[stream_index], stream, fmt_ctx);
+                if (converter->active())
+                {
+                    converters[stream_index] = std::move(converter);
+                    missing_records++;
+                }
+            }
+        }
     }
 
-    avformat_close_input(&fmt_ctx);
+    /**
+     * the next segment { init, data: Uint8Array, start, end } (times of the
+     * lead stream in seconds, NaN for the init segment), null when done. the
+     * init segment also has codecs, the codec string of each output stream
+     */
+    val next()
+    {
+        if (done)
+        {
+            return val::null();
+        }
 
-    return stream_list;
-}
+        if (!header_written)
+        {
+            header_written = true;
+            read_records();
+            check(muxer->write_header(), "Cannot write init segment");
 
-WebMediaInfo get_media_info(std::string filename) {
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+            val segment = segment_to_js(true, NAN, NAN);
+            val codecs = val::array();
+            AVFormatContext *fmt_ctx = reader->get_format_context();
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot open input file");
+            // from the output streams, converted h264 only has its avcC there
+            for (int stream_index : remuxed_streams)
+            {
+                codecs.call<void>("push", gen_codec_string(muxer->output_codecpar(stream_index), &fmt_ctx->streams[stream_index]->avg_frame_rate));
+            }
+            segment.set("codecs", codecs);
+
+            return segment;
+        }
+
+        AVFormatContext *fmt_ctx = reader->get_format_context();
+        AVPacket *packet;
+
+        while ((packet = next_packet()))
+        {
+            bool lead = packet->stream_index == lead_index;
+            AVRational time_base = fmt_ctx->streams[packet->stream_index]->time_base;
+            double pts = ts_to_seconds(packet->pts, time_base);
+            double pts_end = pts + ts_to_seconds(packet->duration, time_base);
+
+            if (lead && (packet->flags & AV_PKT_FLAG_KEY) && pts - fragment_start >= min_fragment_seconds)
+            {
+                double start = fragment_start;
+                double end = fragment_end;
+
+                check(muxer->flush(), "Cannot write fragment");
+                fragment_start = pts;
+                fragment_end = pts_end;
+                check(muxer->write(packet), "Cannot write packet");
+
+                return segment_to_js(false, start, end);
+            }
+
+            if (lead)
+            {
+                fragment_start = std::isnan(fragment_start) ? pts : fragment_start;
+                fragment_end = std::isnan(fragment_end) || pts_end > fragment_end ? pts_end : fragment_end;
+            }
+            check(muxer->write(packet), "Cannot write packet");
+        }
+
+        done = true;
+        check(muxer->finish(), "Cannot write fragment");
+
+        if (muxer->segment_size() == 0)
+        {
+            return val::null();
+        }
+
+        return segment_to_js(false, fragment_start, fragment_end);
     }
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+private:
+    static constexpr double min_fragment_seconds = 1.0;
+
+    std::unique_ptr<WebAVPacketReader> reader;
+    std::unique_ptr<FragmentMuxer> muxer;
+    /** input stream indexes, in output stream order */
+    std::vector<int> remuxed_streams;
+    /**
+     * per stream index: converter of an annex-b h264 stream (avi, mpeg-ps, ...)
+     * to the length prefixed NAL units and avcC record mp4 stores, or null
+     */
+    std::vector<std::unique_ptr<BitstreamConverter>> converters;
+    int missing_records = 0;
+    /** packets read ahead for the records, muxed first */
+    std::deque<AVPacketPtr> pending;
+    AVPacketPtr current = alloc_packet();
+    int lead_index = 0;
+    bool header_written = false;
+    bool done = false;
+    /** lead stream time range of the fragment being written */
+    double fragment_start = NAN;
+    double fragment_end = NAN;
+
+    void check(int ret, const char *message)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find stream information");
+        if (ret < 0)
+        {
+            done = true;
+            av_log(NULL, AV_LOG_ERROR, "%s\n", message);
+            throw std::runtime_error(message);
+        }
     }
 
-    int num_streams = fmt_ctx->nb_streams;
+    /** read and convert the next packet of the reader, NULL when done */
+    AVPacket *read_packet()
+    {
+        AVPacket *packet = reader->read_packet();
 
-    WebMediaInfo media_info = {
-        .format_name = fmt_ctx->iformat->name,
-        .start_time = fmt_ctx->start_time * av_q2d(AV_TIME_BASE_Q),
-        .duration = fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q),
-        .bit_rate = std::to_string(fmt_ctx->bit_rate),
-        .nb_streams = num_streams,
-        .nb_chapters = (int)fmt_ctx->nb_chapters,
-        .flags = fmt_ctx->flags,
-        .streams = std::vector<WebAVStream>(num_streams),
-    };
+        if (packet && converters[packet->stream_index])
+        {
+            check(converters[packet->stream_index]->convert(packet), "Cannot convert packet bitstream");
+        }
 
-    for (int stream_index = 0; stream_index < num_streams; stream_index++)
+        return packet;
+    }
+
+    /** the next packet to mux, valid until the next call, NULL when done */
+    AVPacket *next_packet()
     {
-        AVStream *stream = fmt_ctx->streams[stream_index];
+        if (pending.empty())
+        {
+            return read_packet();
+        }
+
+        av_packet_unref(current.get());
+        av_packet_move_ref(current.get(), pending.front().get());
+        pending.pop_front();
 
-        gen_web_stream(media_info.streams[stream_index], stream, fmt_ctx);
+        return current.get();
     }
 
-    avformat_close_input(&fmt_ctx);
+    /**
+     * the init segment needs the avcC record of each converted stream, which
+     * comes with its first SPS / PPS (AV_PKT_DATA_NEW_EXTRADATA of a converted
+     * packet): read ahead until every one has it, keeping the packets read
+     */
+    void read_records()
+    {
+        std::vector<uint8_t> found(converters.size(), 0);
+        AVPacket *packet;
 
-    return media_info;
-}
+        while (missing_records > 0 && (packet = read_packet()))
+        {
+            int index = packet->stream_index;
+            size_t size = 0;
+            uint8_t *record = av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, &size);
 
-WebAVPacket get_av_packet(std::string filename, double timestamp, int type, int wanted_stream_nb, int seek_flag)
-{
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+            if (converters[index] && record && size > 0 && !found[index])
+            {
+                check(muxer->set_extradata(index, record, size), "Cannot set stream extradata");
+                found[index] = 1;
+                missing_records--;
+            }
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot open input file");
+            AVPacketPtr read = alloc_packet();
+
+            av_packet_move_ref(read.get(), packet);
+            pending.push_back(std::move(read));
+        }
     }
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+    val segment_to_js(bool init, double start, double end)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find stream information");
-    }
+        val segment = val::object();
 
-    int stream_index = av_find_best_stream(fmt_ctx, (AVMediaType)type, wanted_stream_nb, -1, NULL, 0);
+        segment.set("init", init);
+        segment.set("start", start);
+        segment.set("end", end);
+        segment.set("data", val::global("Uint8Array").new_(typed_memory_view(muxer->segment_size(), muxer->segment_data())));
 
-    if (stream_index < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find wanted stream in the input file");
+        return segment;
     }
+};
 
-    AVPacket *packet = NULL;
-    packet = av_packet_alloc();
+/**
+ * WebDemuxerSession keeps one probed AVFormatContext (and the stream table
+ * generated from it) alive for the lifetime of a loaded file, so that every
+ * api call only pays for its seek and read instead of open + probe + close.
+ */
+class WebDemuxerSession
+{
+public:
+    WebDemuxerSession(val source, WebSessionOptions options) : source(source), options(options), io(source, options.io_buffer_size)
+    {
+        open_input(&fmt_ctx, NULL, io.pb, options.probe, options.header_only);
+
+        int num_streams = fmt_ctx->nb_streams;
+
+        streams = std::vector<WebAVStream>(num_streams);
+        stream_versions = std::vector<int>(num_streams, 0);
 
-    if (!packet)
+        for (int stream_index = 0; stream_index < num_streams; stream_index++)
+        {
+            gen_web_stream(streams[stream_index], fmt_ctx->streams[stream_index], fmt_ctx);
+        }
+    }
+
+    ~WebDemuxerSession()
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
         avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot allocate packet");
     }
 
-    int64_t int64_timestamp = (int64_t)(timestamp * AV_TIME_BASE);
-    int64_t seek_time_stamp = av_rescale_q(int64_timestamp, AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
-
-    if ((ret = av_seek_frame(fmt_ctx, stream_index, seek_time_stamp, seek_flag)) < 0)
+    /**
+     * the stream find_stream picks for type (AVMediaType) and wanted_stream_nb -1,
+     * from an earlier probed session of the source: av_find_best_stream ranks
+     * streams by probed info (e.g. frame counts) a header only open lacks
+     */
+    void set_default_stream(int type, int stream_index)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
-        avformat_close_input(&fmt_ctx);
-        av_packet_unref(packet);
-        av_packet_free(&packet);
-        throw std::runtime_error("Cannot seek to the specified timestamp");
+        check_stream_index(stream_index);
+
+        default_streams[type] = stream_index;
     }
 
-    while (av_read_frame(fmt_ctx, packet) >= 0)
+    int find_stream_index(int type, int wanted_stream_nb)
     {
-        if (packet->stream_index == stream_index)
+        if (wanted_stream_nb < 0)
         {
-            break;
+            auto cached = default_streams.find(type);
+
+            if (cached != default_streams.end())
+            {
+                return cached->second;
+            }
         }
-        av_packet_unref(packet);
+
+        return find_stream(fmt_ctx, type, wanted_stream_nb);
     }
 
-    if (!packet)
+    val get_source() const
     {
-        av_log(NULL, AV_LOG_ERROR, "Failed to get av packet at timestamp\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Failed to get av packet at timestamp");
+        return source;
     }
 
-    WebAVPacket web_packet;
+    /** the probed context, readers copy its stream parameters */
+    const AVFormatContext *get_format_context() const
+    {
+        return fmt_ctx;
+    }
 
-    gen_web_packet(web_packet, packet, fmt_ctx->streams[stream_index]);
+    WebAVStream get_av_stream(int type, int wanted_stream_nb)
+    {
+        int stream_index = find_stream_index(type, wanted_stream_nb);
 
-    avformat_close_input(&fmt_ctx);
-    av_packet_unref(packet);
-    av_packet_free(&packet);
+        return streams[stream_index];
+    }
 
-    return web_packet;
-}
+    WebAVStream get_av_stream_at(int stream_index)
+    {
+        check_stream_index(stream_index);
 
-WebAVPacketList get_av_packets(std::string filename, double timestamp, int seek_flag)
-{
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+        return streams[stream_index];
+    }
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
+    /** sum of the stream versions, js caches compare it before looking at single streams */
+    int get_streams_version() const
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot open input file");
+        return streams_version;
     }
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+    /** bumped whenever the stream is regenerated for new in-band extradata */
+    int get_stream_version(int stream_index)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot find stream information");
+        check_stream_index(stream_index);
+
+        return stream_versions[stream_index];
     }
 
-    int num_streams = fmt_ctx->nb_streams;
-    int num_packets = num_streams;
-    WebAVPacketList web_packet_list = {
-        .size = num_packets,
-        .packets = std::vector<WebAVPacket>(num_packets),
-    };
+    /**
+     * new extradata (Uint8Array) of stream_index seen outside of the session,
+     * e.g. by a reader, returns whether the stream changed
+     */
+    bool update_extradata(int stream_index, val data)
+    {
+        check_stream_index(stream_index);
+
+        std::vector<uint8_t> extradata = convertJSArrayToNumberVector<uint8_t>(data);
+        int ret = set_stream_extradata(fmt_ctx->streams[stream_index], extradata.data(), extradata.size());
 
-    AVPacket *packet = NULL;
-    packet = av_packet_alloc();
+        if (ret < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot allocate extradata\n");
+            throw std::runtime_error("Cannot allocate extradata");
+        }
 
-    if (!packet)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
-        avformat_close_input(&fmt_ctx);
-        throw std::runtime_error("Cannot allocate packet");
+        if (ret > 0)
+        {
+            regen_stream(stream_index);
+        }
+
+        return ret > 0;
     }
 
-    for (int stream_index = 0; stream_index < num_streams; stream_index++)
+    /**
+     * the extradata a decoder needs for the packets of stream_index read as
+     * bitstream_format (WebBitstreamFormat): the avcC synthesized for annex-b
+     * h264 read as AVCC, from the parameter sets of the stream extradata or
+     * else of its first packets. a Uint8Array, or undefined when the stream
+     * extradata is used as is.
+     */
+    val get_output_extradata(int stream_index, int bitstream_format)
     {
-        int64_t int64_timestamp = (int64_t)(timestamp * AV_TIME_BASE);
-        int64_t seek_time_stamp = av_rescale_q(int64_timestamp, AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
+        check_stream_index(stream_index);
 
-        if ((ret = av_seek_frame(fmt_ctx, stream_index, seek_time_stamp, seek_flag)) < 0)
+        BitstreamConverter converter(fmt_ctx->streams[stream_index], bitstream_format);
+        std::vector<uint8_t> record = converter.output_extradata();
+
+        if (!converter.synthesizes_record())
         {
-            av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
-            throw std::runtime_error("Cannot seek to the specified timestamp");
+            return val::undefined();
         }
 
-        while (av_read_frame(fmt_ctx, packet) >= 0)
+        if (record.empty() && seek_stream(fmt_ctx, stream_index, 0, AVSEEK_FLAG_BACKWARD) >= 0)
         {
-            if (packet->stream_index == stream_index)
+            AVPacketPtr packet = alloc_packet();
+
+            // the parameter sets precede the first keyframe
+            for (int i = 0; i < MAX_PARAMETER_SET_PACKETS && record.empty() && read_stream_packet(fmt_ctx, stream_index, packet.get()) >= 0; i++)
             {
-                break;
+                int ret = converter.convert(packet.get());
+
+                av_packet_unref(packet.get());
+
+                if (ret < 0)
+                {
+                    av_log(NULL, AV_LOG_ERROR, "Cannot convert packet bitstream\n");
+                    throw std::runtime_error("Cannot convert packet bitstream");
+                }
+
+                record = converter.output_extradata();
             }
-            av_packet_unref(packet);
         }
 
-        if (!packet)
+        if (record.empty())
         {
-            av_log(NULL, AV_LOG_ERROR, "Failed to get av packet at timestamp\n");
-            throw std::runtime_error("Failed to get av packet at timestamp");
+            av_log(NULL, AV_LOG_ERROR, "Cannot find the parameter sets of the stream\n");
+            throw std::runtime_error("Cannot find the parameter sets of the stream");
         }
 
-        gen_web_packet(web_packet_list.packets[stream_index], packet, fmt_ctx->streams[stream_index]);
+        return val::global("Uint8Array").new_(typed_memory_view(record.size(), record.data()));
     }
 
-    av_packet_unref(packet);
-    av_packet_free(&packet);
-    avformat_close_input(&fmt_ctx);
-
-    return web_packet_list;
-}
+    WebAVStreamList get_av_streams()
+    {
+        WebAVStreamList stream_list = {
+            .size = (int)streams.size(),
+            .streams = streams,
+        };
 
-int read_av_packet(std::string filename, double start, double end, int type, int wanted_stream_nb, int seek_flag, val js_caller)
-{
-    AVFormatContext *fmt_ctx = NULL;
-    int ret;
+        return stream_list;
+    }
 
-    if ((ret = avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL)) < 0)
+    WebMediaInfo get_media_info()
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
-        avformat_close_input(&fmt_ctx);
-        return 0;
+        WebMediaInfo media_info = {
+            .format_name = fmt_ctx->iformat->name,
+            .start_time = fmt_ctx->start_time * av_q2d(AV_TIME_BASE_Q),
+            .duration = fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q),
+            .bit_rate = std::to_string(fmt_ctx->bit_rate),
+            .nb_streams = (int)fmt_ctx->nb_streams,
+            .nb_chapters = (int)fmt_ctx->nb_chapters,
+            .flags = fmt_ctx->flags,
+            .streams = streams,
+        };
+
+        return media_info;
     }
 
-    if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+    WebAVPacket get_av_packet(double timestamp, int type, int wanted_stream_nb, int seek_flag)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
-        avformat_close_input(&fmt_ctx);
-        return 0;
-    }
+        int stream_index = find_stream_index(type, wanted_stream_nb);
+        AVPacketPtr packet = alloc_packet();
 
-    int stream_index = av_find_best_stream(fmt_ctx, (AVMediaType)type, wanted_stream_nb, -1, NULL, 0);
+        if (seek_stream(fmt_ctx, stream_index, timestamp, seek_flag) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
+            throw std::runtime_error("Cannot seek to the specified timestamp");
+        }
 
-    if (stream_index < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
-        avformat_close_input(&fmt_ctx);
-        return 0;
-    }
+        if (read_stream_packet(fmt_ctx, stream_index, packet.get()) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Failed to get av packet at timestamp\n");
+            throw std::runtime_error("Failed to get av packet at timestamp");
+        }
 
-    AVPacket *packet = NULL;
-    packet = av_packet_alloc();
+        track_extradata(packet.get());
 
-    if (!packet)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
-        avformat_close_input(&fmt_ctx);
-        return 0;
+        WebAVPacket web_packet;
+
+        gen_web_packet(web_packet, packet.get(), fmt_ctx->streams[stream_index], options.zero_copy);
+        av_packet_unref(packet.get());
+
+        return web_packet;
     }
 
-    if (start > 0)
+    /**
+     * get the packet of every stream at timestamp with one seek and one scan
+     * (see get_stream_packets_at), in stream order. a stream without a packet
+     * near the timestamp gets an empty packet (size 0, timestamp and dts NaN,
+     * pos -1, flags 0).
+     */
+    WebAVPacketList get_av_packets(double timestamp, int seek_flag)
     {
-        int64_t start_timestamp = (int64_t)(start * AV_TIME_BASE);
-        int64_t rescaled_start_time_stamp = av_rescale_q(start_timestamp, AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
+        int num_streams = fmt_ctx->nb_streams;
+        WebAVPacketList web_packet_list = {
+            .size = num_streams,
+            .packets = std::vector<WebAVPacket>(num_streams),
+        };
+        std::vector<AVPacketPtr> packets;
+
+        get_stream_packets_at(fmt_ctx, timestamp, seek_flag, packets);
 
-        if ((ret = av_seek_frame(fmt_ctx, stream_index, rescaled_start_time_stamp, seek_flag)) < 0)
+        for (int stream_index = 0; stream_index < num_streams; stream_index++)
         {
-            av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
-            avformat_close_input(&fmt_ctx);
-            av_packet_unref(packet);
-            av_packet_free(&packet);
-            return 0;
+            WebAVPacket &web_packet = web_packet_list.packets[stream_index];
+            AVPacket *packet = packets[stream_index].get();
+
+            if (!packet->buf)
+            {
+                web_packet.stream_index = stream_index;
+                web_packet.keyframe = 0;
+                web_packet.timestamp = NAN;
+                web_packet.dts = NAN;
+                web_packet.duration = 0;
+                web_packet.pos = -1;
+                web_packet.flags = 0;
+                web_packet.size = 0;
+                continue;
+            }
+
+            track_extradata(packet);
+            gen_web_packet(web_packet, packet, fmt_ctx->streams[stream_index], options.zero_copy);
         }
+
+        return web_packet_list;
     }
 
-    while (av_read_frame(fmt_ctx, packet) >= 0)
+    /**
+     * resolve many timestamps of one stream in one call (see get_packets_at),
+     * returns { packets: the distinct packets as one batch, indexes: Int32Array
+     * with the batch position of each requested time, -1 if none was found }
+     */
+    val get_av_packets_at(val times, int type, int wanted_stream_nb, int seek_flag)
     {
-        if (packet->stream_index == stream_index)
+        int stream_index = find_stream_index(type, wanted_stream_nb);
+        AVStream *stream = fmt_ctx->streams[stream_index];
+        WebAVPacketBatch batch(arena);
+
+        std::vector<int> indexes = get_packets_at(fmt_ctx, stream_index, convertJSArrayToNumberVector<double>(times), seek_flag, [&](AVPacket *packet)
+                                                  {
+            track_extradata(packet);
+
+            if (batch.add(packet, stream) < 0)
+            {
+                av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+                throw std::runtime_error("Cannot allocate packet");
+            } });
+        std::vector<int32_t> batch_indexes(indexes.begin(), indexes.end());
+        val result = val::object();
+
+        result.set("packets", batch.to_js());
+        result.set("indexes", val::global("Int32Array").new_(typed_memory_view(batch_indexes.size(), batch_indexes.data())));
+
+        return result;
+    }
+
+    /**
+     * everything needed to decode the video frame shown at timestamp in one call
+     * (see get_frame_packets), returns { video: batch in decode order from the
+     * keyframe, target: position of the frame in video, audio: batch of the
+     * related audio stream over the same time range, if with_audio and present }
+     */
+    val get_frame_packets(double timestamp, int wanted_stream_nb, bool with_audio)
+    {
+        int video_index = find_stream_index(AVMEDIA_TYPE_VIDEO, wanted_stream_nb);
+        AVStream *video_stream = fmt_ctx->streams[video_index];
+        std::vector<AVPacketPtr> video_packets;
+        int target = ::get_frame_packets(fmt_ctx, video_index, timestamp, video_packets);
+
+        if (target < 0)
         {
-            if (end > 0)
+            av_log(NULL, AV_LOG_ERROR, "Failed to get av packet at timestamp\n");
+            throw std::runtime_error("Failed to get av packet at timestamp");
+        }
+
+        val result = val::object();
+
+        track_extradata(video_packets);
+        result.set("video", packets_to_js(video_packets, video_stream, arena));
+        result.set("target", target);
+
+        int audio_index = with_audio ? av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, video_index, NULL, 0) : -1;
+
+        if (audio_index >= 0)
+        {
+            // from the earliest frame of the gop (b-frames may precede the keyframe) to the timestamp
+            double start = timestamp;
+            std::vector<AVPacketPtr> audio_packets;
+
+            for (const AVPacketPtr &packet : video_packets)
             {
-                int64_t end_timestamp = (int64_t)(end * AV_TIME_BASE);
-                int64_t rescaled_end_timestamp = av_rescale_q(end_timestamp, AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
+                double pts = ts_to_seconds(packet->pts, video_stream->time_base);
 
-                if (packet->pts > rescaled_end_timestamp)
+                if (!std::isnan(pts) && pts < start)
                 {
-                    break;
+                    start = pts;
                 }
             }
 
-            if (packet)
-            {
-                WebAVPacket web_packet;
+            get_range_packets(fmt_ctx, audio_index, start, timestamp, audio_packets);
+            track_extradata(audio_packets);
+            result.set("audio", packets_to_js(audio_packets, fmt_ctx->streams[audio_index], arena));
+        }
+
+        return result;
+    }
+
+    /**
+     * read on from the current position of the session context, without
+     * seeking, the packets of the streams in stream_indexes (an array, all
+     * streams when empty), batched as in WebAVPacketReader::next. this is how
+     * a push source is read: once, in order, after the probe of the session.
+     * an empty batch means the source ended.
+     */
+    val read_next(val stream_indexes, int max_packets, int max_bytes)
+    {
+        std::vector<int> indexes = convertJSArrayToNumberVector<int>(stream_indexes);
+        std::vector<uint8_t> wanted(streams.size(), indexes.empty() ? 1 : 0);
+        WebAVPacketBatch batch(arena);
+        AVPacketPtr packet = alloc_packet();
+
+        for (int stream_index : indexes)
+        {
+            check_stream_index(stream_index);
+            wanted[stream_index] = 1;
+        }
+
+        if (max_packets <= 0 && max_bytes <= 0)
+        {
+            max_packets = 1;
+        }
 
-                gen_web_packet(web_packet, packet, fmt_ctx->streams[stream_index]);
+        while ((max_packets <= 0 || batch.size() < max_packets) && (max_bytes <= 0 || batch.byte_size() < max_bytes) && av_read_frame(fmt_ctx, packet.get()) >= 0)
+        {
+            int index = packet->stream_index;
 
-                // call js method to send packet
-                val result = js_caller.call<val>("sendAVPacket", web_packet).await();
-                int send_result = result.as<int>();
+            // streams added after the probe are not in the stream table, they are skipped
+            if (index < (int)wanted.size() && wanted[index])
+            {
+                track_extradata(packet.get());
 
-                if (send_result == 0)
+                if (batch.add(packet.get(), fmt_ctx->streams[index]) < 0)
                 {
-                    break;
+                    av_packet_unref(packet.get());
+                    av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+                    throw std::runtime_error("Cannot allocate packet");
                 }
             }
-            else
+            av_packet_unref(packet.get());
+        }
+
+        return batch.to_js();
+    }
+
+    /**
+     * get the sample table of a stream (see build_packet_index), the result is cached.
+     */
+    val get_packet_index(int type, int wanted_stream_nb)
+    {
+        int stream_index = find_stream_index(type, wanted_stream_nb);
+        auto cached = packet_indexes.find(stream_index);
+
+        if (cached != packet_indexes.end())
+        {
+            return cached->second.to_js();
+        }
+
+        WebPacketIndex packet_index;
+
+        build_packet_index(packet_index, fmt_ctx, fmt_ctx->streams[stream_index]);
+
+        packet_indexes[stream_index] = packet_index;
+
+        return packet_index.to_js();
+    }
+
+    /**
+     * import a previously exported index, it is returned by get_packet_index
+     * without rebuilding and its keyframes are added to the stream index for seeking
+     */
+    void set_packet_index(val index)
+    {
+        WebPacketIndex packet_index = WebPacketIndex::from_js(index);
+
+        if (packet_index.stream_index < 0 || packet_index.stream_index >= (int)fmt_ctx->nb_streams)
+        {
+            throw std::runtime_error("Invalid packet index stream");
+        }
+
+        AVStream *stream = fmt_ctx->streams[packet_index.stream_index];
+
+        for (size_t i = 0; i < packet_index.dts.size(); i++)
+        {
+            if (packet_index.keyframe[i] && !std::isnan(packet_index.dts[i]) && packet_index.pos[i] >= 0)
             {
-                av_log(NULL, AV_LOG_ERROR, "Failed to get av packet at timestamp\n");
-                break;
+                int64_t timestamp = av_rescale_q((int64_t)(packet_index.dts[i] * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+
+                av_add_index_entry(stream, (int64_t)packet_index.pos[i], timestamp, packet_index.size[i], 0, AVINDEX_KEYFRAME);
             }
         }
-        av_packet_unref(packet);
+
+        packet_indexes[packet_index.stream_index] = packet_index;
     }
 
-    // call js method to end send packet
-    js_caller.call<val>("sendAVPacket", 0).await();
+private:
+    /** packets get_output_extradata reads at most looking for the parameter sets */
+    static const int MAX_PARAMETER_SET_PACKETS = 64;
 
-    avformat_close_input(&fmt_ctx);
-    av_packet_unref(packet);
-    av_packet_free(&packet);
+    val source;
+    WebSessionOptions options;
+    WebIOContext io;
+    AVFormatContext *fmt_ctx = NULL;
+    std::vector<WebAVStream> streams;
+    std::vector<int> stream_versions;
+    int streams_version = 0;
+    std::map<int, WebPacketIndex> packet_indexes;
+    /** AVMediaType to stream index, see set_default_stream */
+    std::map<int, int> default_streams;
+    PacketArena arena;
+
+    void check_stream_index(int stream_index)
+    {
+        if (stream_index < 0 || stream_index >= (int)streams.size())
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
+            throw std::runtime_error("Cannot find wanted stream in the input file");
+        }
+    }
+
+    void regen_stream(int stream_index)
+    {
+        WebAVStream web_stream;
+
+        gen_web_stream(web_stream, fmt_ctx->streams[stream_index], fmt_ctx);
+        streams[stream_index] = web_stream;
+        stream_versions[stream_index]++;
+        streams_version++;
+    }
+
+    /** pick up new in-band extradata (e.g. a resolution change) carried by a packet */
+    void track_extradata(AVPacket *packet)
+    {
+        if (packet->stream_index >= (int)streams.size())
+        {
+            return;
+        }
+
+        int ret = apply_new_extradata(fmt_ctx->streams[packet->stream_index], packet);
+
+        if (ret < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot allocate extradata\n");
+            throw std::runtime_error("Cannot allocate extradata");
+        }
+
+        if (ret > 0)
+        {
+            regen_stream(packet->stream_index);
+        }
+    }
+
+    void track_extradata(const std::vector<AVPacketPtr> &packets)
+    {
+        for (const AVPacketPtr &packet : packets)
+        {
+            track_extradata(packet.get());
+        }
+    }
+};
+
+WebAVPacketReader::WebAVPacketReader(WebDemuxerSession &session, WebSessionOptions options, double start, double end, int type, int wanted_stream_nb, int seek_flag) : io(session.get_source(), options.io_buffer_size)
+{
+    int stream_index = session.find_stream_index(type, wanted_stream_nb);
+
+    open_input_from(&fmt_ctx, io.pb, session.get_format_context(), options.probe);
 
-    return 1;
+    try
+    {
+        init(std::vector<int>{stream_index}, start, end, seek_flag, options.bitstream_format);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+WebAVPacketReader::WebAVPacketReader(WebDemuxerSession &session, WebSessionOptions options, double start, double end, val stream_indexes, int seek_flag) : io(session.get_source(), options.io_buffer_size)
+{
+    open_input_from(&fmt_ctx, io.pb, session.get_format_context(), options.probe);
+
+    try
+    {
+        init(convertJSArrayToNumberVector<int>(stream_indexes), start, end, seek_flag, options.bitstream_format);
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
 }
 
 void set_av_log_level(int level) {
     av_log_set_level(level);
 }
 
+/** passes av_log lines within the log level to Module.onAVLog(level, line) instead of the console */
+static void forward_av_log(void *avcl, int level, const char *fmt, va_list vl)
+{
+    static int print_prefix = 1;
+    char line[1024];
+
+    if (level > av_log_get_level())
+    {
+        return;
+    }
+
+    av_log_format_line2(avcl, level, fmt, vl, line, sizeof(line), &print_prefix);
+    EM_ASM({
+        if (Module.onAVLog) Module.onAVLog($0, UTF8ToString($1));
+    }, level, line);
+}
+
+void set_av_log_forwarding(bool enabled)
+{
+    av_log_set_callback(enabled ? forward_av_log : av_log_default_callback);
+}
+
+/** wasm heap size and the packet arena counters (see PacketArenaStats), post.js adds the heap growths */
+val get_memory_stats()
+{
+    const PacketArenaStats &arena_stats = get_packet_arena_stats();
+    val stats = val::object();
+
+    stats.set("heapSize", (double)emscripten_get_heap_size());
+    stats.set("arenas", (double)arena_stats.arenas);
+    stats.set("arenaCapacity", (double)arena_stats.capacity);
+    stats.set("arenaHighWater", (double)arena_stats.high_water);
+    stats.set("arenaGrowths", (double)arena_stats.growths);
+    stats.set("arenaReuses", (double)arena_stats.reuses);
+    stats.set("packets", (double)arena_stats.packets);
+    stats.set("bytes", (double)arena_stats.bytes);
+
+    return stats;
+}
+
 EMSCRIPTEN_BINDINGS(web_demuxer)
 {
     value_object<Tag>("Tag")
@@ -664,23 +1359,63 @@ EMSCRIPTEN_BINDINGS(web_demuxer)
 
     class_<WebAVPacket>("WebAVPacket")
         .constructor<>()
+        .property("stream_index", &WebAVPacket::stream_index)
         .property("keyframe", &WebAVPacket::keyframe)
         .property("timestamp", &WebAVPacket::timestamp)
+        .property("dts", &WebAVPacket::dts)
         .property("duration", &WebAVPacket::duration)
+        .property("pos", &WebAVPacket::pos)
+        .property("flags", &WebAVPacket::flags)
         .property("size", &WebAVPacket::size)
-        .property("data", &WebAVPacket::get_data); // export data as typed_memory_view
+        .property("side_data", &WebAVPacket::get_side_data)
+        .property("data", &WebAVPacket::get_data) // export data as typed_memory_view, or Uint8Array in zero copy mode
+        .property("zero_copy", &WebAVPacket::get_zero_copy);
+
+    value_object<WebSessionOptions>("WebSessionOptions")
+        .field("zero_copy", &WebSessionOptions::zero_copy)
+        .field("io_buffer_size", &WebSessionOptions::io_buffer_size)
+        .field("probe", &WebSessionOptions::probe)
+        .field("header_only", &WebSessionOptions::header_only)
+        .field("bitstream_format", &WebSessionOptions::bitstream_format);
 
     value_object<WebAVPacketList>("WebAVPacketList")
         .field("size", &WebAVPacketList::size)
         .field("packets", &WebAVPacketList::packets);
 
-    function("get_av_stream", &get_av_stream, return_value_policy::take_ownership());
-    function("get_av_streams", &get_av_streams, return_value_policy::take_ownership());
-    function("get_media_info", &get_media_info, return_value_policy::take_ownership());
-    function("get_av_packet", &get_av_packet, return_value_policy::take_ownership());
-    function("get_av_packets", &get_av_packets, return_value_policy::take_ownership());
-    function("read_av_packet", &read_av_packet);
+    class_<WebDemuxerSession>("WebDemuxerSession")
+        .constructor<val, WebSessionOptions>()
+        .function("find_stream", &WebDemuxerSession::find_stream_index)
+        .function("set_default_stream", &WebDemuxerSession::set_default_stream)
+        .function("get_av_stream", &WebDemuxerSession::get_av_stream, return_value_policy::take_ownership())
+        .function("get_av_stream_at", &WebDemuxerSession::get_av_stream_at, return_value_policy::take_ownership())
+        .function("get_streams_version", &WebDemuxerSession::get_streams_version)
+        .function("get_stream_version", &WebDemuxerSession::get_stream_version)
+        .function("update_extradata", &WebDemuxerSession::update_extradata)
+        .function("get_output_extradata", &WebDemuxerSession::get_output_extradata)
+        .function("get_av_streams", &WebDemuxerSession::get_av_streams, return_value_policy::take_ownership())
+        .function("get_media_info", &WebDemuxerSession::get_media_info, return_value_policy::take_ownership())
+        .function("get_av_packet", &WebDemuxerSession::get_av_packet, return_value_policy::take_ownership())
+        .function("get_av_packets", &WebDemuxerSession::get_av_packets, return_value_policy::take_ownership())
+        .function("read_next", &WebDemuxerSession::read_next)
+        .function("get_av_packets_at", &WebDemuxerSession::get_av_packets_at)
+        .function("get_frame_packets", &WebDemuxerSession::get_frame_packets)
+        .function("get_packet_index", &WebDemuxerSession::get_packet_index)
+        .function("set_packet_index", &WebDemuxerSession::set_packet_index);
+
+    class_<WebAVPacketReader>("WebAVPacketReader")
+        .constructor<WebDemuxerSession &, WebSessionOptions, double, double, int, int, int>()
+        .constructor<WebDemuxerSession &, WebSessionOptions, double, double, val, int>()
+        .function("next", &WebAVPacketReader::next)
+        .function("close", &WebAVPacketReader::close)
+        .property("done", &WebAVPacketReader::get_done);
+
+    class_<WebRemuxer>("WebRemuxer")
+        .constructor<WebDemuxerSession &, WebSessionOptions, double, double, val, std::string>()
+        .function("next", &WebRemuxer::next);
+
     function("set_av_log_level", &set_av_log_level);
+    function("set_av_log_forwarding", &set_av_log_forwarding);
+    function("get_memory_stats", &get_memory_stats);
 
     register_vector<uint8_t>("vector<uint8_t>");
     register_vector<Tag>("vector<Tag>");
@@ -0,0 +1,868 @@
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "web_demuxer_core.h"
+
+extern "C"
+{
+#include <libavutil/display.h>
+#include <libavutil/pixdesc.h>
+#include <libavcodec/codec_id.h>
+#include "video_codec_string.h"
+#include "audio_codec_string.h"
+};
+
+double get_rotation(AVStream *stream) {
+   for (int i = 0; i < stream->codecpar->nb_coded_side_data; i++) {
+        AVPacketSideData *sd = &stream->codecpar->coded_side_data[i];
+
+        if (sd->type == AV_PKT_DATA_DISPLAYMATRIX && sd->size >= 9*4) {
+            double rotation = av_display_rotation_get((int32_t *)sd->data);
+            if (std::isnan(rotation))
+                rotation = 0;
+            
+            return rotation;
+        }
+    }
+
+    return 0;
+}
+
+std::string gen_rational_str(AVRational rational, char sep)
+{
+    std::ostringstream oss;
+    oss << rational.num << sep << rational.den;
+    return oss.str();
+}
+
+// the av_*_name lookups return NULL for unset (-1) or unknown values, e.g. before find_stream_info
+static std::string name_or_empty(const char *name)
+{
+    return name ? name : "";
+}
+
+double ts_to_seconds(int64_t ts, AVRational time_base)
+{
+    return ts == AV_NOPTS_VALUE ? NAN : ts * av_q2d(time_base);
+}
+
+void gen_web_packet_info(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream)
+{
+    web_packet.stream_index = packet->stream_index;
+    web_packet.keyframe = packet->flags & AV_PKT_FLAG_KEY;
+    web_packet.timestamp = ts_to_seconds(packet->pts, stream->time_base);
+    web_packet.dts = ts_to_seconds(packet->dts, stream->time_base);
+    web_packet.duration = packet->duration * av_q2d(stream->time_base);
+    web_packet.pos = (double)packet->pos;
+    web_packet.flags = packet->flags;
+    web_packet.size = packet->size;
+    web_packet.side_data.clear();
+
+    for (int i = 0; i < packet->side_data_elems; i++)
+    {
+        const AVPacketSideData &sd = packet->side_data[i];
+
+        web_packet.side_data.push_back({
+            .type = (int)sd.type,
+            .data = std::vector<uint8_t>(sd.data, sd.data + sd.size),
+        });
+    }
+}
+
+void gen_web_packet(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream)
+{
+    gen_web_packet_info(web_packet, packet, stream);
+
+    if (packet->size > 0)
+    {
+        web_packet.data = std::vector<uint8_t>(packet->data, packet->data + packet->size);
+    }
+    else
+    {
+        web_packet.data = std::vector<uint8_t>();
+    }
+}
+
+std::string gen_codec_string(AVCodecParameters *par, AVRational *frame_rate)
+{
+    char codec_string[40];
+
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+        set_video_codec_string(codec_string, sizeof(codec_string), par, frame_rate);
+    }
+    else if (par->codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+        set_audio_codec_string(codec_string, sizeof(codec_string), par);
+    }
+    else
+    {
+        strcpy(codec_string, "undf");
+    }
+
+    return codec_string;
+}
+
+void gen_web_stream(WebAVStream &web_stream, AVStream *stream, AVFormatContext *fmt_ctx)
+{
+    web_stream.index = stream->index;
+    web_stream.id = stream->id;
+
+    // codecpar info
+    AVCodecParameters *par = stream->codecpar;
+    web_stream.codec_type = (int)par->codec_type;
+    web_stream.codec_type_string = name_or_empty(av_get_media_type_string(par->codec_type));
+    const AVCodecDescriptor *descriptor = avcodec_descriptor_get(par->codec_id);
+    web_stream.codec_name = name_or_empty(descriptor ? descriptor->name : NULL);
+
+    if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+        web_stream.color_primaries = name_or_empty(av_color_primaries_name(par->color_primaries));
+        web_stream.color_transfer = name_or_empty(av_color_transfer_name(par->color_trc));
+        web_stream.color_space = name_or_empty(av_color_space_name(par->color_space));
+        web_stream.color_range = name_or_empty(av_color_range_name(par->color_range));
+    }
+
+    web_stream.codec_string = gen_codec_string(par, &stream->avg_frame_rate);
+    web_stream.profile = name_or_empty(avcodec_profile_name(par->codec_id, par->profile));
+    web_stream.pix_fmt = name_or_empty(av_get_pix_fmt_name((AVPixelFormat)par->format));
+    web_stream.level = par->level;
+    web_stream.width = par->width;
+    web_stream.height = par->height;
+    web_stream.channels = par->ch_layout.nb_channels;
+    web_stream.sample_rate = par->sample_rate;
+    web_stream.sample_fmt = name_or_empty(av_get_sample_fmt_name((AVSampleFormat)par->format));
+    web_stream.bit_rate = std::to_string(par->bit_rate);
+    web_stream.extradata_size = par->extradata_size;
+    if (par->extradata_size > 0)
+    {
+        web_stream.extradata = std::vector<uint8_t>(par->extradata, par->extradata + par->extradata_size);
+    }
+    else
+    {
+        web_stream.extradata = std::vector<uint8_t>();
+    }
+
+    // other stream info
+    web_stream.start_time = stream->start_time * av_q2d(stream->time_base);
+    web_stream.duration = stream->duration > 0 ? stream->duration * av_q2d(stream->time_base) : fmt_ctx->duration * av_q2d(AV_TIME_BASE_Q); // TODO: some file type can not get stream duration
+    web_stream.rotation = get_rotation(stream);
+
+    int64_t nb_frames = stream->nb_frames;
+
+    // vp8 codec does not have nb_frames
+    if (nb_frames == 0)
+    {
+        nb_frames = (fmt_ctx->duration * (double)stream->avg_frame_rate.num) / ((double)stream->avg_frame_rate.den * AV_TIME_BASE);
+    }
+    web_stream.nb_frames = std::to_string(nb_frames);
+    web_stream.r_frame_rate = gen_rational_str(stream->r_frame_rate, '/');
+    web_stream.avg_frame_rate = gen_rational_str(stream->avg_frame_rate, '/');
+    AVRational sar, dar;
+    sar = av_guess_sample_aspect_ratio(fmt_ctx, stream, NULL);
+
+    if (sar.num)
+    {
+        av_reduce(&dar.num, &dar.den, par->width * sar.num, par->height * sar.den, 1024 * 1024);
+        web_stream.sample_aspect_ratio = gen_rational_str(sar, ':');
+        web_stream.display_aspect_ratio = gen_rational_str(dar, ':');
+    }
+    else
+    {
+        web_stream.sample_aspect_ratio = std::string("N/A");
+        web_stream.display_aspect_ratio = std::string("N/A");
+    }
+
+    AVDictionaryEntry *tag = NULL;
+
+    while ((tag = av_dict_get(stream->metadata, "", tag, AV_DICT_IGNORE_SUFFIX)))
+    {
+        Tag t = {
+            .key = tag->key,
+            .value = tag->value,
+        };
+        web_stream.tags.push_back(t);
+    }
+}
+
+int set_stream_extradata(AVStream *stream, const uint8_t *data, size_t size)
+{
+    AVCodecParameters *par = stream->codecpar;
+
+    if ((size_t)par->extradata_size == size && (size == 0 || memcmp(par->extradata, data, size) == 0))
+    {
+        return 0;
+    }
+
+    uint8_t *extradata = (uint8_t *)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+    if (!extradata)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    memcpy(extradata, data, size);
+    av_freep(&par->extradata);
+    par->extradata = extradata;
+    par->extradata_size = (int)size;
+
+    return 1;
+}
+
+int apply_new_extradata(AVStream *stream, AVPacket *packet)
+{
+    size_t size = 0;
+    uint8_t *data = av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, &size);
+
+    if (!data || size == 0)
+    {
+        return 0;
+    }
+
+    return set_stream_extradata(stream, data, size);
+}
+
+static bool has_header_streams(AVFormatContext *fmt_ctx)
+{
+    return fmt_ctx->nb_streams > 0 && !(fmt_ctx->ctx_flags & AVFMTCTX_NOHEADER);
+}
+
+static bool has_stream_info(AVFormatContext *fmt_ctx)
+{
+    if (!has_header_streams(fmt_ctx))
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++)
+    {
+        AVCodecParameters *par = fmt_ctx->streams[i]->codecpar;
+
+        if (par->codec_id == AV_CODEC_ID_NONE)
+        {
+            return false;
+        }
+
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO && (par->width <= 0 || par->height <= 0))
+        {
+            return false;
+        }
+
+        if (par->codec_type == AVMEDIA_TYPE_AUDIO && (par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void open_input(AVFormatContext **fmt_ctx, const char *url, AVIOContext *pb, int probe_policy, bool header_only)
+{
+    int ret;
+
+    *fmt_ctx = avformat_alloc_context();
+
+    if (!*fmt_ctx)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot allocate format context\n");
+        throw std::runtime_error("Cannot allocate format context");
+    }
+
+    (*fmt_ctx)->pb = pb;
+
+    if (probe_policy == WEB_PROBE_FAST)
+    {
+        (*fmt_ctx)->probesize = 256 * 1024;
+        (*fmt_ctx)->max_analyze_duration = AV_TIME_BASE / 2;
+    }
+    else if (probe_policy == WEB_PROBE_THOROUGH)
+    {
+        (*fmt_ctx)->probesize = 50 * 1024 * 1024;
+        (*fmt_ctx)->max_analyze_duration = 30 * AV_TIME_BASE;
+    }
+
+    if ((ret = avformat_open_input(fmt_ctx, url, NULL, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open input file\n");
+        avformat_close_input(fmt_ctx);
+        throw std::runtime_error("Cannot open input file");
+    }
+
+    if ((header_only && has_header_streams(*fmt_ctx)) || (probe_policy == WEB_PROBE_FAST && has_stream_info(*fmt_ctx)))
+    {
+        return;
+    }
+
+    if ((ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
+        avformat_close_input(fmt_ctx);
+        throw std::runtime_error("Cannot find stream information");
+    }
+}
+
+void open_input_from(AVFormatContext **fmt_ctx, AVIOContext *pb, const AVFormatContext *probed, int probe_policy)
+{
+    int ret;
+
+    open_input(fmt_ctx, NULL, pb, probe_policy, true);
+
+    // a header that does not list every probed stream is probed as usual
+    if ((*fmt_ctx)->nb_streams != probed->nb_streams && (ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find stream information\n");
+        avformat_close_input(fmt_ctx);
+        throw std::runtime_error("Cannot find stream information");
+    }
+
+    for (unsigned int i = 0; i < (*fmt_ctx)->nb_streams && i < probed->nb_streams; i++)
+    {
+        AVStream *stream = (*fmt_ctx)->streams[i];
+        const AVStream *probed_stream = probed->streams[i];
+
+        if ((ret = avcodec_parameters_copy(stream->codecpar, probed_stream->codecpar)) < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot copy stream parameters\n");
+            avformat_close_input(fmt_ctx);
+            throw std::runtime_error("Cannot copy stream parameters");
+        }
+
+        stream->avg_frame_rate = probed_stream->avg_frame_rate;
+        stream->r_frame_rate = probed_stream->r_frame_rate;
+    }
+}
+
+int find_stream(AVFormatContext *fmt_ctx, int type, int wanted_stream_nb)
+{
+    int stream_index = av_find_best_stream(fmt_ctx, (AVMediaType)type, wanted_stream_nb, -1, NULL, 0);
+
+    if (stream_index < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find wanted stream in the input file\n");
+        throw std::runtime_error("Cannot find wanted stream in the input file");
+    }
+
+    return stream_index;
+}
+
+int seek_stream(AVFormatContext *fmt_ctx, int stream_index, double timestamp, int seek_flag)
+{
+    int64_t int64_timestamp = (int64_t)(timestamp * AV_TIME_BASE);
+    int64_t seek_time_stamp = av_rescale_q(int64_timestamp, AV_TIME_BASE_Q, fmt_ctx->streams[stream_index]->time_base);
+
+    return av_seek_frame(fmt_ctx, stream_index, seek_time_stamp, seek_flag);
+}
+
+int read_stream_packet(AVFormatContext *fmt_ctx, int stream_index, AVPacket *packet)
+{
+    int ret;
+
+    while ((ret = av_read_frame(fmt_ctx, packet)) >= 0)
+    {
+        if (packet->stream_index == stream_index)
+        {
+            break;
+        }
+        av_packet_unref(packet);
+    }
+
+    return ret;
+}
+
+AVPacketPtr alloc_packet()
+{
+    AVPacketPtr packet(av_packet_alloc());
+
+    if (!packet)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot allocate packet\n");
+        throw std::runtime_error("Cannot allocate packet");
+    }
+
+    return packet;
+}
+
+StreamDiscard::StreamDiscard(AVFormatContext *fmt_ctx, const std::vector<int> &keep) : fmt_ctx(fmt_ctx), discards(fmt_ctx->nb_streams)
+{
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++)
+    {
+        discards[i] = fmt_ctx->streams[i]->discard;
+        if (std::find(keep.begin(), keep.end(), (int)i) == keep.end())
+        {
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+}
+
+StreamDiscard::~StreamDiscard()
+{
+    for (unsigned int i = 0; i < discards.size() && i < fmt_ctx->nb_streams; i++)
+    {
+        fmt_ctx->streams[i]->discard = discards[i];
+    }
+}
+
+static PacketArenaStats packet_arena_stats = {};
+
+const PacketArenaStats &get_packet_arena_stats()
+{
+    return packet_arena_stats;
+}
+
+PacketArena::PacketArena()
+{
+    packet_arena_stats.arenas++;
+}
+
+PacketArena::~PacketArena()
+{
+    packet_arena_stats.arenas--;
+    packet_arena_stats.capacity -= packets.size();
+    for (AVPacket *packet : packets)
+    {
+        av_packet_free(&packet);
+    }
+}
+
+int PacketArena::add(const AVPacket *packet)
+{
+    if (used == (int)packets.size())
+    {
+        AVPacket *kept = av_packet_alloc();
+
+        if (!kept)
+        {
+            return AVERROR(ENOMEM);
+        }
+
+        packets.push_back(kept);
+        packet_arena_stats.capacity++;
+        packet_arena_stats.growths++;
+        grown = true;
+    }
+
+    int ret = av_packet_ref(packets[used], packet);
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    int64_t size = packet->size;
+
+    for (int i = 0; i < packet->side_data_elems; i++)
+    {
+        size += packet->side_data[i].size;
+    }
+
+    used++;
+    bytes += size;
+
+    packet_arena_stats.high_water = std::max(packet_arena_stats.high_water, bytes);
+    packet_arena_stats.packets++;
+    packet_arena_stats.bytes += size;
+
+    return 0;
+}
+
+void PacketArena::reset()
+{
+    if (used > 0 && !grown)
+    {
+        packet_arena_stats.reuses++;
+    }
+
+    for (int i = 0; i < used; i++)
+    {
+        av_packet_unref(packets[i]);
+    }
+
+    used = 0;
+    bytes = 0;
+    grown = false;
+}
+
+/**
+ * how far (seconds) the demuxer reads ahead instead of seeking: to the next
+ * target in get_packets_at, past the timestamp in get_stream_packets_at
+ */
+static const double read_ahead_seconds = 5.0;
+
+// the look-ahead of get_stream_packets_at while a subtitle or data stream is
+// unresolved, their packets can be far apart
+static const double sparse_read_ahead_seconds = 60.0;
+
+static bool is_sparse_stream(AVStream *stream)
+{
+    return stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO && stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO;
+}
+
+static int64_t packet_time(AVPacket *packet)
+{
+    return packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+}
+
+std::vector<int> get_packets_at(AVFormatContext *fmt_ctx, int stream_index, const std::vector<double> &times, int seek_flag, const std::function<void(AVPacket *)> &add_packet)
+{
+    AVStream *stream = fmt_ctx->streams[stream_index];
+    std::vector<int> result(times.size(), -1);
+    std::vector<int> order;
+
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        if (!std::isnan(times[i]))
+        {
+            order.push_back(i);
+        }
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&times](int a, int b)
+                     { return times[a] < times[b]; });
+
+    // a backward seek returns the last keyframe at or before the target, which
+    // a forward read finds as well: the last keyframe before the first packet
+    // past the target (or the previous result if there is none in between)
+    bool read_forward = seek_flag == AVSEEK_FLAG_BACKWARD;
+    AVPacketPtr packet = alloc_packet();
+    AVPacketPtr keyframe = alloc_packet();
+    // first packet past the previous target, the next forward read starts with it
+    AVPacketPtr lookahead = alloc_packet();
+    bool has_lookahead = false;
+    StreamDiscard discard(fmt_ctx, {stream_index});
+
+    int count = 0;
+    int last = -1;
+    double last_time = 0;
+    int64_t last_pos = -1;
+    int64_t last_ts = AV_NOPTS_VALUE;
+
+    auto add = [&](AVPacket *added)
+    {
+        add_packet(added);
+        last = count++;
+        last_pos = added->pos;
+        last_ts = packet_time(added);
+    };
+
+    for (int i : order)
+    {
+        double time = times[i];
+
+        if (read_forward && last >= 0 && time - last_time <= read_ahead_seconds)
+        {
+            int64_t target = av_rescale_q((int64_t)(time * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+            bool found = false;
+
+            while (true)
+            {
+                if (has_lookahead)
+                {
+                    av_packet_move_ref(packet.get(), lookahead.get());
+                    has_lookahead = false;
+                }
+                else if (read_stream_packet(fmt_ctx, stream_index, packet.get()) < 0)
+                {
+                    av_packet_unref(packet.get());
+                    break;
+                }
+
+                int64_t ts = packet_time(packet.get());
+
+                if (ts != AV_NOPTS_VALUE && ts > target)
+                {
+                    av_packet_move_ref(lookahead.get(), packet.get());
+                    has_lookahead = true;
+                    break;
+                }
+
+                if (packet->flags & AV_PKT_FLAG_KEY)
+                {
+                    av_packet_unref(keyframe.get());
+                    av_packet_move_ref(keyframe.get(), packet.get());
+                    found = true;
+                }
+                else
+                {
+                    av_packet_unref(packet.get());
+                }
+            }
+
+            if (found)
+            {
+                add(keyframe.get());
+                av_packet_unref(keyframe.get());
+            }
+
+            result[i] = last;
+            last_time = time;
+            continue;
+        }
+
+        av_packet_unref(lookahead.get());
+        has_lookahead = false;
+
+        if (seek_stream(fmt_ctx, stream_index, time, seek_flag) < 0 ||
+            read_stream_packet(fmt_ctx, stream_index, packet.get()) < 0)
+        {
+            av_packet_unref(packet.get());
+            last = -1;
+            continue;
+        }
+
+        if (last < 0 || packet->pos != last_pos || packet_time(packet.get()) != last_ts)
+        {
+            add(packet.get());
+        }
+        av_packet_unref(packet.get());
+
+        result[i] = last;
+        last_time = time;
+    }
+
+    return result;
+}
+
+void get_stream_packets_at(AVFormatContext *fmt_ctx, double timestamp, int seek_flag, std::vector<AVPacketPtr> &packets)
+{
+    unsigned int nb_streams = fmt_ctx->nb_streams;
+    bool keyframes_only = !(seek_flag & AVSEEK_FLAG_ANY);
+    // a stream is resolved by its first packet past the timestamp
+    std::vector<bool> resolved(nb_streams, false);
+    unsigned int remaining = nb_streams;
+    unsigned int remaining_sparse = 0;
+    AVPacketPtr packet = alloc_packet();
+
+    packets.clear();
+    for (unsigned int i = 0; i < nb_streams; i++)
+    {
+        packets.push_back(alloc_packet());
+        if (fmt_ctx->streams[i]->discard >= AVDISCARD_ALL)
+        {
+            resolved[i] = true;
+            remaining--;
+        }
+        else if (is_sparse_stream(fmt_ctx->streams[i]))
+        {
+            remaining_sparse++;
+        }
+    }
+
+    // one seek for all streams, on the default stream, which lands at or before
+    // the timestamp of the others in interleaved inputs
+    if (av_seek_frame(fmt_ctx, -1, (int64_t)(timestamp * AV_TIME_BASE), seek_flag) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
+        throw std::runtime_error("Cannot seek to the specified timestamp");
+    }
+
+    while (remaining > 0 && av_read_frame(fmt_ctx, packet.get()) >= 0)
+    {
+        int index = packet->stream_index;
+        AVStream *stream = fmt_ctx->streams[index];
+        int64_t ts = packet_time(packet.get());
+        double seconds = ts == AV_NOPTS_VALUE ? NAN : ts * av_q2d(stream->time_base);
+
+        // bounded look-ahead: streams without a packet by now are absent here,
+        // do not scan the rest of the input. wider while sparse streams are left
+        if (seconds > timestamp + (remaining_sparse > 0 ? sparse_read_ahead_seconds : read_ahead_seconds))
+        {
+            break;
+        }
+
+        if (resolved[index])
+        {
+            av_packet_unref(packet.get());
+            continue;
+        }
+
+        AVPacket *found = packets[index].get();
+
+        if (seconds > timestamp)
+        {
+            if (!found->buf)
+            {
+                av_packet_move_ref(found, packet.get());
+            }
+            resolved[index] = true;
+            remaining--;
+            if (is_sparse_stream(stream))
+            {
+                remaining_sparse--;
+            }
+        }
+        else if (!keyframes_only || (packet->flags & AV_PKT_FLAG_KEY))
+        {
+            av_packet_unref(found);
+            av_packet_move_ref(found, packet.get());
+        }
+
+        av_packet_unref(packet.get());
+    }
+
+    av_packet_unref(packet.get());
+}
+
+int get_frame_packets(AVFormatContext *fmt_ctx, int stream_index, double timestamp, std::vector<AVPacketPtr> &packets)
+{
+    AVStream *stream = fmt_ctx->streams[stream_index];
+    int64_t target = av_rescale_q((int64_t)(timestamp * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+    int target_index = -1;
+    int64_t target_pts = AV_NOPTS_VALUE;
+    AVPacketPtr packet = alloc_packet();
+    StreamDiscard discard(fmt_ctx, {stream_index});
+
+    packets.clear();
+
+    if (av_seek_frame(fmt_ctx, stream_index, target, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot seek to the specified timestamp\n");
+        throw std::runtime_error("Cannot seek to the specified timestamp");
+    }
+
+    while (read_stream_packet(fmt_ctx, stream_index, packet.get()) >= 0)
+    {
+        int64_t ts = packet_time(packet.get());
+        bool keyframe = packet->flags & AV_PKT_FLAG_KEY;
+        bool past_target = ts != AV_NOPTS_VALUE && ts > target;
+
+        // packets decoded after the target frame are not needed for it
+        if (past_target && !packets.empty())
+        {
+            break;
+        }
+
+        // the seek may land before the last keyframe (sparse index), start there
+        if (keyframe && !past_target)
+        {
+            packets.clear();
+            target_index = -1;
+            target_pts = AV_NOPTS_VALUE;
+        }
+
+        if (packets.empty() && !keyframe)
+        {
+            av_packet_unref(packet.get());
+            continue;
+        }
+
+        if (packet->pts != AV_NOPTS_VALUE && packet->pts <= target &&
+            (target_pts == AV_NOPTS_VALUE || packet->pts >= target_pts))
+        {
+            target_index = packets.size();
+            target_pts = packet->pts;
+        }
+
+        AVPacketPtr kept = alloc_packet();
+
+        av_packet_move_ref(kept.get(), packet.get());
+        packets.push_back(std::move(kept));
+
+        // the timestamp is before the first keyframe, which is the target then
+        if (past_target)
+        {
+            break;
+        }
+    }
+
+    av_packet_unref(packet.get());
+
+    if (packets.empty())
+    {
+        return -1;
+    }
+
+    return target_index < 0 ? 0 : target_index;
+}
+
+void get_range_packets(AVFormatContext *fmt_ctx, int stream_index, double start, double end, std::vector<AVPacketPtr> &packets)
+{
+    AVStream *stream = fmt_ctx->streams[stream_index];
+    AVPacketPtr packet = alloc_packet();
+    StreamDiscard discard(fmt_ctx, {stream_index});
+
+    packets.clear();
+
+    if (seek_stream(fmt_ctx, stream_index, start, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        return;
+    }
+
+    while (read_stream_packet(fmt_ctx, stream_index, packet.get()) >= 0)
+    {
+        if (packet->pts != AV_NOPTS_VALUE)
+        {
+            double pts = ts_to_seconds(packet->pts, stream->time_base);
+
+            if (pts > end)
+            {
+                break;
+            }
+
+            if (pts + ts_to_seconds(packet->duration, stream->time_base) <= start)
+            {
+                av_packet_unref(packet.get());
+                continue;
+            }
+        }
+
+        AVPacketPtr kept = alloc_packet();
+
+        av_packet_move_ref(kept.get(), packet.get());
+        packets.push_back(std::move(kept));
+    }
+
+    av_packet_unref(packet.get());
+}
+
+static void scan_packet_index(WebPacketIndex &packet_index, AVFormatContext *fmt_ctx, AVStream *stream)
+{
+    AVPacketPtr packet = alloc_packet();
+    // skip payloads of the other streams where the demuxer supports it
+    StreamDiscard discard(fmt_ctx, {stream->index});
+
+    if (av_seek_frame(fmt_ctx, -1, INT64_MIN, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        av_seek_frame(fmt_ctx, -1, 0, AVSEEK_FLAG_BYTE);
+    }
+
+    while (av_read_frame(fmt_ctx, packet.get()) >= 0)
+    {
+        if (packet->stream_index == stream->index)
+        {
+            packet_index.add(ts_to_seconds(packet->pts, stream->time_base),
+                             ts_to_seconds(packet->dts, stream->time_base),
+                             packet->pos,
+                             packet->size,
+                             packet->flags & AV_PKT_FLAG_KEY);
+        }
+        av_packet_unref(packet.get());
+    }
+}
+
+void build_packet_index(WebPacketIndex &packet_index, AVFormatContext *fmt_ctx, AVStream *stream)
+{
+    int entries = avformat_index_get_entries_count(stream);
+
+    packet_index.stream_index = stream->index;
+
+    if (entries > 0 && stream->nb_frames > 0 && entries >= stream->nb_frames)
+    {
+        // the entries are in decode order, with reordered frames their pts is unknown
+        bool reordered = stream->codecpar->video_delay > 0;
+
+        for (int i = 0; i < entries; i++)
+        {
+            const AVIndexEntry *entry = avformat_index_get_entry(stream, i);
+            double timestamp = ts_to_seconds(entry->timestamp, stream->time_base);
+
+            packet_index.add(reordered ? NAN : timestamp, timestamp, entry->pos, entry->size, entry->flags & AVINDEX_KEYFRAME ? 1 : 0);
+        }
+    }
+    else
+    {
+        scan_packet_index(packet_index, fmt_ctx, stream);
+    }
+}
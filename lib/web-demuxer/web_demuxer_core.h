@@ -0,0 +1,420 @@
+/**
+ * demux core shared by the wasm module (web_demuxer.cpp, embind glue) and the
+ * native build (make web-demuxer-native), it depends on libavformat only.
+ */
+#ifndef WEB_DEMUXER_CORE_H
+#define WEB_DEMUXER_CORE_H
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/bind.h>
+#include <emscripten/val.h>
+
+using namespace emscripten;
+#endif
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/avutil.h>
+};
+
+typedef struct Tag
+{
+    std::string key;
+    std::string value;
+} Tag;
+
+typedef struct WebAVStream
+{
+    int index;
+    int id;
+    /** Codec Info from codecpar */
+    int codec_type;
+    std::string codec_type_string;
+    std::string codec_name;
+    std::string codec_string;
+    std::string profile;
+    std::string pix_fmt;
+    std::string color_primaries;
+    std::string color_transfer;
+    std::string color_space;
+    std::string color_range;
+    int level;
+    int width;
+    int height;
+    int channels;
+    int sample_rate;
+    std::string sample_fmt;
+    std::string bit_rate;
+    int extradata_size;
+    std::vector<uint8_t> extradata;
+#ifdef __EMSCRIPTEN__
+    val get_extradata() const{
+        return val(typed_memory_view(extradata.size(), extradata.data()));
+    }
+#endif
+    /** Other Info */
+    std::string r_frame_rate;
+    std::string avg_frame_rate;
+    std::string sample_aspect_ratio;
+    std::string display_aspect_ratio;
+    double start_time;
+    double duration;
+    double rotation;
+    std::string nb_frames;
+    std::vector<Tag> tags;
+} WebAVStream;
+
+typedef struct WebAVPacketSideData
+{
+    /** AVPacketSideDataType, e.g. AV_PKT_DATA_NEW_EXTRADATA */
+    int type;
+    std::vector<uint8_t> data;
+} WebAVPacketSideData;
+
+typedef struct WebAVPacket
+{
+    int stream_index;
+    int keyframe;
+    /** pts, dts and duration in seconds, NaN when unknown */
+    double timestamp;
+    double dts;
+    double duration;
+    /** byte position in the input, -1 when unknown */
+    double pos;
+    /** AV_PKT_FLAG_* (key, corrupt, discard, ...) */
+    int flags;
+    int size;
+    std::vector<uint8_t> data;
+    std::vector<WebAVPacketSideData> side_data;
+#ifdef __EMSCRIPTEN__
+    /** payload already written into a js owned Uint8Array (zero copy mode) */
+    val js_data = val::undefined();
+    val get_data() const{
+        if (!js_data.isUndefined())
+        {
+            return js_data;
+        }
+        return val(typed_memory_view(data.size(), data.data()));
+    }
+    bool get_zero_copy() const{
+        return !js_data.isUndefined();
+    }
+    /** [{ type, data: Uint8Array }], copied so the result outlives the packet */
+    val get_side_data() const{
+        val result = val::array();
+
+        for (const WebAVPacketSideData &sd : side_data)
+        {
+            val entry = val::object();
+
+            entry.set("type", sd.type);
+            entry.set("data", val::global("Uint8Array").new_(typed_memory_view(sd.data.size(), sd.data.data())));
+            result.call<void>("push", entry);
+        }
+
+        return result;
+    }
+#endif
+} WebAVPacket;
+
+typedef struct WebAVStreamList
+{
+    int size;
+    std::vector<WebAVStream> streams;
+} WebAVStreamList;
+
+typedef struct WebAVPacketList
+{
+    int size;
+    std::vector<WebAVPacket> packets;
+} WebAVPacketList;
+
+typedef struct WebMediaInfo
+{
+    std::string format_name;
+    double start_time;
+    double duration;
+    std::string bit_rate;
+    int nb_streams;
+    int nb_chapters;
+    int flags;
+    std::vector<WebAVStream> streams;
+} WebMediaInfo;
+
+/**
+ * WebPacketIndex is the per sample table of one stream (times in seconds,
+ * NaN when unknown), exported to js as typed arrays and importable back so a
+ * reopened session can skip building it.
+ */
+typedef struct WebPacketIndex
+{
+    int stream_index;
+    std::vector<double> pts;
+    std::vector<double> dts;
+    std::vector<double> pos;
+    std::vector<int32_t> size;
+    std::vector<uint8_t> keyframe;
+
+    void add(double pts_value, double dts_value, int64_t pos_value, int size_value, int keyframe_value)
+    {
+        pts.push_back(pts_value);
+        dts.push_back(dts_value);
+        pos.push_back((double)pos_value);
+        size.push_back(size_value);
+        keyframe.push_back(keyframe_value);
+    }
+
+#ifdef __EMSCRIPTEN__
+    val to_js() const
+    {
+        val result = val::object();
+
+        result.set("stream_index", stream_index);
+        result.set("count", (int)pts.size());
+        result.set("pts", val::global("Float64Array").new_(typed_memory_view(pts.size(), pts.data())));
+        result.set("dts", val::global("Float64Array").new_(typed_memory_view(dts.size(), dts.data())));
+        result.set("pos", val::global("Float64Array").new_(typed_memory_view(pos.size(), pos.data())));
+        result.set("size", val::global("Int32Array").new_(typed_memory_view(size.size(), size.data())));
+        result.set("keyframe", val::global("Uint8Array").new_(typed_memory_view(keyframe.size(), keyframe.data())));
+
+        return result;
+    }
+
+    static WebPacketIndex from_js(val index)
+    {
+        WebPacketIndex packet_index = {
+            .stream_index = index["stream_index"].as<int>(),
+            .pts = convertJSArrayToNumberVector<double>(index["pts"]),
+            .dts = convertJSArrayToNumberVector<double>(index["dts"]),
+            .pos = convertJSArrayToNumberVector<double>(index["pos"]),
+            .size = convertJSArrayToNumberVector<int32_t>(index["size"]),
+            .keyframe = convertJSArrayToNumberVector<uint8_t>(index["keyframe"]),
+        };
+        size_t count = packet_index.pts.size();
+
+        if (packet_index.dts.size() != count || packet_index.pos.size() != count ||
+            packet_index.size.size() != count || packet_index.keyframe.size() != count)
+        {
+            throw std::runtime_error("Invalid packet index");
+        }
+
+        return packet_index;
+    }
+#endif
+} WebPacketIndex;
+
+double get_rotation(AVStream *stream);
+
+std::string gen_rational_str(AVRational rational, char sep);
+
+double ts_to_seconds(int64_t ts, AVRational time_base);
+
+/** fill the packet info (timestamps, pos, flags, size, side data) without the payload */
+void gen_web_packet_info(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream);
+
+/** fill the packet info and copy the payload into web_packet.data */
+void gen_web_packet(WebAVPacket &web_packet, AVPacket *packet, AVStream *stream);
+
+/** WebCodecs / MSE codec string of codec parameters, e.g. avc1.64001f, "undf" for other than audio and video */
+std::string gen_codec_string(AVCodecParameters *par, AVRational *frame_rate);
+
+void gen_web_stream(WebAVStream &web_stream, AVStream *stream, AVFormatContext *fmt_ctx);
+
+/**
+ * replace the codecpar extradata of stream (in-band parameter change),
+ * returns 1 if it changed, 0 if it is the same, or a negative AVERROR
+ */
+int set_stream_extradata(AVStream *stream, const uint8_t *data, size_t size);
+
+/** set_stream_extradata from the AV_PKT_DATA_NEW_EXTRADATA side data of packet, 0 if it has none */
+int apply_new_extradata(AVStream *stream, AVPacket *packet);
+
+/**
+ * how much of the input avformat_find_stream_info may read and decode
+ *   DEFAULT: libavformat defaults (5MB / 5s)
+ *   FAST: 256KB / 0.5s, skipped entirely when the header already describes
+ *     every stream (codec, size / sample rate), e.g. mp4 and matroska
+ *   THOROUGH: 50MB / 30s, for inputs whose streams start late
+ */
+enum WebProbePolicy
+{
+    WEB_PROBE_DEFAULT = 0,
+    WEB_PROBE_FAST = 1,
+    WEB_PROBE_THOROUGH = 2,
+};
+
+/**
+ * open and probe an input, either from url or, when pb is set, from a custom
+ * AVIOContext (url may then be NULL). with header_only the stream info probe
+ * is skipped unless the format only creates its streams while reading
+ * (mpeg-ps, flv, ...). throws std::runtime_error on failure.
+ */
+void open_input(AVFormatContext **fmt_ctx, const char *url, AVIOContext *pb, int probe_policy = WEB_PROBE_DEFAULT, bool header_only = false);
+
+/**
+ * open pb as another context over the input already opened and probed as
+ * probed (e.g. for a reader next to a session): only the header is parsed,
+ * the stream parameters found by the probe are copied instead of probed
+ * again. throws std::runtime_error on failure.
+ */
+void open_input_from(AVFormatContext **fmt_ctx, AVIOContext *pb, const AVFormatContext *probed, int probe_policy = WEB_PROBE_DEFAULT);
+
+/** av_find_best_stream, throws std::runtime_error if there is no such stream */
+int find_stream(AVFormatContext *fmt_ctx, int type, int wanted_stream_nb);
+
+/** seek stream_index to timestamp (seconds), returns av_seek_frame's result */
+int seek_stream(AVFormatContext *fmt_ctx, int stream_index, double timestamp, int seek_flag);
+
+/** read frames until one of stream_index, returns av_read_frame's result */
+int read_stream_packet(AVFormatContext *fmt_ctx, int stream_index, AVPacket *packet);
+
+/** owning AVPacket pointer, released with av_packet_free */
+struct AVPacketDeleter
+{
+    void operator()(AVPacket *packet) const
+    {
+        av_packet_free(&packet);
+    }
+};
+
+typedef std::unique_ptr<AVPacket, AVPacketDeleter> AVPacketPtr;
+
+/** av_packet_alloc, throws std::runtime_error on failure */
+AVPacketPtr alloc_packet();
+
+/**
+ * StreamDiscard sets AVDISCARD_ALL on every stream but the kept ones, so the
+ * demuxer skips their payloads where it can, and restores the previous
+ * discard levels when it goes out of scope.
+ */
+class StreamDiscard
+{
+public:
+    StreamDiscard(AVFormatContext *fmt_ctx, const std::vector<int> &keep);
+    ~StreamDiscard();
+
+    StreamDiscard(const StreamDiscard &) = delete;
+    StreamDiscard &operator=(const StreamDiscard &) = delete;
+
+private:
+    AVFormatContext *fmt_ctx;
+    std::vector<AVDiscard> discards;
+};
+
+/** counters over all PacketArena instances */
+typedef struct PacketArenaStats
+{
+    /** arenas alive and the AVPackets they keep for the next batch */
+    int64_t arenas;
+    int64_t capacity;
+    /** most payload bytes referenced by one batch */
+    int64_t high_water;
+    /** AVPacket allocations, and batches served by the packets already kept */
+    int64_t growths;
+    int64_t reuses;
+    /** packets and payload bytes referenced */
+    int64_t packets;
+    int64_t bytes;
+} PacketArenaStats;
+
+const PacketArenaStats &get_packet_arena_stats();
+
+/**
+ * PacketArena references the packets of one batch (av_packet_ref, no payload
+ * copy) in AVPackets that are kept for the next batch, so steady streaming
+ * does not allocate per packet. the payloads are copied once, when the batch
+ * is written out (see WebAVPacketBatch::to_js), and the demuxer buffers are
+ * released by reset().
+ */
+class PacketArena
+{
+public:
+    PacketArena();
+    ~PacketArena();
+
+    PacketArena(const PacketArena &) = delete;
+    PacketArena &operator=(const PacketArena &) = delete;
+
+    /** reference a packet at the end, returns 0 or a negative AVERROR */
+    int add(const AVPacket *packet);
+
+    /** unreference the packets and keep the AVPackets */
+    void reset();
+
+    int count() const
+    {
+        return used;
+    }
+
+    const AVPacket *packet(int i) const
+    {
+        return packets[i];
+    }
+
+    /** payload and side data bytes referenced */
+    int64_t size() const
+    {
+        return bytes;
+    }
+
+private:
+    std::vector<AVPacket *> packets;
+    int used = 0;
+    int64_t bytes = 0;
+    bool grown = false;
+};
+
+/**
+ * resolve the packet of stream_index at each of times (seconds) on one
+ * context. targets are visited in ascending order; with a plain backward seek
+ * a target shortly after the previous one is reached by reading forward
+ * instead of seeking again, and targets resolving to the same packet share it.
+ * add_packet is called once per distinct packet, the result holds for every
+ * time (in request order) the number of its packet in add_packet call order,
+ * -1 where no packet was found.
+ */
+std::vector<int> get_packets_at(AVFormatContext *fmt_ctx, int stream_index, const std::vector<double> &times, int seek_flag, const std::function<void(AVPacket *)> &add_packet);
+
+/**
+ * get the packet of every stream at timestamp (seconds) with one seek and one
+ * forward scan: for each stream the last keyframe (any packet with
+ * AVSEEK_FLAG_ANY) at or before the timestamp, else its first packet after
+ * it. the scan stops once every stream is resolved, at the end of the input
+ * or a few seconds past the timestamp (a minute while a subtitle or data
+ * stream is unresolved); packets[i] is left empty (no data, size 0) for a
+ * stream without a packet in that range.
+ * throws std::runtime_error if the seek fails.
+ */
+void get_stream_packets_at(AVFormatContext *fmt_ctx, double timestamp, int seek_flag, std::vector<AVPacketPtr> &packets);
+
+/**
+ * collect what a decoder needs to output the frame of stream_index shown at
+ * timestamp (seconds): the last keyframe at or before it and every following
+ * packet up to the last one with dts <= timestamp, in decode order.
+ * returns the position in packets of the target (the largest pts <= timestamp),
+ * -1 if no keyframe was found. throws std::runtime_error if the seek fails.
+ */
+int get_frame_packets(AVFormatContext *fmt_ctx, int stream_index, double timestamp, std::vector<AVPacketPtr> &packets);
+
+/** collect the packets of stream_index overlapping [start, end] (seconds) in decode order, none if the seek fails */
+void get_range_packets(AVFormatContext *fmt_ctx, int stream_index, double start, double end, std::vector<AVPacketPtr> &packets);
+
+/**
+ * build the sample table of a stream. formats with a complete native index
+ * (mov/mp4 sample tables) are served from the AVStream index entries, whose
+ * timestamps are dts: pts is reported equal to them, or NaN for video with
+ * reordered frames (codecpar->video_delay > 0); others (flv, mpeg-ps, avi
+ * without idx1, ...) are built by one linear scan.
+ */
+void build_packet_index(WebPacketIndex &packet_index, AVFormatContext *fmt_ctx, AVStream *stream);
+
+#endif
@@ -1,6 +1,7 @@
-import { FFMpegWorkerMessageType, GetAVPacketMessageData, GetAVPacketsMessageData, GetAVStreamMessageData, GetAVStreamsMessageData, GetMediaInfoMessageData, LoadWASMMessageData, ReadAVPacketMessageData, SetAVLogLevelMessageData, WebAVPacket, WebAVStream } from "./types";
+import { FFMpegWorkerMessageType, GetAVPacketMessageData, GetAVPacketsAtMessageData, GetAVPacketsMessageData, GetAVStreamMessageData, GetDecoderConfigMessageData, GetFramePacketsMessageData, GetPacketIndexMessageData, LoadSourceMessageData, LoadWASMMessageData, ReadAVPacketMessageData, RemuxRangeMessageData, SetAVLogLevelMessageData, SetPacketIndexMessageData, WebAVPacket, WebAVPacketBatch, WebAVStream } from "./types";
 
 let Module: any; // TODO: rm any
+let session: any; // DemuxSession of the loaded source
 
 self.postMessage({
   type: "FFmpegWorkerLoaded",
@@ -13,20 +14,42 @@ self.addEventListener("message", async function (e) {
     switch (type) {
       case "LoadWASM":
         return await handleLoadWASM(data);
+      case "LoadSource":
+        return await handleLoadSource(data, msgId);
+      case "DestroySource":
+        return handleDestroySource(msgId);
       case "GetAVStream":
         return handleGetAVStream(data, msgId);
       case "GetAVStreams":
-        return handleGetAVStreams(data, msgId);
+        return handleGetAVStreams(msgId);
       case "GetMediaInfo":
-        return handleGetMediaInfo(data, msgId);
+        return handleGetMediaInfo(msgId);
+      case "GetDecoderConfig":
+        return handleGetDecoderConfig(data, msgId);
       case "GetAVPacket":
         return handleGetAVPacket(data, msgId);
       case "GetAVPackets":
         return handleGetAVPackets(data, msgId);
+      case "GetAVPacketsAt":
+        return handleGetAVPacketsAt(data, msgId);
+      case "GetFramePackets":
+        return handleGetFramePackets(data, msgId);
+      case "GetPacketIndex":
+        return handleGetPacketIndex(data, msgId);
+      case "SetPacketIndex":
+        return handleSetPacketIndex(data, msgId);
       case "ReadAVPacket":
         return await handleReadAVPacket(data, msgId);
+      case "RemuxRange":
+        return await handleRemuxRange(data, msgId);
       case "SetAVLogLevel":
         return handleSetAVLogLevel(data, msgId);
+      case "GetUrlCacheStats":
+        return handleGetUrlCacheStats(msgId);
+      case "GetMemoryStats":
+        return handleGetMemoryStats(msgId);
+      case "GetStats":
+        return handleGetStats(msgId);
       default:
         return;
     }
@@ -40,14 +63,68 @@ self.addEventListener("message", async function (e) {
 });
 
 async function handleLoadWASM(data: LoadWASMMessageData) {
-  const { wasmLoaderPath } = data || {};
+  const { wasmLoaderPath, wasmModule, urlCache, trace } = data || {};
   const ModuleLoader = await import(/* @vite-ignore */wasmLoaderPath);
-  Module = await ModuleLoader.default();
+
+  // instantiate a module compiled once on the main thread instead of fetching and compiling again
+  Module = await ModuleLoader.default(wasmModule ? {
+    instantiateWasm(imports: WebAssembly.Imports, successCallback: (instance: WebAssembly.Instance, module: WebAssembly.Module) => void) {
+      // the threaded build hands the module on to its pthread workers
+      WebAssembly.instantiate(wasmModule, imports).then((instance) => successCallback(instance, wasmModule));
+      return {};
+    },
+  } : undefined);
+
+  // starts the fetch worker, which must be up before a read waits on it
+  await Module.setUrlCacheOptions(urlCache || {});
+
+  if (trace) {
+    Module.setTrace(true);
+  }
+}
+
+function getSession() {
+  if (!session) {
+    throw new Error("source is not loaded. call load() first");
+  }
+
+  return session;
+}
+
+async function handleLoadSource(data: LoadSourceMessageData, msgId: number) {
+  const { options } = data;
+  let { source } = data;
+
+  // demuxing reads synchronously, so collect a stream into a Blob first
+  if (source instanceof ReadableStream) {
+    source = await new Response(source).blob();
+  }
+
+  session?.destroy();
+  session = undefined;
+  session = Module.createSession(source, options);
+
+  self.postMessage({
+    type: FFMpegWorkerMessageType.LoadSource,
+    msgId,
+    // metadata for the main thread cache
+    result: options.cacheMetadata ? session.getMetadata() : undefined,
+  });
+}
+
+function handleDestroySource(msgId: number) {
+  session?.destroy();
+  session = undefined;
+
+  self.postMessage({
+    type: FFMpegWorkerMessageType.DestroySource,
+    msgId,
+  });
 }
 
 function handleGetAVStream(data: GetAVStreamMessageData, msgId: number) {
-  const { source, streamType, streamIndex } = data;
-  const result = Module.getAVStream(source, streamType, streamIndex);
+  const { streamType, streamIndex } = data;
+  const result = getSession().getAVStream(streamType, streamIndex);
 
   self.postMessage(
     {
@@ -59,9 +136,8 @@ function handleGetAVStream(data: GetAVStreamMessageData, msgId: number) {
   );
 }
 
-function handleGetAVStreams(data: GetAVStreamsMessageData, msgId: number) {
-  const { source } = data;
-  const result = Module.getAVStreams(source);
+function handleGetAVStreams(msgId: number) {
+  const result = getSession().getAVStreams();
 
   self.postMessage(
     {
@@ -73,9 +149,8 @@ function handleGetAVStreams(data: GetAVStreamsMessageData, msgId: number) {
   );
 }
 
-function handleGetMediaInfo(data: GetMediaInfoMessageData, msgId: number) {
-  const { source } = data;
-  const result = Module.getMediaInfo(source);
+function handleGetMediaInfo(msgId: number) {
+  const result = getSession().getMediaInfo();
 
   self.postMessage(
     {
@@ -87,9 +162,23 @@ function handleGetMediaInfo(data: GetMediaInfoMessageData, msgId: number) {
   );
 }
 
+function handleGetDecoderConfig(data: GetDecoderConfigMessageData, msgId: number) {
+  const { streamType, streamIndex, bitstreamFormat } = data;
+  const result = getSession().getDecoderConfig(streamType, streamIndex, bitstreamFormat);
+
+  self.postMessage(
+    {
+      type: FFMpegWorkerMessageType.GetDecoderConfig,
+      msgId,
+      result,
+    },
+    result?.description ? [result.description.buffer] : [],
+  );
+}
+
 function handleGetAVPacket(data: GetAVPacketMessageData, msgId: number) {
-  const { source, time, streamType, streamIndex, seekFlag } = data;
-  const result = Module.getAVPacket(source, time, streamType, streamIndex, seekFlag);
+  const { time, streamType, streamIndex, seekFlag } = data;
+  const result = getSession().getAVPacket(time, streamType, streamIndex, seekFlag);
 
   self.postMessage(
     {
@@ -102,8 +191,8 @@ function handleGetAVPacket(data: GetAVPacketMessageData, msgId: number) {
 }
 
 function handleGetAVPackets(data: GetAVPacketsMessageData, msgId: number) {
-  const { source, time, seekFlag } = data;
-  const result = Module.getAVPackets(source, time, seekFlag);
+  const { time, seekFlag } = data;
+  const result = getSession().getAVPackets(time, seekFlag);
 
   self.postMessage(
     {
@@ -115,16 +204,76 @@ function handleGetAVPackets(data: GetAVPacketsMessageData, msgId: number) {
   );
 }
 
+function handleGetAVPacketsAt(data: GetAVPacketsAtMessageData, msgId: number) {
+  const { times, streamType, streamIndex, seekFlag } = data;
+  const result = getSession().getAVPacketsAt(times, streamType, streamIndex, seekFlag);
+
+  self.postMessage(
+    {
+      type: FFMpegWorkerMessageType.GetAVPacketsAt,
+      msgId,
+      result,
+    },
+    [result.indexes.buffer, ...batchBuffers(result.packets)],
+  );
+}
+
+function handleGetFramePackets(data: GetFramePacketsMessageData, msgId: number) {
+  const { time, streamIndex, audio } = data;
+  const result = getSession().getFramePackets(time, streamIndex, audio);
+
+  self.postMessage(
+    {
+      type: FFMpegWorkerMessageType.GetFramePackets,
+      msgId,
+      result,
+    },
+    [...batchBuffers(result.video), ...(result.audio ? batchBuffers(result.audio) : [])],
+  );
+}
+
+function batchBuffers(batch: WebAVPacketBatch): ArrayBuffer[] {
+  return [batch.times.buffer, batch.fields.buffer, batch.side_data.buffer, batch.data.buffer] as ArrayBuffer[];
+}
+
+function handleGetPacketIndex(data: GetPacketIndexMessageData, msgId: number) {
+  const { streamType, streamIndex } = data;
+  const result = getSession().getPacketIndex(streamType, streamIndex);
+
+  self.postMessage(
+    {
+      type: FFMpegWorkerMessageType.GetPacketIndex,
+      msgId,
+      result,
+    },
+    [result.pts.buffer, result.dts.buffer, result.pos.buffer, result.size.buffer, result.keyframe.buffer],
+  );
+}
+
+function handleSetPacketIndex(data: SetPacketIndexMessageData, msgId: number) {
+  const { index } = data;
+
+  getSession().setPacketIndex(index);
+  self.postMessage({
+    type: FFMpegWorkerMessageType.SetPacketIndex,
+    msgId,
+  });
+}
+
 async function handleReadAVPacket(data: ReadAVPacketMessageData, msgId: number) {
-  const { source, start, end, streamType, streamIndex, seekFlag } = data;
-  const result = await Module.readAVPacket(
+  const { start, end, streamType, streamIndex, seekFlag, batchSize, batchBytes, streamIndices, batched, bitstreamFormat } = data;
+  const result = await getSession().readAVPacket(
     msgId,
-    source,
     start,
     end,
     streamType,
     streamIndex,
-    seekFlag
+    seekFlag,
+    batchSize,
+    batchBytes,
+    streamIndices,
+    batched,
+    bitstreamFormat
   );
 
   self.postMessage({
@@ -134,6 +283,17 @@ async function handleReadAVPacket(data: ReadAVPacketMessageData, msgId: number)
   });
 }
 
+async function handleRemuxRange(data: RemuxRangeMessageData, msgId: number) {
+  const { start, end, streamIndices, format } = data;
+  const result = await getSession().remuxRange(msgId, start, end, streamIndices, format);
+
+  self.postMessage({
+    type: FFMpegWorkerMessageType.RemuxRange,
+    msgId,
+    result,
+  });
+}
+
 function handleSetAVLogLevel(data: SetAVLogLevelMessageData, msgId: number) {
   const { level } = data
 
@@ -142,4 +302,28 @@ function handleSetAVLogLevel(data: SetAVLogLevelMessageData, msgId: number) {
     type: "SetAVLogLevel",
     msgId,
   })
-}
\ No newline at end of file
+}
+
+function handleGetUrlCacheStats(msgId: number) {
+  self.postMessage({
+    type: FFMpegWorkerMessageType.GetUrlCacheStats,
+    msgId,
+    result: Module.getUrlCacheStats(),
+  });
+}
+
+function handleGetMemoryStats(msgId: number) {
+  self.postMessage({
+    type: FFMpegWorkerMessageType.GetMemoryStats,
+    msgId,
+    result: Module.getMemoryStats(),
+  });
+}
+
+function handleGetStats(msgId: number) {
+  self.postMessage({
+    type: FFMpegWorkerMessageType.GetStats,
+    msgId,
+    result: getSession().getStats(),
+  });
+}
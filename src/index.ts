@@ -1,6 +1,13 @@
 import { WebDemuxer } from "./web-demuxer";
+import { WebDemuxerPool } from "./web-demuxer-pool";
 
-export type { WebAVStream, WebAVPacket, WebMediaInfo } from './types';
-export type { WebDemuxerOptions } from './web-demuxer';
-export { AVMediaType, AVLogLevel, AVSeekFlag } from './types';
-export { WebDemuxer };
+export type { WebAVStream, WebAVPacket, WebAVPacketSideData, WebFramePackets, WebMediaInfo, WebPacketIndex, WebDemuxerSource, UrlCacheOptions, UrlCacheStats, MemoryStats, SessionStats, WebTraceEvent, ProbePolicy, BitstreamFormat, WebRemuxSegment } from './types';
+export type { WebDemuxerOptions, WasmVariants, LoadOptions, ReadAVPacketOptions, RemuxOptions } from './web-demuxer';
+export type { WasmFeatures } from './wasm-features';
+export type { WebDemuxerPoolOptions } from './web-demuxer-pool';
+export type { PushSourceOptions } from './push-source';
+export { AVMediaType, AVLogLevel, AVSeekFlag, AVPacketFlag, AVPacketSideDataType } from './types';
+export { detectWasmFeatures } from './wasm-features';
+export { WebAVPacketRecords } from './packet-records';
+export { PushSource } from './push-source';
+export { WebDemuxer, WebDemuxerPool };
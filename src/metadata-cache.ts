@@ -0,0 +1,52 @@
+import { ProbePolicy, SourceMetadata, WebDemuxerSource } from "./types";
+
+const MAX_ENTRIES = 64;
+
+/**
+ * Stream metadata of loaded sources, shared by every WebDemuxer (and pool
+ * worker) of the page so a source is only probed once. Entries are looked up
+ * by file or url, the worker only uses an entry whose identity matches the
+ * current source version (lastModified, ETag or Last-Modified).
+ */
+class MetadataCache {
+  private entries = new Map<string, SourceMetadata>(); // in LRU order
+
+  key(source: WebDemuxerSource, probe: ProbePolicy): string | undefined {
+    if (typeof source === "string") {
+      return `${probe}:url:${source}`;
+    }
+
+    if (source instanceof File) {
+      return `${probe}:file:${source.name}:${source.size}:${source.lastModified}`;
+    }
+
+    // buffers, streams and unnamed blobs have no identity
+    return undefined;
+  }
+
+  get(key: string): SourceMetadata | undefined {
+    const entry = this.entries.get(key);
+
+    if (entry) {
+      this.entries.delete(key);
+      this.entries.set(key, entry);
+    }
+
+    return entry;
+  }
+
+  set(key: string, entry: SourceMetadata) {
+    this.entries.delete(key);
+    this.entries.set(key, entry);
+
+    while (this.entries.size > MAX_ENTRIES) {
+      this.entries.delete(this.entries.keys().next().value as string);
+    }
+  }
+
+  clear() {
+    this.entries.clear();
+  }
+}
+
+export const metadataCache = new MetadataCache();
@@ -0,0 +1,120 @@
+import { AVPacketFlag, WebAVPacket, WebAVPacketBatch, WebAVPacketSideData } from "./types";
+
+const TIME_FIELDS = 4;
+const INT_FIELDS = 4;
+const SIDE_DATA_FIELDS = 4;
+
+/**
+ * WebAVPacketRecords
+ *
+ * A batch of packets kept as the flat records the worker sends: no object is
+ * created per packet until toPacket (or payload) is called, e.g. right before
+ * building an EncodedVideoChunk.
+ */
+export class WebAVPacketRecords {
+  /** number of packets */
+  readonly size: number;
+  /** per packet [pts, dts, duration] in seconds (NaN when unknown) and [pos] in bytes */
+  readonly times: Float64Array;
+  /** per packet [stream_index, flags, offset, size] */
+  readonly fields: Int32Array;
+  /** per side data entry [packet, type, offset, size], in packet order */
+  readonly sideDataFields: Int32Array;
+  /** all payloads back to back, followed by the side data */
+  readonly data: Uint8Array;
+
+  constructor(batch: WebAVPacketBatch) {
+    this.size = batch.size;
+    this.times = batch.times;
+    this.fields = batch.fields;
+    this.sideDataFields = batch.side_data;
+    this.data = batch.data;
+  }
+
+  pts(i: number): number {
+    return this.times[i * TIME_FIELDS];
+  }
+
+  dts(i: number): number {
+    return this.times[i * TIME_FIELDS + 1];
+  }
+
+  duration(i: number): number {
+    return this.times[i * TIME_FIELDS + 2];
+  }
+
+  /** byte position in the source, -1 when unknown */
+  pos(i: number): number {
+    return this.times[i * TIME_FIELDS + 3];
+  }
+
+  streamIndex(i: number): number {
+    return this.fields[i * INT_FIELDS];
+  }
+
+  /** AV_PKT_FLAG_* bits */
+  flags(i: number): number {
+    return this.fields[i * INT_FIELDS + 1];
+  }
+
+  keyframe(i: number): 0 | 1 {
+    return (this.flags(i) & AVPacketFlag.AV_PKT_FLAG_KEY) as 0 | 1;
+  }
+
+  offset(i: number): number {
+    return this.fields[i * INT_FIELDS + 2];
+  }
+
+  byteLength(i: number): number {
+    return this.fields[i * INT_FIELDS + 3];
+  }
+
+  /** payload of packet i, a view on data */
+  payload(i: number): Uint8Array {
+    const offset = this.offset(i);
+
+    return this.data.subarray(offset, offset + this.byteLength(i));
+  }
+
+  /** whether any packet of the batch has side data, e.g. new extradata */
+  get hasSideData(): boolean {
+    return this.sideDataFields.length > 0;
+  }
+
+  /** side data of packet i, views on data */
+  sideData(i: number): WebAVPacketSideData[] {
+    const result: WebAVPacketSideData[] = [];
+
+    for (let j = 0; j < this.sideDataFields.length; j += SIDE_DATA_FIELDS) {
+      if (this.sideDataFields[j] === i) {
+        const offset = this.sideDataFields[j + 2];
+
+        result.push({
+          type: this.sideDataFields[j + 1],
+          data: this.data.subarray(offset, offset + this.sideDataFields[j + 3]),
+        });
+      }
+    }
+
+    return result;
+  }
+
+  toPacket(i: number): WebAVPacket {
+    return {
+      stream_index: this.streamIndex(i),
+      keyframe: this.keyframe(i),
+      timestamp: this.pts(i),
+      dts: this.dts(i),
+      duration: this.duration(i),
+      pos: this.pos(i),
+      flags: this.flags(i),
+      size: this.byteLength(i),
+      data: this.payload(i),
+      side_data: this.hasSideData ? this.sideData(i) : [],
+    };
+  }
+
+  toPackets(): WebAVPacket[] {
+    return Array.from({ length: this.size }, (_, i) => this.toPacket(i));
+  }
+}
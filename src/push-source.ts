@@ -0,0 +1,149 @@
+// layout of the control buffer, shared with PushSource in lib/web-demuxer/post.js
+const WRITE_SEQ = 0; // Int32, bumped after bytes are appended or the source ends
+const READ_SEQ = 1; // Int32, bumped after the worker releases bytes
+const ENDED = 2; // Int32, 1 once end() is called
+const WRITTEN = 2; // Float64 (byte offset 16), total bytes appended
+const RELEASED = 3; // Float64 (byte offset 24), bytes the writer may overwrite
+const CONTROL_BYTES = 32;
+
+export interface PushSourceOptions {
+  /**
+   * ring buffer size in bytes, the most that is buffered ahead of the demuxer, default 8MB
+   */
+  capacity?: number;
+}
+
+/**
+ * the shared buffers of a PushSource, as posted to the worker
+ */
+export interface PushSourceDescriptor {
+  buffer: SharedArrayBuffer;
+  control: SharedArrayBuffer;
+}
+
+/**
+ * PushSource
+ *
+ * A source whose bytes are appended while it is demuxed, e.g. a fetch body,
+ * MediaRecorder chunks or a recording that is still being written. Bytes go
+ * through a bounded ring (SharedArrayBuffer) that the worker reads
+ * synchronously, waiting with Atomics.wait for bytes that have not arrived
+ * yet. So packets are emitted as soon as their bytes are in, and append()
+ * waits while the ring is full. The source is probed once on load and then
+ * read once, in order: it cannot be seeked. Needs a cross origin isolated page.
+ */
+export class PushSource {
+  readonly capacity: number;
+  private buffer: SharedArrayBuffer;
+  private control: SharedArrayBuffer;
+  private data: Uint8Array;
+  private state: Int32Array;
+  private positions: Float64Array;
+
+  constructor(options: PushSourceOptions = {}) {
+    if (typeof SharedArrayBuffer === "undefined" || !self.crossOriginIsolated) {
+      throw new Error("PushSource needs SharedArrayBuffer, i.e. a cross origin isolated page");
+    }
+
+    this.capacity = options.capacity ?? 8 * 1024 * 1024;
+    this.buffer = new SharedArrayBuffer(this.capacity);
+    this.control = new SharedArrayBuffer(CONTROL_BYTES);
+    this.data = new Uint8Array(this.buffer);
+    this.state = new Int32Array(this.control);
+    this.positions = new Float64Array(this.control);
+  }
+
+  /** total bytes appended */
+  get written(): number {
+    return this.positions[WRITTEN];
+  }
+
+  get ended(): boolean {
+    return Atomics.load(this.state, ENDED) === 1;
+  }
+
+  /**
+   * Append bytes, resolves once all of them are in the ring
+   * (waits while the demuxer has not consumed enough)
+   */
+  public async append(chunk: Uint8Array): Promise<void> {
+    if (this.ended) {
+      throw new Error("PushSource has ended");
+    }
+
+    let offset = 0;
+
+    while (offset < chunk.byteLength) {
+      // read the sequence before the free space, so a release in between wakes the wait
+      const readSeq = Atomics.load(this.state, READ_SEQ);
+      const written = this.positions[WRITTEN];
+      const free = this.capacity - (written - this.positions[RELEASED]);
+
+      if (free <= 0) {
+        await this.waitForRelease(readSeq);
+        continue;
+      }
+
+      const length = Math.min(free, chunk.byteLength - offset);
+      const start = written % this.capacity;
+      const head = Math.min(length, this.capacity - start);
+
+      this.data.set(chunk.subarray(offset, offset + head), start);
+      this.data.set(chunk.subarray(offset + head, offset + length), 0);
+      this.positions[WRITTEN] = written + length;
+      offset += length;
+
+      Atomics.add(this.state, WRITE_SEQ, 1);
+      Atomics.notify(this.state, WRITE_SEQ);
+    }
+  }
+
+  /**
+   * Mark the end of the source, the demuxer reads the remaining bytes and ends
+   */
+  public end() {
+    Atomics.store(this.state, ENDED, 1);
+    Atomics.add(this.state, WRITE_SEQ, 1);
+    Atomics.notify(this.state, WRITE_SEQ);
+  }
+
+  /**
+   * Append every chunk of a stream (e.g. a fetch body), then end
+   */
+  public async pipeFrom(stream: ReadableStream<Uint8Array>): Promise<void> {
+    const reader = stream.getReader();
+
+    try {
+      while (true) {
+        const { done, value } = await reader.read();
+
+        if (done) break;
+
+        await this.append(value);
+      }
+    } finally {
+      reader.releaseLock();
+      this.end();
+    }
+  }
+
+  /** @internal the shared buffers posted to the worker */
+  public descriptor(): PushSourceDescriptor {
+    return { buffer: this.buffer, control: this.control };
+  }
+
+  private async waitForRelease(readSeq: number) {
+    // Atomics.wait is not allowed on the main thread
+    const waitAsync = (Atomics as any).waitAsync;
+
+    if (waitAsync) {
+      const result = waitAsync(this.state, READ_SEQ, readSeq, 1000);
+
+      if (result.async) {
+        await result.value;
+      }
+    } else {
+      await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+  }
+}
@@ -72,3 +72,70 @@ export enum AVSeekFlag {
    */
   AVSEEK_FLAG_FRAME = 8
 }
+
+/**
+ * sync with ffmpeg libavcodec/packet.h
+ */
+export enum AVPacketFlag {
+  /**
+   * The packet contains a keyframe
+   */
+  AV_PKT_FLAG_KEY = 0x0001,
+  /**
+   * The packet content is corrupted
+   */
+  AV_PKT_FLAG_CORRUPT = 0x0002,
+  /**
+   * Used to discard packets which are required to maintain valid decoder state
+   * but are not required for output and should be dropped after decoding
+   */
+  AV_PKT_FLAG_DISCARD = 0x0004,
+  /**
+   * The packet comes from a trusted source
+   */
+  AV_PKT_FLAG_TRUSTED = 0x0008,
+  /**
+   * The packet contains frames that can be discarded by the decoder,
+   * i.e. non-reference frames
+   */
+  AV_PKT_FLAG_DISPOSABLE = 0x0010,
+}
+
+/**
+ * sync with ffmpeg libavcodec/packet.h (first entries)
+ */
+export enum AVPacketSideDataType {
+  /**
+   * An AV_PKT_DATA_PALETTE side data packet contains exactly AVPALETTE_SIZE
+   * bytes worth of palette
+   */
+  AV_PKT_DATA_PALETTE,
+  /**
+   * New extradata, e.g. changed parameter sets, to configure the decoder with
+   */
+  AV_PKT_DATA_NEW_EXTRADATA,
+  /**
+   * Changed channel layout, sample rate or dimensions
+   */
+  AV_PKT_DATA_PARAM_CHANGE,
+  AV_PKT_DATA_H263_MB_INFO,
+  AV_PKT_DATA_REPLAYGAIN,
+  AV_PKT_DATA_DISPLAYMATRIX,
+  AV_PKT_DATA_STEREO3D,
+  AV_PKT_DATA_AUDIO_SERVICE_TYPE,
+  AV_PKT_DATA_QUALITY_STATS,
+  AV_PKT_DATA_FALLBACK_TRACK,
+  AV_PKT_DATA_CPB_PROPERTIES,
+  /**
+   * Samples to skip at the start (u32le) and end (u32le) of the packet,
+   * e.g. encoder delay and padding
+   */
+  AV_PKT_DATA_SKIP_SAMPLES,
+  AV_PKT_DATA_JP_DUALMONO,
+  AV_PKT_DATA_STRINGS_METADATA,
+  AV_PKT_DATA_SUBTITLE_POSITION,
+  AV_PKT_DATA_MATROSKA_BLOCKADDITIONAL,
+  AV_PKT_DATA_WEBVTT_IDENTIFIER,
+  AV_PKT_DATA_WEBVTT_SETTINGS,
+  AV_PKT_DATA_METADATA_UPDATE,
+}
@@ -2,6 +2,21 @@
  * sync with web-demuxer.h
  */
 import { AVMediaType } from "./avutil";
+import type { PushSource } from "../push-source";
+
+/**
+ * a File/Blob, a url fetched with range requests, an in-memory buffer,
+ * a ReadableStream which is collected into a Blob on load,
+ * or a PushSource demuxed while bytes are appended
+ */
+export type WebDemuxerSource =
+  | File
+  | Blob
+  | string
+  | ArrayBuffer
+  | ArrayBufferView
+  | ReadableStream<Uint8Array>
+  | PushSource;
 
 export interface WebAVStream {
   index: number;
@@ -36,14 +51,70 @@ export interface WebAVStream {
   tags: Record<string, string>
 }
 
+export interface WebAVPacketSideData {
+  /** AVPacketSideDataType */
+  type: number;
+  data: Uint8Array;
+}
+
 export interface WebAVPacket {
+  stream_index: number;
   keyframe: 0 | 1;
+  /** pts in seconds, NaN when unknown */
   timestamp: number;
+  /** dts in seconds, NaN when unknown */
+  dts: number;
   duration: number;
+  /** byte position in the source, -1 when unknown */
+  pos: number;
+  /** AVPacketFlag bits */
+  flags: number;
+  size: number;
+  data: Uint8Array;
+  /** e.g. new extradata (parameter set change), skip samples, palette */
+  side_data: WebAVPacketSideData[];
+}
+
+/**
+ * packets needed to decode the video frame at a time point, see getFramePackets
+ */
+export interface WebFramePackets {
+  /** video packets in decode order, starting with the keyframe */
+  video: WebAVPacket[];
+  /** index in video of the packet of the frame shown at the time point */
+  targetIndex: number;
+  /** packets of the related audio stream from the earliest video frame to the time point */
+  audio: WebAVPacket[];
+}
+
+/**
+ * packets of one batched read round trip as flat records, see WebAVPacketRecords
+ */
+export interface WebAVPacketBatch {
   size: number;
+  /** per packet [pts, dts, duration] in seconds (NaN when unknown) and [pos] in bytes */
+  times: Float64Array;
+  /** per packet [stream_index, flags, offset, size], offset/size locate the payload in data */
+  fields: Int32Array;
+  /** per side data entry [packet, type, offset, size], the bytes follow the payloads in data */
+  side_data: Int32Array;
   data: Uint8Array;
 }
 
+/**
+ * per sample table of one stream, times in seconds (NaN when unknown),
+ * pos in bytes. can be stored and passed back to setPacketIndex
+ */
+export interface WebPacketIndex {
+  stream_index: number;
+  count: number;
+  pts: Float64Array;
+  dts: Float64Array;
+  pos: Float64Array;
+  size: Int32Array;
+  keyframe: Uint8Array;
+}
+
 export interface WebMediaInfo {
   format_name: string;
   start_time: number;
@@ -54,3 +125,154 @@ export interface WebMediaInfo {
   flags: number;
   streams: WebAVStream[];
 }
+
+/**
+ * sync with post.js UrlBlockCache
+ */
+export interface UrlCacheOptions {
+  /**
+   * cache block size in bytes, default 256KB
+   */
+  blockSize?: number;
+  /**
+   * max memory of cached blocks in bytes, default 64MB
+   */
+  maxMemory?: number;
+  /**
+   * max read-ahead in blocks for sequential reads, default 16
+   */
+  maxReadAhead?: number;
+  /**
+   * max range requests in flight, made by fetch() in a helper worker, default 4.
+   * needs a cross origin isolated page, otherwise (or with 1) each request is a sync XHR
+   */
+  concurrency?: number;
+  /**
+   * attempts per range request, default 3
+   */
+  retries?: number;
+  /**
+   * delay before the first retry in ms, doubled for each further one, default 250
+   */
+  retryDelay?: number;
+}
+
+export interface UrlCacheStats {
+  hits: number;
+  misses: number;
+  requests: number;
+  bytesFetched: number;
+  memory: number;
+  blocks: number;
+  /** range requests that can be in flight, 1 without the fetch worker */
+  concurrency: number;
+  /** range requests in flight */
+  inflight: number;
+}
+
+/**
+ * wasm heap and packet arena counters of a worker, the packets of a batch are
+ * referenced in a per reader arena, whose AVPackets are reused from batch to
+ * batch, until their payloads are copied once into the batch's buffer
+ */
+export interface MemoryStats {
+  /** wasm heap size in bytes, and how often it grew */
+  heapSize: number;
+  heapGrowths: number;
+  /** arenas alive and the AVPackets they keep */
+  arenas: number;
+  arenaCapacity: number;
+  /** most payload bytes referenced by one batch */
+  arenaHighWater: number;
+  /** AVPacket allocations, and batches served by the kept AVPackets */
+  arenaGrowths: number;
+  arenaReuses: number;
+  /** packets and payload bytes passed through the arenas */
+  packets: number;
+  bytes: number;
+}
+
+/**
+ * counters of the loaded source, reset by load()
+ */
+export interface SessionStats {
+  /** time to open and probe the source */
+  probeMs: number;
+  /** random access calls (getAVPacket, getAVPackets, getAVPacketsAt, getFramePackets) and their total time */
+  seeks: number;
+  seekMs: number;
+  /** seek latency histogram: counts[i] seeks took at most bounds[i] ms, the last count the slower ones */
+  seekLatency: { bounds: number[]; counts: number[] };
+  /** source read callbacks of the io contexts and the bytes they returned */
+  readCalls: number;
+  bytesRead: number;
+  /** url sources: range requests, bytes fetched and block cache hits / misses */
+  urlRequests: number;
+  urlBytesFetched: number;
+  urlCacheHits: number;
+  urlCacheMisses: number;
+  /** packets and payload bytes sent to the page */
+  packets: number;
+  bytes: number;
+  /** wasm heap size in bytes */
+  heapSize: number;
+  /** worker requests answered since load, and their mean and max round trip time */
+  messages: number;
+  roundTripMs: number;
+  maxRoundTripMs: number;
+}
+
+/**
+ * a phase of the worker (probe, seek, read, remux), a worker request
+ * (message, detail.type) or an av_log line (log, detail.level and message),
+ * with the fields of a performance.measure / performance.mark entry;
+ * startTime is on the page's time origin
+ */
+export interface WebTraceEvent {
+  name: "probe" | "seek" | "read" | "remux" | "message" | "log";
+  startTime: number;
+  duration: number;
+  detail?: Record<string, unknown>;
+}
+
+/**
+ * how much of the source is read and decoded to find stream information
+ * - fast: tight probe limits, header only when the container describes every stream
+ * - default: libavformat defaults
+ * - thorough: large probe limits, for streams starting late in the file
+ */
+export type ProbePolicy = "fast" | "default" | "thorough";
+
+/**
+ * packet bitstream format of h264 / hevc streams
+ * - keep: as demuxed
+ * - annexb: start code prefixed, parameter sets in band, decoded without a description
+ * - avcc: length prefixed, decoded with the avcC / hvcC record as description
+ *   (annex-b h264 sources get a synthesized avcC as AV_PKT_DATA_NEW_EXTRADATA side data)
+ */
+export type BitstreamFormat = "keep" | "annexb" | "avcc";
+
+/**
+ * a segment of a remuxed range, each one is a transferable buffer to append to a SourceBuffer
+ */
+export interface WebRemuxSegment {
+  /** the init segment (first of the stream) or a media fragment */
+  init: boolean;
+  data: Uint8Array;
+  /** lead stream time range of a fragment in seconds, NaN for the init segment */
+  start: number;
+  end: number;
+  /** MSE type of the init segment, e.g. video/mp4; codecs="avc1.64001f, mp4a.40.2" */
+  mimeType?: string;
+}
+
+/**
+ * stream metadata of a probed source, identity is the source version
+ * (file name/size/lastModified, or url plus ETag/Last-Modified)
+ */
+export interface SourceMetadata {
+  identity: string;
+  mediaInfo: WebMediaInfo;
+  /** stream index picked for streamIndex -1 per AVMediaType, by the probed session */
+  defaultStreams?: Partial<Record<AVMediaType, number>>;
+}
@@ -1,43 +1,62 @@
 import { AVLogLevel, AVMediaType, AVSeekFlag } from "./avutil";
+import type { PushSourceDescriptor } from "../push-source";
+import { BitstreamFormat, ProbePolicy, SourceMetadata, UrlCacheOptions, WebDemuxerSource, WebPacketIndex } from "./demuxer";
 
 export enum FFMpegWorkerMessageType {
   FFmpegWorkerLoaded = "FFmpegWorkerLoaded",
   WASMRuntimeInitialized = "WASMRuntimeInitialized",
   LoadWASM = "LoadWASM",
+  LoadSource = "LoadSource",
+  DestroySource = "DestroySource",
   GetAVPacket = "GetAVPacket",
   GetAVPackets = "GetAVPackets",
+  GetAVPacketsAt = "GetAVPacketsAt",
+  GetFramePackets = "GetFramePackets",
   GetAVStream = "GetAVStream",
   GetAVStreams = "GetAVStreams",
   GetMediaInfo = "GetMediaInfo",
+  GetDecoderConfig = "GetDecoderConfig",
   ReadAVPacket = "ReadAVPacket",
   AVPacketStream = "AVPacketStream",
+  AVPacketBatchStream = "AVPacketBatchStream",
   ReadNextAVPacket = "ReadNextAVPacket",
   StopReadAVPacket = "StopReadAVPacket",
+  RemuxRange = "RemuxRange",
+  RemuxSegmentStream = "RemuxSegmentStream",
   SetAVLogLevel = "SetAVLogLevel",
+  GetUrlCacheStats = "GetUrlCacheStats",
+  GetMemoryStats = "GetMemoryStats",
+  GetStats = "GetStats",
+  TraceEvent = "TraceEvent",
+  GetPacketIndex = "GetPacketIndex",
+  SetPacketIndex = "SetPacketIndex",
 }
 
 export type FFMpegWorkerMessageData =
   | GetAVPacketMessageData
   | GetAVPacketsMessageData
+  | GetAVPacketsAtMessageData
+  | GetFramePacketsMessageData
   | GetAVStreamMessageData
-  | GetAVStreamsMessageData
+  | GetDecoderConfigMessageData
   | ReadAVPacketMessageData
+  | RemuxRangeMessageData
   | LoadWASMMessageData
+  | LoadSourceMessageData
   | SetAVLogLevelMessageData
-  | GetMediaInfoMessageData;
+  | GetPacketIndexMessageData
+  | SetPacketIndexMessageData;
 
 export interface GetAVStreamMessageData {
-  source: File | string;
   streamType: AVMediaType;
   streamIndex: number;
 }
 
-export interface GetAVStreamsMessageData {
-  source: File | string;
+export interface GetDecoderConfigMessageData extends GetAVStreamMessageData {
+  bitstreamFormat?: BitstreamFormat;
 }
 
 export interface GetAVPacketMessageData {
-  source: File | string;
   time: number;
   streamType: AVMediaType;
   streamIndex: number;
@@ -45,26 +64,71 @@ export interface GetAVPacketMessageData {
 }
 
 export interface GetAVPacketsMessageData {
-  source: File | string;
   time: number;
   seekFlag: AVSeekFlag;
 }
 
+export interface GetAVPacketsAtMessageData {
+  times: number[];
+  streamType: AVMediaType;
+  streamIndex: number;
+  seekFlag: AVSeekFlag;
+}
+
+export interface GetFramePacketsMessageData {
+  time: number;
+  streamIndex: number;
+  audio: boolean;
+}
+
 export interface ReadAVPacketMessageData {
-  source: File | string;
   start: number;
   end: number;
   streamType: AVMediaType;
   streamIndex: number;
   seekFlag: AVSeekFlag;
+  batchSize: number;
+  batchBytes: number;
+  streamIndices?: number[];
+  /** always send batches, even of one packet */
+  batched?: boolean;
+  bitstreamFormat?: BitstreamFormat;
+}
+
+export interface RemuxRangeMessageData {
+  start: number;
+  end: number;
+  streamIndices?: number[];
+  format: string;
+}
+
+export interface GetPacketIndexMessageData {
+  streamType: AVMediaType;
+  streamIndex: number;
+}
+
+export interface SetPacketIndexMessageData {
+  index: WebPacketIndex;
 }
 
 export interface LoadWASMMessageData {
   wasmLoaderPath: string;
+  wasmModule?: WebAssembly.Module;
+  urlCache?: UrlCacheOptions;
+  trace?: boolean;
+}
+
+export interface LoadSourceMessageData {
+  source: WebDemuxerSource | PushSourceDescriptor;
+  options: SessionOptions;
 }
 
-export interface GetMediaInfoMessageData {
-  source: File | string;
+export interface SessionOptions {
+  zeroCopy: boolean;
+  ioBufferSize?: number;
+  probe?: ProbePolicy;
+  cacheMetadata?: boolean;
+  metadata?: SourceMetadata;
 }
 
 export interface SetAVLogLevelMessageData {
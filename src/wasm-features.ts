@@ -0,0 +1,67 @@
+import type { WebDemuxerOptions } from "./web-demuxer";
+
+export interface WasmFeatures {
+  simd: boolean;
+  threads: boolean;
+}
+
+// smallest modules using a v128 instruction / a shared memory atomic
+const SIMD_TEST_MODULE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
+const THREADS_TEST_MODULE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 4, 1, 96, 0, 0, 3, 2, 1, 0, 5, 4, 1, 3, 1, 1, 10, 11, 1, 9, 0, 65, 0, 254, 16, 2, 0,
+  26, 11,
+]);
+
+let features: WasmFeatures | undefined;
+
+/**
+ * Detect the wasm features the build variants depend on, the threaded build
+ * also needs SharedArrayBuffer, i.e. a cross origin isolated page
+ */
+export function detectWasmFeatures(): WasmFeatures {
+  if (!features) {
+    const validate = (bytes: Uint8Array) => {
+      try {
+        return WebAssembly.validate(bytes);
+      } catch (e) {
+        return false;
+      }
+    };
+
+    features = {
+      simd: validate(SIMD_TEST_MODULE),
+      threads:
+        typeof SharedArrayBuffer !== "undefined" &&
+        !!self.crossOriginIsolated &&
+        validate(THREADS_TEST_MODULE),
+    };
+  }
+
+  return features;
+}
+
+/**
+ * Pick the best wasm loader for the current browser:
+ * wasmVariants.threads (SIMD + pthreads), then wasmVariants.simd, then wasmLoaderPath
+ */
+export function selectWasmLoaderPath(options: WebDemuxerOptions): string {
+  const { wasmLoaderPath, wasmVariants } = options;
+
+  if (!wasmVariants) {
+    return wasmLoaderPath;
+  }
+
+  const { simd, threads } = detectWasmFeatures();
+
+  if (wasmVariants.threads && simd && threads) {
+    return wasmVariants.threads;
+  }
+
+  if (wasmVariants.simd && simd) {
+    return wasmVariants.simd;
+  }
+
+  return wasmLoaderPath;
+}
@@ -0,0 +1,361 @@
+import {
+  AVMediaType,
+  AVSeekFlag,
+  BitstreamFormat,
+  WebAVPacket,
+  WebAVStream,
+  WebDemuxerSource,
+  WebFramePackets,
+  WebMediaInfo,
+  WebRemuxSegment,
+} from "./types";
+import {
+  LoadOptions,
+  ReadAVPacketOptions,
+  RemuxOptions,
+  WebDemuxer,
+  WebDemuxerOptions,
+} from "./web-demuxer";
+import { selectWasmLoaderPath } from "./wasm-features";
+import { PushSource } from "./push-source";
+
+export interface WebDemuxerPoolOptions extends WebDemuxerOptions {
+  /**
+   * number of workers, default navigator.hardwareConcurrency (max 8)
+   */
+  size?: number;
+  /**
+   * path to the wasm file, default the selected wasm loader path with a .wasm extension
+   */
+  wasmPath?: string;
+  /**
+   * options used when a worker loads a source
+   */
+  loadOptions?: LoadOptions;
+}
+
+interface PoolSlot {
+  demuxer: WebDemuxer;
+  source?: WebDemuxerSource;
+  loading?: Promise<void>;
+  pending: number;
+  lastUsed: number;
+}
+
+/**
+ * WebDemuxerPool
+ *
+ * Runs requests on several WebDemuxer workers that share one compiled wasm
+ * module. Requests are routed with affinity per source: an idle worker that
+ * already has the source loaded is preferred, then any idle worker (which
+ * loads the source), then the least busy worker holding the source.
+ * So concurrent seeks and independent streams (e.g. video and audio of one
+ * file) are demuxed in parallel.
+ */
+export class WebDemuxerPool {
+  private slots: PoolSlot[] = [];
+  private ready: Promise<void>;
+  private releaseWaiters: (() => void)[] = [];
+  private useCounter = 0;
+  private loadOptions?: LoadOptions;
+
+  constructor(options: WebDemuxerPoolOptions) {
+    // pick the build variant once, the compiled module must match its loader
+    const wasmLoaderPath = selectWasmLoaderPath(options);
+    const {
+      size = Math.min(navigator.hardwareConcurrency || 4, 8),
+      wasmPath = wasmLoaderPath.replace(/(\.min)?\.js$/, ".wasm"),
+      loadOptions,
+      ...demuxerOptions
+    } = options;
+
+    this.ready = WebAssembly.compileStreaming(fetch(wasmPath)).then((wasmModule) => {
+      for (let i = 0; i < size; i++) {
+        this.slots.push({
+          demuxer: new WebDemuxer({
+            ...demuxerOptions,
+            wasmLoaderPath,
+            wasmVariants: undefined,
+            wasmModule,
+          }),
+          pending: 0,
+          lastUsed: 0,
+        });
+      }
+    });
+    this.loadOptions = loadOptions;
+  }
+
+  private pickSlot(source: WebDemuxerSource): PoolSlot | undefined {
+    const idle = this.slots.filter((slot) => slot.pending === 0);
+    const idleWithSource = idle.find((slot) => slot.source === source);
+
+    if (idleWithSource) return idleWithSource;
+
+    if (idle.length > 0) {
+      // prefer empty workers, then the least recently used one
+      return idle.sort(
+        (a, b) => Number(!!a.source) - Number(!!b.source) || a.lastUsed - b.lastUsed,
+      )[0];
+    }
+
+    const withSource = this.slots.filter((slot) => slot.source === source);
+
+    if (withSource.length > 0) {
+      return withSource.sort((a, b) => a.pending - b.pending)[0];
+    }
+
+    // every worker is busy with other sources, wait for one to be released
+    return undefined;
+  }
+
+  private async acquire(source: WebDemuxerSource): Promise<PoolSlot> {
+    if (source instanceof PushSource) {
+      throw new Error("a PushSource is read once, load it in a single WebDemuxer");
+    }
+
+    await this.ready;
+
+    let slot = this.pickSlot(source);
+
+    while (!slot) {
+      await new Promise<void>((resolve) => this.releaseWaiters.push(resolve));
+      slot = this.pickSlot(source);
+    }
+
+    slot.pending++;
+    slot.lastUsed = this.useCounter++;
+
+    try {
+      if (slot.source !== source) {
+        slot.source = source;
+        slot.loading = slot.demuxer.load(source, this.loadOptions);
+      }
+
+      await slot.loading;
+    } catch (e) {
+      slot.source = undefined;
+      this.release(slot);
+      throw e;
+    }
+
+    return slot;
+  }
+
+  private release(slot: PoolSlot) {
+    slot.pending--;
+
+    const waiters = this.releaseWaiters;
+
+    this.releaseWaiters = [];
+    waiters.forEach((resolve) => resolve());
+  }
+
+  /**
+   * Run a task on a worker that has the source loaded
+   * @param source source to demux
+   * @param task task using the WebDemuxer of the worker
+   * @returns task result
+   */
+  public async run<T>(
+    source: WebDemuxerSource,
+    task: (demuxer: WebDemuxer) => Promise<T>,
+  ): Promise<T> {
+    const slot = await this.acquire(source);
+
+    try {
+      return await task(slot.demuxer);
+    } finally {
+      this.release(slot);
+    }
+  }
+
+  /**
+   * Gets information about a specified stream of a source
+   * @see WebDemuxer.getAVStream
+   */
+  public getAVStream(
+    source: WebDemuxerSource,
+    streamType?: AVMediaType,
+    streamIndex?: number,
+  ): Promise<WebAVStream> {
+    return this.run(source, (demuxer) => demuxer.getAVStream(streamType, streamIndex));
+  }
+
+  /**
+   * Get all streams of a source
+   * @see WebDemuxer.getAVStreams
+   */
+  public getAVStreams(source: WebDemuxerSource): Promise<WebAVStream[]> {
+    return this.run(source, (demuxer) => demuxer.getAVStreams());
+  }
+
+  /**
+   * Get media info of a source
+   * @see WebDemuxer.getMediaInfo
+   */
+  public getMediaInfo(source: WebDemuxerSource): Promise<WebMediaInfo> {
+    return this.run(source, (demuxer) => demuxer.getMediaInfo());
+  }
+
+  /**
+   * Gets the WebCodecs decoder config of a stream of a source
+   * @see WebDemuxer.getDecoderConfig
+   */
+  public getDecoderConfig(
+    source: WebDemuxerSource,
+    streamType?: AVMediaType,
+    streamIndex?: number,
+    bitstreamFormat?: BitstreamFormat,
+  ): Promise<VideoDecoderConfig | AudioDecoderConfig | null> {
+    return this.run(source, (demuxer) =>
+      demuxer.getDecoderConfig(streamType, streamIndex, bitstreamFormat),
+    );
+  }
+
+  /**
+   * Gets the packet at a time point of a source
+   * @see WebDemuxer.getAVPacket
+   */
+  public getAVPacket(
+    source: WebDemuxerSource,
+    time: number,
+    streamType?: AVMediaType,
+    streamIndex?: number,
+    seekFlag?: AVSeekFlag,
+  ): Promise<WebAVPacket> {
+    return this.run(source, (demuxer) =>
+      demuxer.getAVPacket(time, streamType, streamIndex, seekFlag),
+    );
+  }
+
+  /**
+   * Get all packets at a time point from all streams of a source
+   * @see WebDemuxer.getAVPackets
+   */
+  public getAVPackets(
+    source: WebDemuxerSource,
+    time: number,
+    seekFlag?: AVSeekFlag,
+  ): Promise<WebAVPacket[]> {
+    return this.run(source, (demuxer) => demuxer.getAVPackets(time, seekFlag));
+  }
+
+  /**
+   * Gets the packets of one stream of a source at many time points
+   * @see WebDemuxer.getAVPacketsAt
+   */
+  public getAVPacketsAt(
+    source: WebDemuxerSource,
+    times: number[],
+    streamType?: AVMediaType,
+    streamIndex?: number,
+    seekFlag?: AVSeekFlag,
+  ): Promise<(WebAVPacket | null)[]> {
+    return this.run(source, (demuxer) =>
+      demuxer.getAVPacketsAt(times, streamType, streamIndex, seekFlag),
+    );
+  }
+
+  /**
+   * Gets the packets needed to decode the video frame of a source at a time point
+   * @see WebDemuxer.getFramePackets
+   */
+  public getFramePackets(
+    source: WebDemuxerSource,
+    time: number,
+    streamIndex?: number,
+    audio?: boolean,
+  ): Promise<WebFramePackets> {
+    return this.run(source, (demuxer) => demuxer.getFramePackets(time, streamIndex, audio));
+  }
+
+  /**
+   * Returns a `ReadableStream` for streaming packet data of a source,
+   * the worker is held until the stream is closed or cancelled
+   * @see WebDemuxer.readAVPacket
+   */
+  public readAVPacket(
+    source: WebDemuxerSource,
+    start?: number,
+    end?: number,
+    streamType?: AVMediaType,
+    streamIndex?: number,
+    seekFlag?: AVSeekFlag,
+    options?: ReadAVPacketOptions,
+  ): ReadableStream<WebAVPacket> {
+    return this.holdStream(source, (demuxer) =>
+      demuxer.readAVPacket(start, end, streamType, streamIndex, seekFlag, options),
+    );
+  }
+
+  /**
+   * Returns a `ReadableStream` of a time range of a source remuxed to
+   * fragmented MP4, the worker is held until the stream is closed or cancelled
+   * @see WebDemuxer.remuxRange
+   */
+  public remuxRange(
+    source: WebDemuxerSource,
+    start?: number,
+    end?: number,
+    streamIndices?: number[],
+    options?: RemuxOptions,
+  ): ReadableStream<WebRemuxSegment> {
+    return this.holdStream(source, (demuxer) =>
+      demuxer.remuxRange(start, end, streamIndices, options),
+    );
+  }
+
+  /** pass a stream of a worker through, holding the worker until it ends */
+  private holdStream<T>(
+    source: WebDemuxerSource,
+    open: (demuxer: WebDemuxer) => ReadableStream<T>,
+  ): ReadableStream<T> {
+    let slot: PoolSlot | undefined;
+    let reader: ReadableStreamDefaultReader<T>;
+    const releaseSlot = () => {
+      if (slot) {
+        this.release(slot);
+        slot = undefined;
+      }
+    };
+
+    return new ReadableStream(
+      {
+        start: async () => {
+          slot = await this.acquire(source);
+          reader = open(slot.demuxer).getReader();
+        },
+        pull: async (controller) => {
+          try {
+            const { done, value } = await reader.read();
+
+            if (done) {
+              releaseSlot();
+              controller.close();
+            } else {
+              controller.enqueue(value);
+            }
+          } catch (e) {
+            releaseSlot();
+            controller.error(e);
+          }
+        },
+        cancel: async (reason) => {
+          await reader?.cancel(reason);
+          releaseSlot();
+        },
+      },
+      new CountQueuingStrategy({ highWaterMark: 0 }),
+    );
+  }
+
+  /**
+   * Destroy all workers of the pool
+   */
+  public async destroy() {
+    await this.ready;
+    this.slots.forEach((slot) => slot.demuxer.destroy());
+    this.slots = [];
+  }
+}
@@ -5,9 +5,29 @@ import {
   FFMpegWorkerMessageData,
   FFMpegWorkerMessageType,
   WebAVPacket,
+  WebAVPacketBatch,
+  WebFramePackets,
+  UrlCacheOptions,
+  UrlCacheStats,
+  MemoryStats,
+  SessionStats,
+  WebTraceEvent,
   WebAVStream,
+  WebDemuxerSource,
   WebMediaInfo,
+  WebPacketIndex,
+  ProbePolicy,
+  BitstreamFormat,
+  AVPacketSideDataType,
+  ReadAVPacketMessageData,
+  RemuxRangeMessageData,
+  WebRemuxSegment,
+  SourceMetadata,
 } from "./types";
+import { metadataCache } from "./metadata-cache";
+import { WebAVPacketRecords } from "./packet-records";
+import { PushSource } from "./push-source";
+import { selectWasmLoaderPath } from "./wasm-features";
 import FFmpegWorker from "./ffmpeg.worker.ts?worker&inline";
 
 const TIME_BASE = 1000000;
@@ -17,6 +37,95 @@ export interface WebDemuxerOptions {
    * path to the wasm loader
    */
   wasmLoaderPath: string;
+  /**
+   * write packet data once from the wasm heap into a transferable buffer,
+   * set to false to fall back to the copying path, default true
+   */
+  zeroCopy?: boolean;
+  /**
+   * block cache options for url sources
+   */
+  urlCache?: UrlCacheOptions;
+  /**
+   * precompiled wasm module, lets several workers share one compilation
+   */
+  wasmModule?: WebAssembly.Module;
+  /**
+   * loaders of the optional SIMD and threaded (SIMD + pthreads) builds,
+   * the best one the browser supports is used, wasmLoaderPath is the fallback
+   */
+  wasmVariants?: WasmVariants;
+  /**
+   * trace worker phases, requests and av_log lines: true records them as
+   * performance.measure / performance.mark entries named "web-demuxer:<name>",
+   * a function receives the events instead, default false
+   */
+  trace?: boolean | ((event: WebTraceEvent) => void);
+}
+
+export interface WasmVariants {
+  /**
+   * path to the SIMD wasm loader (ffmpeg-simd.js)
+   */
+  simd?: string;
+  /**
+   * path to the threaded wasm loader (ffmpeg-threads.js),
+   * only used on cross origin isolated pages
+   */
+  threads?: string;
+}
+
+export interface LoadOptions {
+  /**
+   * size of the AVIOContext buffer used to read the source, default 32KB,
+   * larger values allow larger sequential reads per source read
+   */
+  ioBufferSize?: number;
+  /**
+   * probe policy used to find stream information, default "default"
+   */
+  probe?: ProbePolicy;
+  /**
+   * reuse the stream metadata of an earlier load of the same File or url
+   * (same lastModified / ETag) instead of probing, default true
+   */
+  cacheMetadata?: boolean;
+}
+
+export interface ReadAVPacketOptions {
+  /**
+   * max packets sent per worker round trip,
+   * default 1 (no batching), or no limit when batchBytes is set
+   */
+  batchSize?: number;
+  /**
+   * max payload bytes sent per worker round trip, default 0 (no limit)
+   */
+  batchBytes?: number;
+  /**
+   * high water mark of the returned stream in packets, default 1
+   */
+  highWaterMark?: number;
+  /**
+   * bitstream format of h264 / hevc packets, converted in the worker, default "keep"
+   */
+  bitstreamFormat?: BitstreamFormat;
+  /**
+   * readAVPacketStreams only: packets held past the highWaterMark of full
+   * streams, in total, before reading pauses, default 8 * highWaterMark
+   */
+  maxBufferedPackets?: number;
+}
+
+export interface RemuxOptions {
+  /**
+   * muxer of the output, default "mp4" (fragmented)
+   */
+  format?: string;
+  /**
+   * high water mark of the returned stream in segments, default 1
+   */
+  highWaterMark?: number;
 }
 
 /**
@@ -29,10 +138,14 @@ export class WebDemuxer {
   private ffmpegWorker: Worker;
   private ffmpegWorkerLoadStatus: Promise<void>;
   private msgId: number;
+  private options: WebDemuxerOptions;
+  /** worker requests answered since load, for getStats */
+  private roundTrips = { count: 0, totalMs: 0, maxMs: 0 };
 
-  public source?: File | string;
+  public source?: WebDemuxerSource;
 
   constructor(options: WebDemuxerOptions) {
+    this.options = options;
     this.ffmpegWorker = new FFmpegWorker();
     this.ffmpegWorkerLoadStatus = new Promise((resolve, reject) => {
       this.ffmpegWorker.addEventListener("message", (e) => {
@@ -40,10 +153,18 @@ export class WebDemuxer {
 
         if (type === FFMpegWorkerMessageType.FFmpegWorkerLoaded) {
           this.post(FFMpegWorkerMessageType.LoadWASM, {
-            wasmLoaderPath: options.wasmLoaderPath,
+            wasmLoaderPath: selectWasmLoaderPath(options),
+            wasmModule: options.wasmModule,
+            urlCache: options.urlCache,
+            trace: !!options.trace,
           });
         }
 
+        if (type === FFMpegWorkerMessageType.TraceEvent) {
+          // the worker has its own time origin
+          this.trace({ ...e.data.result, startTime: e.data.result.startTime - performance.timeOrigin });
+        }
+
         if (type === FFMpegWorkerMessageType.WASMRuntimeInitialized) {
           resolve();
         }
@@ -61,24 +182,32 @@ export class WebDemuxer {
     type: FFMpegWorkerMessageType,
     data?: FFMpegWorkerMessageData,
     msgId?: number,
+    transfer: Transferable[] = [],
   ) {
     this.ffmpegWorker.postMessage({
       type,
       msgId: msgId ?? this.msgId++,
       data,
-    });
+    }, transfer);
   }
 
-  private getFromWorker<T>(type: FFMpegWorkerMessageType, msgData: FFMpegWorkerMessageData): Promise<T> {
+  private getFromWorker<T>(
+    type: FFMpegWorkerMessageType,
+    msgData?: FFMpegWorkerMessageData,
+    transfer?: Transferable[],
+  ): Promise<T> {
     return new Promise((resolve, reject) => {
       if (!this.source) {
         reject("source is not loaded. call load() first");
         return;
       }
 
-      const msgId = this.msgId;
+      const msgId = this.msgId++;
+      const start = performance.now();
       const msgListener = ({ data }: MessageEvent) => {
         if (data.type === type && data.msgId === msgId) {
+          this.addRoundTrip(type, start);
+
           if (data.errMsg) {
             reject(data.errMsg);
           } else {
@@ -89,19 +218,91 @@ export class WebDemuxer {
       };
 
       this.ffmpegWorker.addEventListener("message", msgListener);
-      this.post(type, msgData, msgId);
+      this.post(type, msgData, msgId, transfer);
     });
   }
 
+  private addRoundTrip(type: FFMpegWorkerMessageType, start: number) {
+    const duration = performance.now() - start;
+    const roundTrips = this.roundTrips;
+
+    roundTrips.count++;
+    roundTrips.totalMs += duration;
+    roundTrips.maxMs = Math.max(roundTrips.maxMs, duration);
+
+    if (this.options.trace) {
+      this.trace({ name: "message", startTime: start, duration, detail: { type } });
+    }
+  }
+
+  private trace(event: WebTraceEvent) {
+    const { trace } = this.options;
+
+    if (typeof trace === "function") {
+      trace(event);
+    } else if (trace) {
+      const name = `web-demuxer:${event.name}`;
+
+      if (event.duration > 0) {
+        performance.measure(name, { start: event.startTime, duration: event.duration, detail: event.detail });
+      } else {
+        performance.mark(name, { startTime: event.startTime, detail: event.detail });
+      }
+    }
+  }
+
   /**
    * Load a file for demuxing
+   * the worker opens and probes the source once, then keeps it open
+   * for all subsequent calls until another source is loaded
    * @param source source to load
+   * @param options load options
    * @returns load status
    */
-  public async load(source: File | string) {
+  public async load(source: WebDemuxerSource, options: LoadOptions = {}) {
     await this.ffmpegWorkerLoadStatus;
 
+    const push = source instanceof PushSource;
+    // a full probe of a live source would wait for seconds of media
+    const { probe = push ? "fast" : "default", cacheMetadata = true } = options;
+    const cacheKey = cacheMetadata ? metadataCache.key(source, probe) : undefined;
+
     this.source = source;
+
+    try {
+      const metadata = await this.getFromWorker<SourceMetadata | undefined>(
+        FFMpegWorkerMessageType.LoadSource,
+        {
+          // the worker reads the shared buffers of a push source
+          source: push ? source.descriptor() : source,
+          options: {
+            zeroCopy: this.options.zeroCopy ?? true,
+            ioBufferSize: options.ioBufferSize,
+            probe,
+            cacheMetadata: !!cacheKey,
+            metadata: cacheKey ? metadataCache.get(cacheKey) : undefined,
+          },
+        },
+        source instanceof ReadableStream ? [source] : [],
+      );
+
+      if (cacheKey && metadata) {
+        metadataCache.set(cacheKey, metadata);
+      }
+
+      // stats are per loaded source, the worker starts new counters with the session
+      this.roundTrips = { count: 0, totalMs: 0, maxMs: 0 };
+    } catch (e) {
+      this.source = undefined;
+      throw e;
+    }
+  }
+
+  /**
+   * Clear the stream metadata cached by load() for all WebDemuxer instances
+   */
+  static clearMetadataCache() {
+    metadataCache.clear();
   }
 
   /**
@@ -125,7 +326,6 @@ export class WebDemuxer {
     streamIndex = -1,
   ): Promise<WebAVStream> {
     return this.getFromWorker(FFMpegWorkerMessageType.GetAVStream, {
-      source: this.source!,
       streamType,
       streamIndex,
     });
@@ -136,9 +336,7 @@ export class WebDemuxer {
    * @returns WebAVStream[]
    */
   public getAVStreams(): Promise<WebAVStream[]> {
-    return this.getFromWorker(FFMpegWorkerMessageType.GetAVStreams, {
-      source: this.source!,
-    });
+    return this.getFromWorker(FFMpegWorkerMessageType.GetAVStreams);
   }
 
   /**
@@ -146,9 +344,27 @@ export class WebDemuxer {
    * @returns WebMediaInfo
    */
   public getMediaInfo(): Promise<WebMediaInfo> {
-    return this.getFromWorker(FFMpegWorkerMessageType.GetMediaInfo, {
-      source: this.source!,
-    });
+    return this.getFromWorker(FFMpegWorkerMessageType.GetMediaInfo);
+  }
+
+  /**
+   * Gets the WebCodecs decoder config of a stream. Configs are built once per
+   * source in the worker and rebuilt only when in-band extradata changes.
+   * @param streamType The type of media stream
+   * @param streamIndex The index of the media stream
+   * @param bitstreamFormat bitstream format the packets are read in, default "keep",
+   * with "avcc" annex-b h264 is described by the avcC synthesized in the worker
+   * @returns VideoDecoderConfig, AudioDecoderConfig, or null for other stream types
+   */
+  public getDecoderConfig(
+    streamType = AVMediaType.AVMEDIA_TYPE_VIDEO,
+    streamIndex = -1,
+    bitstreamFormat: BitstreamFormat = "keep",
+  ): Promise<VideoDecoderConfig | AudioDecoderConfig | null> {
+    return this.getFromWorker<VideoDecoderConfig | AudioDecoderConfig | null>(
+      FFMpegWorkerMessageType.GetDecoderConfig,
+      { streamType, streamIndex, bitstreamFormat },
+    );
   }
 
   /**
@@ -166,7 +382,6 @@ export class WebDemuxer {
     seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD
   ): Promise<WebAVPacket> {
     return this.getFromWorker(FFMpegWorkerMessageType.GetAVPacket, {
-      source: this.source!,
       time,
       streamType,
       streamIndex,
@@ -185,12 +400,102 @@ export class WebDemuxer {
     seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD
   ): Promise<WebAVPacket[]> {
     return this.getFromWorker(FFMpegWorkerMessageType.GetAVPackets, {
-      source: this.source!,
       time,
       seekFlag
     });
   }
 
+  /**
+   * Gets the packets of one stream at many time points in one call, e.g. for
+   * thumbnail timelines. Times are resolved in ascending order on the open
+   * source, close targets are reached by reading forward instead of seeking,
+   * and all packets come back in one transfer.
+   * @param times times in seconds
+   * @param streamType The type of media stream
+   * @param streamIndex The index of the media stream
+   * @param seekFlag The seek flag
+   * @returns the packet of each time in request order, null where none was found;
+   * times resolving to the same packet (e.g. the same keyframe) share one object
+   */
+  public async getAVPacketsAt(
+    times: number[],
+    streamType = AVMediaType.AVMEDIA_TYPE_VIDEO,
+    streamIndex = -1,
+    seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD
+  ): Promise<(WebAVPacket | null)[]> {
+    const { packets, indexes } = await this.getFromWorker<{
+      packets: WebAVPacketBatch;
+      indexes: Int32Array;
+    }>(FFMpegWorkerMessageType.GetAVPacketsAt, {
+      times,
+      streamType,
+      streamIndex,
+      seekFlag,
+    });
+    const unpacked = this.unpackAVPacketBatch(packets);
+
+    return Array.from(indexes, (index) => (index >= 0 ? unpacked[index] : null));
+  }
+
+  /**
+   * Gets everything needed to decode the video frame shown at a time point in
+   * one round trip: the last keyframe at or before it and every packet up to the
+   * frame in decode order, plus the audio of the same time range
+   * @param time time in seconds
+   * @param streamIndex The index of the video stream
+   * @param audio whether to include the packets of the related audio stream
+   * @returns WebFramePackets
+   */
+  public async getFramePackets(
+    time: number,
+    streamIndex = -1,
+    audio = true
+  ): Promise<WebFramePackets> {
+    const result = await this.getFromWorker<{
+      video: WebAVPacketBatch;
+      target: number;
+      audio?: WebAVPacketBatch;
+    }>(FFMpegWorkerMessageType.GetFramePackets, {
+      time,
+      streamIndex,
+      audio,
+    });
+
+    return {
+      video: this.unpackAVPacketBatch(result.video),
+      targetIndex: result.target,
+      audio: result.audio ? this.unpackAVPacketBatch(result.audio) : [],
+    };
+  }
+
+  /**
+   * Get the sample table (pts, dts, byte offset, size, keyframe) of a stream,
+   * from the container index when complete, otherwise by one linear scan
+   * @param streamType The type of media stream
+   * @param streamIndex The index of the media stream
+   * @returns WebPacketIndex
+   */
+  public getPacketIndex(
+    streamType = AVMediaType.AVMEDIA_TYPE_VIDEO,
+    streamIndex = -1,
+  ): Promise<WebPacketIndex> {
+    return this.getFromWorker(FFMpegWorkerMessageType.GetPacketIndex, {
+      streamType,
+      streamIndex,
+    });
+  }
+
+  /**
+   * Import a packet index previously returned by getPacketIndex,
+   * so the loaded source skips building it
+   * @param index WebPacketIndex
+   */
+  public setPacketIndex(index: WebPacketIndex): Promise<void> {
+    return this.getFromWorker(FFMpegWorkerMessageType.SetPacketIndex, {
+      index,
+    });
+  }
+
   /**
    * Returns a `ReadableStream` for streaming packet data.
    * @param start start time in seconds
@@ -198,6 +503,7 @@ export class WebDemuxer {
    * @param streamType The type of media stream
    * @param streamIndex The index of the media stream
    * @param seekFlag The seek flag
+   * @param options batching and queueing options
    * @returns ReadableStream<WebAVPacket>
    */
   public readAVPacket(
@@ -205,11 +511,96 @@ export class WebDemuxer {
     end = 0,
     streamType = AVMediaType.AVMEDIA_TYPE_VIDEO,
     streamIndex = -1,
-    seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD
+    seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD,
+    options: ReadAVPacketOptions = {}
   ): ReadableStream<WebAVPacket> {
-    const queueingStrategy = new CountQueuingStrategy({ highWaterMark: 1 });
-    const msgId = this.msgId;
-    let pullCounter = 0;
+    const { batchBytes = 0, batchSize = batchBytes > 0 ? 0 : 1, highWaterMark = 1, bitstreamFormat } = options;
+
+    return this.createReadStream<WebAVPacket, WebAVPacketBatch>(
+      FFMpegWorkerMessageType.ReadAVPacket,
+      { start, end, streamType, streamIndex, seekFlag, batchSize, batchBytes, bitstreamFormat },
+      highWaterMark,
+      FFMpegWorkerMessageType.AVPacketBatchStream,
+      (batch) => this.unpackAVPacketBatch(batch),
+    );
+  }
+
+  /**
+   * Returns a `ReadableStream` of packet batches kept as flat records
+   * (WebAVPacketRecords), no object is created per packet until the consumer
+   * asks for one, e.g. to build an EncodedVideoChunk from payload(i).
+   * @param start start time in seconds
+   * @param end end time in seconds
+   * @param streamType The type of media stream
+   * @param streamIndex The index of the media stream
+   * @param seekFlag The seek flag
+   * @param options batching (default 64 packets per batch) and queueing (in batches) options
+   * @returns ReadableStream<WebAVPacketRecords>
+   */
+  public readAVPacketRecords(
+    start = 0,
+    end = 0,
+    streamType = AVMediaType.AVMEDIA_TYPE_VIDEO,
+    streamIndex = -1,
+    seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD,
+    options: ReadAVPacketOptions = {}
+  ): ReadableStream<WebAVPacketRecords> {
+    const { batchBytes = 0, batchSize = batchBytes > 0 ? 0 : 64, highWaterMark = 1, bitstreamFormat } = options;
+
+    return this.createReadStream<WebAVPacketRecords, WebAVPacketBatch>(
+      FFMpegWorkerMessageType.ReadAVPacket,
+      { start, end, streamType, streamIndex, seekFlag, batchSize, batchBytes, batched: true, bitstreamFormat },
+      highWaterMark,
+      FFMpegWorkerMessageType.AVPacketBatchStream,
+      (batch) => [new WebAVPacketRecords(batch)],
+    );
+  }
+
+  /**
+   * Returns a `ReadableStream` of a time range remuxed to fragmented MP4 in the
+   * worker, without decoding, for Media Source Extensions: the init segment
+   * first (with its mimeType), then one chunk per fragment. The first stream
+   * leads: reading starts at its keyframe before start and fragments start at
+   * its keyframes, spanning at least one second.
+   * @param start start time in seconds
+   * @param end end time in seconds
+   * @param streamIndices streams to remux, default the first video and audio streams
+   * @param options output format and queueing options
+   * @returns ReadableStream<WebRemuxSegment>
+   */
+  public remuxRange(
+    start = 0,
+    end = 0,
+    streamIndices?: number[],
+    options: RemuxOptions = {},
+  ): ReadableStream<WebRemuxSegment> {
+    const { format = "mp4", highWaterMark = 1 } = options;
+
+    return this.createReadStream<WebRemuxSegment, WebRemuxSegment>(
+      FFMpegWorkerMessageType.RemuxRange,
+      { start, end, streamIndices, format },
+      highWaterMark,
+      FFMpegWorkerMessageType.RemuxSegmentStream,
+      (segment) => [segment],
+    );
+  }
+
+  /**
+   * pull based stream of a worker read: the worker sends a chunk message
+   * (unpacked into stream chunks) per ReadNextAVPacket, and a null
+   * AVPacketStream message at the end
+   */
+  private createReadStream<T, R>(
+    requestType: FFMpegWorkerMessageType,
+    msgData: ReadAVPacketMessageData | RemuxRangeMessageData,
+    highWaterMark: number,
+    chunkType: FFMpegWorkerMessageType,
+    unpack: (result: R) => T[],
+  ): ReadableStream<T> {
+    const queueingStrategy = new CountQueuingStrategy({ highWaterMark });
+    const msgId = this.msgId++;
+    // the worker sends the first packet (or batch) without being asked
+    let waitingForWorker = true;
     let msgListener: (e: MessageEvent) => void;
     let cancelResolver: () => void;
 
@@ -224,7 +615,7 @@ export class WebDemuxer {
             const data = e.data;
 
             if (
-              data.type === FFMpegWorkerMessageType.ReadAVPacket &&
+              data.type === requestType &&
               data.msgId === msgId
             ) {
               if (data.errMsg) {
@@ -239,7 +630,10 @@ export class WebDemuxer {
               data.type === FFMpegWorkerMessageType.AVPacketStream &&
               data.msgId === msgId
             ) {
+              waitingForWorker = false;
+
               if (data.result && !cancelResolver) {
+                // single packets are only sent to unbatched WebAVPacket streams
                 controller.enqueue(data.result);
               } else {
                 this.ffmpegWorker.removeEventListener("message", msgListener);
@@ -251,28 +645,32 @@ export class WebDemuxer {
                 }
               }
             }
+
+            if (
+              data.type === chunkType &&
+              data.msgId === msgId
+            ) {
+              waitingForWorker = false;
+
+              if (!cancelResolver) {
+                unpack(data.result).forEach((chunk) => controller.enqueue(chunk));
+              }
+            }
           };
 
           this.ffmpegWorker.addEventListener("message", msgListener);
-          this.post(FFMpegWorkerMessageType.ReadAVPacket, {
-            source: this.source,
-            start,
-            end,
-            streamType,
-            streamIndex,
-            seekFlag
-          });
+          this.post(requestType, msgData, msgId);
         },
         pull: () => {
-          // first pull called by read don't send read next message
-          if (pullCounter > 0) {
+          // only one request in flight, a batch enqueue may trigger several pulls
+          if (!waitingForWorker) {
+            waitingForWorker = true;
             this.post(
               FFMpegWorkerMessageType.ReadNextAVPacket,
               undefined,
               msgId,
             );
           }
-          pullCounter++;
         },
         cancel: () => {
           return new Promise((resolve) => {
@@ -285,6 +683,176 @@ export class WebDemuxer {
     );
   }
 
+  /**
+   * Returns one `ReadableStream` per stream for reading several streams
+   * (e.g. video and audio) in a single demux pass, packets are tagged with
+   * their stream_index.
+   * Each stream buffers up to highWaterMark packets (default 16). Reading goes
+   * on while any stream has room, the packets of full streams are queued past
+   * their highWaterMark, up to maxBufferedPackets in total, then reading pauses
+   * until a full stream is read. So a stalled consumer does not stop the others
+   * right away, and bounds how far they can read ahead instead of the file
+   * being read twice.
+   * @param start start time in seconds
+   * @param end end time in seconds
+   * @param streamIndices distinct stream indices to read, seeking is done on the first one
+   * @param seekFlag The seek flag
+   * @param options batching and per stream queueing options
+   * @returns ReadableStream<WebAVPacket>[] in the order of streamIndices
+   */
+  public readAVPacketStreams(
+    start = 0,
+    end = 0,
+    streamIndices: number[],
+    seekFlag = AVSeekFlag.AVSEEK_FLAG_BACKWARD,
+    options: ReadAVPacketOptions = {},
+  ): ReadableStream<WebAVPacket>[] {
+    const {
+      batchBytes = 0,
+      batchSize = batchBytes > 0 ? 0 : 16,
+      highWaterMark = 16,
+      maxBufferedPackets = 8 * highWaterMark,
+      bitstreamFormat,
+    } = options;
+    const msgId = this.msgId++;
+    const controllers = new Map<number, ReadableStreamDefaultController<WebAVPacket>>();
+    // the worker sends the first batch without being asked
+    let waitingForWorker = true;
+    let stopResolvers: (() => void)[] = [];
+
+    const requestNext = () => {
+      const open = [...controllers.values()];
+      // packets queued past the high water mark of full streams
+      const overflow = open.reduce((sum, controller) => sum + Math.max(0, -(controller.desiredSize ?? 0)), 0);
+
+      if (waitingForWorker || !open.some((controller) => (controller.desiredSize ?? 0) > 0) || overflow >= maxBufferedPackets) {
+        return;
+      }
+
+      waitingForWorker = true;
+      this.post(FFMpegWorkerMessageType.ReadNextAVPacket, undefined, msgId);
+    };
+
+    const msgListener = ({ data }: MessageEvent) => {
+      if (data.msgId !== msgId) return;
+
+      if (data.type === FFMpegWorkerMessageType.ReadAVPacket && data.errMsg) {
+        controllers.forEach((controller) => controller.error(data.errMsg));
+        controllers.clear();
+        this.ffmpegWorker.removeEventListener("message", msgListener);
+      }
+
+      if (data.type === FFMpegWorkerMessageType.AVPacketBatchStream) {
+        waitingForWorker = false;
+        // packets of cancelled streams are dropped
+        this.unpackAVPacketBatch(data.result).forEach((packet) =>
+          controllers.get(packet.stream_index)?.enqueue(packet),
+        );
+        requestNext();
+      }
+
+      if (data.type === FFMpegWorkerMessageType.AVPacketStream && !data.result) {
+        controllers.forEach((controller) => controller.close());
+        controllers.clear();
+        stopResolvers.forEach((resolve) => resolve());
+        stopResolvers = [];
+        this.ffmpegWorker.removeEventListener("message", msgListener);
+      }
+    };
+
+    const streams = streamIndices.map(
+      (streamIndex) =>
+        new ReadableStream<WebAVPacket>(
+          {
+            start: (controller) => {
+              controllers.set(streamIndex, controller);
+            },
+            pull: requestNext,
+            cancel: () => {
+              controllers.delete(streamIndex);
+
+              if (controllers.size > 0) {
+                requestNext();
+                return;
+              }
+
+              // the last open stream stops the read
+              return new Promise<void>((resolve) => {
+                stopResolvers.push(resolve);
+                this.post(FFMpegWorkerMessageType.StopReadAVPacket, undefined, msgId);
+              });
+            },
+          },
+          new CountQueuingStrategy({ highWaterMark }),
+        ),
+    );
+
+    if (!this.source) {
+      controllers.forEach((controller) => controller.error("source is not loaded. call load() first"));
+      controllers.clear();
+      return streams;
+    }
+
+    this.ffmpegWorker.addEventListener("message", msgListener);
+    this.post(FFMpegWorkerMessageType.ReadAVPacket, {
+      start,
+      end,
+      streamType: AVMediaType.AVMEDIA_TYPE_UNKNOWN,
+      streamIndex: -1,
+      seekFlag,
+      batchSize,
+      batchBytes,
+      streamIndices,
+      bitstreamFormat,
+    }, msgId);
+
+    return streams;
+  }
+
+  /**
+   * Split a struct-of-arrays packet batch into WebAVPackets,
+   * packet data are views on the batch buffer
+   */
+  private unpackAVPacketBatch(batch: WebAVPacketBatch): WebAVPacket[] {
+    return new WebAVPacketRecords(batch).toPackets();
+  }
+
+  /**
+   * Get hit/miss counters of the url block cache
+   * @returns UrlCacheStats
+   */
+  public getUrlCacheStats(): Promise<UrlCacheStats> {
+    return this.getFromWorker(FFMpegWorkerMessageType.GetUrlCacheStats);
+  }
+
+  /**
+   * Get wasm heap and packet arena counters of the worker
+   * @returns MemoryStats
+   */
+  public getMemoryStats(): Promise<MemoryStats> {
+    return this.getFromWorker(FFMpegWorkerMessageType.GetMemoryStats);
+  }
+
+  /**
+   * Get the counters of the loaded source: probe time, seeks and their
+   * latency histogram, source reads, url range requests and cache hits,
+   * packets and bytes sent, the wasm heap size and worker round trip times
+   * @returns SessionStats
+   */
+  public async getStats(): Promise<SessionStats> {
+    const stats = await this.getFromWorker<Omit<SessionStats, "messages" | "roundTripMs" | "maxRoundTripMs">>(
+      FFMpegWorkerMessageType.GetStats,
+    );
+    const { count, totalMs, maxMs } = this.roundTrips;
+
+    return {
+      ...stats,
+      messages: count,
+      roundTripMs: count > 0 ? totalMs / count : 0,
+      maxRoundTripMs: maxMs,
+    };
+  }
+
   /**
    * Set log level
    * @param level log level
@@ -372,16 +940,31 @@ export class WebDemuxer {
   /**
    * Generate VideoDecoderConfig from WebAVStream
    * @param avStream WebAVStream
+   * @param bitstreamFormat bitstream format the packets are read in, default "keep"
+   * @param avPacket packet carrying new extradata (e.g. the first keyframe read as "avcc"), overrides the stream extradata
    * @returns VideoDecoderConfig
    */
-  public genVideoDecoderConfig(avStream: WebAVStream): VideoDecoderConfig {
+  public genVideoDecoderConfig(
+    avStream: WebAVStream,
+    bitstreamFormat: BitstreamFormat = "keep",
+    avPacket?: WebAVPacket,
+  ): VideoDecoderConfig {
+    const extradata =
+      avPacket?.side_data.find(
+        (sideData) => sideData.type === AVPacketSideDataType.AV_PKT_DATA_NEW_EXTRADATA,
+      )?.data ?? avStream.extradata;
+    // annex-b extradata (start code prefixed) is not a valid description, parameter sets are in band
+    const annexB =
+      extradata?.length >= 3 && extradata[0] === 0 && extradata[1] === 0 &&
+      (extradata[2] === 1 || (extradata[2] === 0 && extradata[3] === 1));
+
     return {
       codec: avStream.codec_string,
       codedWidth: avStream.width,
       codedHeight: avStream.height,
       description:
-        avStream.extradata?.length > 0
-          ? avStream.extradata
+        bitstreamFormat !== "annexb" && extradata?.length > 0 && !annexB
+          ? extradata
           : undefined,
     };
   }
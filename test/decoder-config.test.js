@@ -0,0 +1,88 @@
+import { beforeEach, describe, expect, it } from 'vitest'
+import { loadPostJs } from './helpers/post-js.js'
+
+// annex-b h264 extradata (as probed from MPEG-TS) and the avcC synthesized from it
+const SPS = [0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9]
+const PPS = [0x68, 0xeb, 0xe3, 0xcb]
+const ANNEXB_EXTRADATA = new Uint8Array([0, 0, 0, 1, ...SPS, 0, 0, 0, 1, ...PPS])
+const AVCC = new Uint8Array([1, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0, SPS.length, ...SPS, 1, 0, PPS.length, ...PPS])
+
+function h264Stream() {
+  return {
+    id: 256,
+    index: 0,
+    codec_type: 0,
+    codec_name: 'h264',
+    codec_string: 'avc1.64001f',
+    width: 1280,
+    height: 720,
+    extradata: ANNEXB_EXTRADATA,
+    extradata_size: ANNEXB_EXTRADATA.length,
+    tags: { size: () => 0 },
+    delete() {},
+  }
+}
+
+/** native session of one annex-b h264 stream, counting the avcC requests */
+class FakeSession {
+  constructor() {
+    this.outputRequests = []
+    FakeSession.last = this
+  }
+
+  get_streams_version() {
+    return 0
+  }
+
+  get_stream_version() {
+    return 0
+  }
+
+  find_stream() {
+    return 0
+  }
+
+  get_av_streams() {
+    return { streams: { size: () => 1, get: () => h264Stream(), delete() {} } }
+  }
+
+  get_output_extradata(streamIndex, bitstreamFormat) {
+    this.outputRequests.push([streamIndex, bitstreamFormat])
+    return AVCC.slice()
+  }
+}
+
+describe('DemuxSession.getDecoderConfig, Annex-B H.264', () => {
+  let session
+
+  beforeEach(() => {
+    const { DemuxSession } = loadPostJs({ Module: { WebDemuxerSession: FakeSession } })
+
+    session = new DemuxSession(new Uint8Array(16))
+  })
+
+  it('describes avcc packets with the synthesized avcC', () => {
+    const config = session.getDecoderConfig(0, -1, 'avcc')
+
+    expect(config.codec).toBe('avc1.64001f')
+    expect(config.description).toEqual(AVCC)
+    expect(FakeSession.last.outputRequests).toEqual([[0, 2]])
+  })
+
+  it('synthesizes the avcC once per stream version and hands out copies', () => {
+    const first = session.getDecoderConfig(0, -1, 'avcc')
+
+    first.description.fill(0)
+
+    const second = session.getDecoderConfig(0, -1, 'avcc')
+
+    expect(second.description).toEqual(AVCC)
+    expect(FakeSession.last.outputRequests).toHaveLength(1)
+  })
+
+  it('has no description for keep and annexb', () => {
+    expect(session.getDecoderConfig(0, -1, 'keep').description).toBeUndefined()
+    expect(session.getDecoderConfig(0, -1, 'annexb').description).toBeUndefined()
+    expect(FakeSession.last.outputRequests).toHaveLength(0)
+  })
+})
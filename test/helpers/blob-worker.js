@@ -0,0 +1,47 @@
+import { Worker } from 'node:worker_threads'
+import { resolveObjectURL } from 'node:buffer'
+
+/**
+ * The web Worker subset post.js uses for a blob: url script (postMessage,
+ * onmessage, onerror, terminate), run on a worker thread. the script is read
+ * asynchronously, messages posted before are queued.
+ */
+export class BlobWorker {
+  queue = []
+  onmessage = null
+  onerror = null
+
+  constructor(url) {
+    resolveObjectURL(url).text().then((code) => {
+      this.worker = new Worker(
+        `const { parentPort } = require('node:worker_threads');
+        globalThis.self = globalThis;
+        self.postMessage = (message) => parentPort.postMessage(message);
+        parentPort.on('message', (data) => self.onmessage({ data }));
+        ${code}`,
+        { eval: true },
+      )
+      this.worker.on('message', (data) => this.onmessage?.({ data }))
+      this.worker.on('error', (e) => this.onerror?.(e))
+      this.queue.forEach((message) => this.worker.postMessage(message))
+      this.queue = null
+
+      if (this.terminated) {
+        this.worker.terminate()
+      }
+    })
+  }
+
+  postMessage(message) {
+    if (this.worker) {
+      this.worker.postMessage(message)
+    } else {
+      this.queue.push(message)
+    }
+  }
+
+  terminate() {
+    this.terminated = true
+    this.worker?.terminate()
+  }
+}
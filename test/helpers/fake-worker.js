@@ -0,0 +1,66 @@
+/**
+ * Stand-in for the ffmpeg worker of WebDemuxer (mock ./ffmpeg.worker.ts?worker&inline
+ * with it): it loads the wasm and sources at once, other requests are kept in
+ * held, or passed to FakeWorker.onMessage(worker, message) when that is set.
+ */
+export class FakeWorker {
+  static instances = []
+  static onMessage = undefined
+
+  constructor() {
+    this.listeners = new Set()
+    this.held = []
+    this.posted = []
+    FakeWorker.instances.push(this)
+    queueMicrotask(() => this.emit({ type: 'FFmpegWorkerLoaded' }))
+  }
+
+  static reset() {
+    FakeWorker.instances = []
+    FakeWorker.onMessage = undefined
+  }
+
+  addEventListener(_, listener) {
+    this.listeners.add(listener)
+  }
+
+  removeEventListener(_, listener) {
+    this.listeners.delete(listener)
+  }
+
+  emit(data) {
+    ;[...this.listeners].forEach((listener) => listener({ data }))
+  }
+
+  postMessage(message) {
+    this.posted.push(message)
+
+    if (message.type === 'LoadWASM') {
+      queueMicrotask(() => this.emit({ type: 'WASMRuntimeInitialized' }))
+    } else if (message.type === 'LoadSource') {
+      queueMicrotask(() => this.emit({ type: 'LoadSource', msgId: message.msgId, result: undefined }))
+    } else if (FakeWorker.onMessage) {
+      queueMicrotask(() => FakeWorker.onMessage(this, message))
+    } else {
+      this.held.push(message)
+    }
+  }
+
+  terminate() {}
+}
+
+/** a WebAVPacketBatch of one byte packets of the given stream indices */
+export function packetBatch(streamIndices) {
+  const size = streamIndices.length
+  const fields = new Int32Array(size * 4)
+
+  streamIndices.forEach((streamIndex, i) => fields.set([streamIndex, 0, i, 1], i * 4))
+
+  return { size, times: new Float64Array(size * 4), fields, side_data: new Int32Array(0), data: new Uint8Array(size) }
+}
+
+export async function until(condition) {
+  while (!condition()) {
+    await new Promise((resolve) => setTimeout(resolve, 0))
+  }
+}
@@ -0,0 +1,36 @@
+import { readFileSync } from 'node:fs'
+import { SyncXMLHttpRequest } from './sync-xhr.js'
+import { BlobWorker } from './blob-worker.js'
+
+const source = readFileSync(new URL('../../lib/web-demuxer/post.js', import.meta.url), 'utf8')
+
+/**
+ * Evaluate lib/web-demuxer/post.js, which is appended to the emscripten module
+ * code, with a stub Module and node stand-ins for the worker globals it uses.
+ * each call has its own url block cache. with crossOriginIsolated, url reads
+ * may go through the fetch engine (see setUrlCacheOptions). Module may stand
+ * in for the native bindings (e.g. WebDemuxerSession) used by DemuxSession.
+ */
+export function loadPostJs({ crossOriginIsolated = false, FileReaderSync, Module = {} } = {}) {
+  const globals = {
+    self: { crossOriginIsolated },
+    XMLHttpRequest: SyncXMLHttpRequest,
+    Worker: BlobWorker,
+    FileReaderSync,
+  }
+  const names = Object.keys(globals)
+  const module = new Function(
+    'Module',
+    ...names,
+    `${source}
+    return { UrlSource, FileSource, guardSource, SessionStats, DemuxSession, urlBlockCache, setUrlCacheOptions, getUrlCacheStats };`,
+  )(Module, ...names.map((name) => globals[name]))
+
+  return {
+    ...module,
+    /** stop the fetch engine worker */
+    dispose() {
+      module.urlBlockCache.engine?.terminate()
+    },
+  }
+}
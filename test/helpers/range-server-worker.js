@@ -0,0 +1,88 @@
+import { createServer } from 'node:http'
+import { createReadStream, statSync } from 'node:fs'
+import { join } from 'node:path'
+import { parentPort, workerData } from 'node:worker_threads'
+
+// GET requests per url (path and query), read by /__requests?url=...
+const requests = new Map()
+
+/**
+ * Serves the files of workerData.root with Range support. GET requests can be
+ * made to misbehave with the query string:
+ *   fail=N         the first N requests of the url answer 503
+ *   status=S       answer S
+ *   ignoreRange=1  answer 200 with the whole file, like a server without Range support
+ *   shiftStart=N   answer the range N bytes before the asked one, like a proxy with 32 bit offsets
+ *   truncate=N     end ranges that start before byte N at N, like a server capping its responses
+ */
+const server = createServer((request, response) => {
+  const url = new URL(request.url, 'http://localhost')
+
+  if (url.pathname === '/__requests') {
+    response.end(String(requests.get(url.searchParams.get('url')) || 0))
+    return
+  }
+
+  let size, mtimeMs
+
+  try {
+    ({ size, mtimeMs } = statSync(join(workerData.root, url.pathname)))
+  } catch (e) {
+    response.writeHead(404)
+    response.end()
+    return
+  }
+
+  const headers = {
+    'Accept-Ranges': 'bytes',
+    'Content-Type': 'application/octet-stream',
+    ETag: `"${size.toString(16)}-${Math.floor(mtimeMs).toString(16)}"`,
+  }
+
+  if (request.method === 'HEAD') {
+    response.writeHead(200, { ...headers, 'Content-Length': size })
+    response.end()
+    return
+  }
+
+  const count = (requests.get(request.url) || 0) + 1
+  const query = url.searchParams
+  const range = /^bytes=(\d+)-(\d*)$/.exec(request.headers.range || '')
+
+  requests.set(request.url, count)
+
+  if (count <= Number(query.get('fail') || 0)) {
+    response.writeHead(503)
+    response.end()
+    return
+  }
+
+  if (query.has('status')) {
+    response.writeHead(Number(query.get('status')))
+    response.end()
+    return
+  }
+
+  if (!range || query.has('ignoreRange')) {
+    response.writeHead(200, { ...headers, 'Content-Length': size })
+    createReadStream(join(workerData.root, url.pathname)).pipe(response)
+    return
+  }
+
+  const shift = Number(query.get('shiftStart') || 0)
+  const start = Math.max(Number(range[1]) - shift, 0)
+  const truncate = Number(query.get('truncate') || size)
+  const last = Math.min(range[2] ? Number(range[2]) - shift : size - 1, size - 1)
+  const end = start < truncate ? Math.min(last, truncate - 1) : last
+
+  if (start > end) {
+    response.writeHead(416, { 'Content-Range': `bytes */${size}` })
+    response.end()
+    return
+  }
+
+  response.writeHead(206, { ...headers, 'Content-Length': end - start + 1, 'Content-Range': `bytes ${start}-${end}/${size}` })
+  createReadStream(join(workerData.root, url.pathname), { start, end }).pipe(response)
+})
+
+server.listen(0, '127.0.0.1', () => parentPort.postMessage(server.address().port))
@@ -0,0 +1,36 @@
+import { Worker } from 'node:worker_threads'
+
+/**
+ * Start the range server of range-server-worker.js on the files of root. it
+ * runs on its own thread, because url reads block the test thread while they
+ * wait for the response (sync XHR, Atomics.wait).
+ */
+export async function startRangeServer(root) {
+  const worker = new Worker(new URL('./range-server-worker.js', import.meta.url), { workerData: { root } })
+  const port = await new Promise((resolve, reject) => {
+    worker.once('message', resolve)
+    worker.once('error', reject)
+  })
+  const origin = `http://127.0.0.1:${port}`
+
+  return {
+    /** url of path, with the misbehaviour options of range-server-worker.js as query */
+    url(path, query = {}) {
+      const search = new URLSearchParams(query).toString()
+
+      return `${origin}/${path}${search ? '?' + search : ''}`
+    },
+
+    /** GET requests made to url so far */
+    async requests(url) {
+      const { pathname, search } = new URL(url)
+      const response = await fetch(`${origin}/__requests?url=${encodeURIComponent(pathname + search)}`)
+
+      return Number(await response.text())
+    },
+
+    close() {
+      return worker.terminate()
+    },
+  }
+}
@@ -0,0 +1,34 @@
+import { parentPort, workerData } from 'node:worker_threads'
+
+// see sync-xhr.js for the layout of the shared buffer
+const control = new Int32Array(workerData.buffer, 0, 4)
+const data = new Uint8Array(workerData.buffer, 16)
+
+parentPort.on('message', async ({ method, url, headers }) => {
+  let status = 0
+  let head = new Uint8Array(0)
+  let body = new Uint8Array(0)
+
+  try {
+    const response = await fetch(url, { method, headers })
+
+    status = response.status
+    head = new TextEncoder().encode(JSON.stringify([...response.headers]))
+    body = new Uint8Array(await response.arrayBuffer())
+  } catch (e) {
+    // network error, status 0
+  }
+
+  if (head.byteLength + body.byteLength > data.byteLength) {
+    status = 0
+    head = body = new Uint8Array(0)
+  }
+
+  data.set(head, 0)
+  data.set(body, head.byteLength)
+  control[1] = status
+  control[2] = head.byteLength
+  control[3] = body.byteLength
+  Atomics.store(control, 0, 1)
+  Atomics.notify(control, 0)
+})
@@ -0,0 +1,51 @@
+import { Worker } from 'node:worker_threads'
+
+// [done, status, header bytes, body bytes] followed by the headers (json) and the body
+const buffer = new SharedArrayBuffer(16 + 64 * 1024 * 1024)
+const control = new Int32Array(buffer, 0, 4)
+const data = new Uint8Array(buffer, 16)
+let worker
+
+/**
+ * The synchronous XMLHttpRequest subset post.js uses (open, setRequestHeader,
+ * send, status, getResponseHeader, response as ArrayBuffer), for node: the
+ * request is made with fetch() on a worker thread while send() waits with
+ * Atomics.wait.
+ */
+export class SyncXMLHttpRequest {
+  headers = {}
+  responseHeaders = new Map()
+  status = 0
+  response = null
+
+  open(method, url) {
+    this.method = method
+    this.url = url
+  }
+
+  setRequestHeader(name, value) {
+    this.headers[name] = value
+  }
+
+  send() {
+    if (!worker) {
+      worker = new Worker(new URL('./sync-xhr-worker.js', import.meta.url), { workerData: { buffer } })
+      worker.unref()
+    }
+
+    Atomics.store(control, 0, 0)
+    worker.postMessage({ method: this.method, url: this.url, headers: this.headers })
+    Atomics.wait(control, 0, 0)
+
+    const headLength = control[2]
+    const bodyLength = control[3]
+
+    this.status = control[1]
+    this.responseHeaders = new Map(JSON.parse(new TextDecoder().decode(data.slice(0, headLength)) || '[]'))
+    this.response = data.slice(headLength, headLength + bodyLength).buffer
+  }
+
+  getResponseHeader(name) {
+    return this.responseHeaders.get(name.toLowerCase()) ?? null
+  }
+}
@@ -0,0 +1,151 @@
+import { afterAll, afterEach, beforeAll, describe, expect, it } from 'vitest'
+import { closeSync, ftruncateSync, mkdtempSync, openSync, readSync, rmSync, writeSync } from 'node:fs'
+import { tmpdir } from 'node:os'
+import { join } from 'node:path'
+import { startRangeServer } from './helpers/range-server.js'
+import { loadPostJs } from './helpers/post-js.js'
+
+// the layout of h264-aac-5g-sparse.mp4 (bench/native/gen_corpus.sh): a free box
+// with a 64 bit size spanning 5GB, then the media, sparse on disk
+const GAP = 5 * 1024 ** 3
+const TAIL = 256 * 1024
+const SIZE = GAP + TAIL
+const BOUNDARY = 2 ** 32
+const BLOCK_SIZE = 64 * 1024
+
+// content depends on the bits above 32 too, so a read at a wrapped offset gets other bytes
+const byteAt = (position) => (position % 251 + Math.floor(position / BOUNDARY) * 101) & 0xff
+const expected = (position, length) => Uint8Array.from({ length }, (_, i) => byteAt(position + i))
+
+let root
+let path
+let server
+
+function writePattern(fd, position, length) {
+  writeSync(fd, expected(position, length), 0, length, position)
+}
+
+beforeAll(async () => {
+  root = mkdtempSync(join(tmpdir(), 'web-demuxer-large-'))
+  path = join(root, 'large.mp4')
+
+  const fd = openSync(path, 'w')
+  const header = Buffer.alloc(16)
+
+  header.writeUInt32BE(1, 0)
+  header.write('free', 4)
+  header.writeBigUInt64BE(BigInt(GAP), 8)
+  writeSync(fd, header, 0, 16, 0)
+  ftruncateSync(fd, SIZE)
+  writePattern(fd, BOUNDARY - 2 * BLOCK_SIZE, 4 * BLOCK_SIZE)
+  writePattern(fd, GAP, TAIL)
+  closeSync(fd)
+
+  server = await startRangeServer(root)
+})
+
+afterAll(async () => {
+  await server?.close()
+  rmSync(root, { recursive: true, force: true })
+})
+
+// a File of the sparse file for FileSource, with the FileReaderSync subset it uses
+class FakeFile {
+  constructor(start = 0, end = SIZE) {
+    this.name = 'large.mp4'
+    this.lastModified = 0
+    this.start = start
+    this.size = end - start
+  }
+
+  slice(start, end) {
+    return new FakeFile(this.start + start, this.start + Math.min(end, this.size))
+  }
+}
+
+class FakeFileReaderSync {
+  readAsArrayBuffer(blob) {
+    const fd = openSync(path, 'r')
+    const bytes = new Uint8Array(blob.size)
+
+    try {
+      readSync(fd, bytes, 0, blob.size, blob.start)
+    } finally {
+      closeSync(fd)
+    }
+
+    return bytes.buffer
+  }
+}
+
+const sources = [
+  ['UrlSource, concurrency 1', { concurrency: 1 }],
+  ['UrlSource, concurrency 4', { concurrency: 4 }],
+  ['FileSource', { file: true }],
+]
+
+describe.each(sources)('%s past 4GB', (name, { concurrency, file }) => {
+  let post
+
+  // the source as WebIOContext sees it: read(position as a double, view of the io buffer)
+  async function open(query = {}) {
+    post = loadPostJs({ crossOriginIsolated: true, FileReaderSync: FakeFileReaderSync })
+
+    if (file) {
+      return post.guardSource(new post.FileSource(new FakeFile()), new post.SessionStats())
+    }
+
+    await post.setUrlCacheOptions({ blockSize: BLOCK_SIZE, concurrency, retryDelay: 10 })
+
+    return post.guardSource(new post.UrlSource(server.url('large.mp4', { concurrency, ...query })), new post.SessionStats())
+  }
+
+  // read_packet of WebIOContext: bytes read into its buffer, -1 on errors, 0 at the end
+  function ioRead(source, position, length) {
+    const buffer = new Uint8Array(length)
+    const bytes = source.read(position, buffer)
+
+    return bytes < 0 ? bytes : buffer.subarray(0, bytes)
+  }
+
+  afterEach(() => post?.dispose())
+
+  it('reports the size and the 64 bit box header', async () => {
+    const source = await open()
+    const header = ioRead(source, 0, 16)
+
+    expect(source.size()).toBe(SIZE)
+    expect(new DataView(header.buffer).getBigUint64(8)).toBe(BigInt(GAP))
+  })
+
+  it('reads across the 4GB boundary', async () => {
+    const source = await open()
+
+    for (const position of [BOUNDARY - 100, BOUNDARY - 1, BOUNDARY, BOUNDARY + BLOCK_SIZE - 7]) {
+      expect(ioRead(source, position, 32 * 1024)).toEqual(expected(position, 32 * 1024))
+    }
+  })
+
+  it('reads the media past 4GB sequentially, as the demuxer does', async () => {
+    const source = await open()
+    let position = GAP
+
+    while (position < SIZE) {
+      const chunk = ioRead(source, position, 32 * 1024)
+
+      expect(chunk.byteLength).toBeGreaterThan(0)
+      expect(chunk).toEqual(expected(position, chunk.byteLength))
+      position += chunk.byteLength
+    }
+
+    expect(position).toBe(SIZE)
+    expect(ioRead(source, SIZE, 32 * 1024).byteLength).toBe(0)
+    expect(ioRead(source, SIZE - 10, 32 * 1024)).toEqual(expected(SIZE - 10, 10))
+  })
+
+  it.skipIf(file)('fails a read whose range comes back 4GB off', async () => {
+    const source = await open({ shiftStart: BOUNDARY })
+
+    expect(ioRead(source, GAP, 1000)).toBe(-1)
+  })
+})
@@ -0,0 +1,175 @@
+/**
+ * native tests of BitstreamConverter (lib/web-demuxer/bitstream_converter.cpp)
+ *
+ * usage: bitstream_converter_test
+ * exits non zero at the first failed check, logs go to stderr.
+ */
+#include <algorithm>
+
+#include "native_test.h"
+#include "bitstream_converter.h"
+
+// high profile level 3.1 SPS, a level 4.0 one of the same stream, its PPS and an IDR slice
+static const Bytes SPS = {0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50};
+static const Bytes SPS_LEVEL_40 = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78};
+static const Bytes PPS = {0x68, 0xeb, 0xe3, 0xcb};
+static const Bytes IDR = {0x65, 0x88, 0x84, 0x21};
+
+static const Bytes START_CODE = {0, 0, 0, 1};
+
+static Bytes length_prefixed(const Bytes &nal)
+{
+    return concat({{0, 0, (uint8_t)(nal.size() >> 8), (uint8_t)(nal.size() & 0xff)}, nal});
+}
+
+static Bytes avcc_record(const Bytes &sps, const Bytes &pps)
+{
+    return concat({{1, sps[1], sps[2], sps[3], 0xff, 0xe1, 0, (uint8_t)sps.size()}, sps, {1, 0, (uint8_t)pps.size()}, pps});
+}
+
+static AVFormatContext *alloc_context()
+{
+    AVFormatContext *fmt_ctx = avformat_alloc_context();
+
+    CHECK(fmt_ctx);
+
+    return fmt_ctx;
+}
+
+static void test_avcc_from_annexb_extradata()
+{
+    AVFormatContext *fmt_ctx = alloc_context();
+    AVStream *stream = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, concat({START_CODE, SPS, START_CODE, PPS}));
+    BitstreamConverter converter(stream, WEB_BITSTREAM_AVCC);
+
+    CHECK(converter.active());
+    CHECK(converter.synthesizes_record());
+    CHECK(converter.output_extradata() == avcc_record(SPS, PPS));
+
+    // the first packet carries the record, 3 and 4 byte start codes become 4 byte lengths
+    AVPacket *packet = make_packet(concat({START_CODE, IDR, {0, 0, 1}, IDR}), 0, 0);
+
+    CHECK(converter.convert(packet) == 0);
+    CHECK(packet_bytes(packet) == concat({length_prefixed(IDR), length_prefixed(IDR)}));
+    CHECK(new_extradata(packet) == avcc_record(SPS, PPS));
+    CHECK(packet->pts == 0);
+    av_packet_free(&packet);
+
+    // an unchanged record is not repeated, also not for in-band copies of the same parameter sets
+    packet = make_packet(concat({START_CODE, SPS, START_CODE, PPS, START_CODE, IDR}), 0, 3000);
+    CHECK(converter.convert(packet) == 0);
+    CHECK(packet_bytes(packet) == concat({length_prefixed(SPS), length_prefixed(PPS), length_prefixed(IDR)}));
+    CHECK(new_extradata(packet).empty());
+    CHECK(packet->pts == 3000);
+    av_packet_free(&packet);
+
+    // a new SPS in band replaces the record
+    packet = make_packet(concat({START_CODE, SPS_LEVEL_40, START_CODE, PPS, START_CODE, IDR}), 0, 6000);
+    CHECK(converter.convert(packet) == 0);
+    CHECK(new_extradata(packet) == avcc_record(SPS_LEVEL_40, PPS));
+    CHECK(converter.output_extradata() == avcc_record(SPS_LEVEL_40, PPS));
+    av_packet_free(&packet);
+
+    avformat_free_context(fmt_ctx);
+}
+
+static void test_avcc_without_extradata()
+{
+    AVFormatContext *fmt_ctx = alloc_context();
+    AVStream *stream = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, Bytes());
+    BitstreamConverter converter(stream, WEB_BITSTREAM_AVCC);
+
+    CHECK(converter.synthesizes_record());
+    CHECK(converter.output_extradata().empty());
+
+    // no record until both an SPS and a PPS were seen
+    AVPacket *packet = make_packet(concat({START_CODE, SPS, START_CODE, IDR}), 0, 0);
+
+    CHECK(converter.convert(packet) == 0);
+    CHECK(new_extradata(packet).empty());
+    CHECK(converter.output_extradata().empty());
+    av_packet_free(&packet);
+
+    packet = make_packet(concat({START_CODE, PPS, START_CODE, IDR}), 0, 3000);
+    CHECK(converter.convert(packet) == 0);
+    CHECK(packet_bytes(packet) == concat({length_prefixed(PPS), length_prefixed(IDR)}));
+    CHECK(new_extradata(packet) == avcc_record(SPS, PPS));
+    CHECK(converter.output_extradata() == avcc_record(SPS, PPS));
+    av_packet_free(&packet);
+
+    avformat_free_context(fmt_ctx);
+}
+
+static void test_annexb_from_avcc()
+{
+    AVFormatContext *fmt_ctx = alloc_context();
+    AVStream *stream = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, avcc_record(SPS, PPS));
+    BitstreamConverter converter(stream, WEB_BITSTREAM_ANNEXB);
+
+    CHECK(converter.active());
+    CHECK(!converter.synthesizes_record());
+    CHECK(converter.output_extradata().empty());
+
+    // h264_mp4toannexb puts the parameter sets of the record in front of the IDR slice
+    AVPacket *packet = make_packet(length_prefixed(IDR), 0, 0);
+
+    packet->flags |= AV_PKT_FLAG_KEY;
+    CHECK(converter.convert(packet) == 0);
+
+    Bytes out = packet_bytes(packet);
+
+    CHECK(is_annexb_extradata(out.data(), out.size()));
+    CHECK(out.size() > IDR.size());
+    CHECK(std::equal(IDR.begin(), IDR.end(), out.end() - IDR.size()));
+    CHECK(std::search(out.begin(), out.end(), SPS.begin(), SPS.end()) != out.end());
+    av_packet_free(&packet);
+
+    avformat_free_context(fmt_ctx);
+}
+
+static void test_pass_through()
+{
+    AVFormatContext *fmt_ctx = alloc_context();
+    AVStream *annexb = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, concat({START_CODE, SPS, START_CODE, PPS}));
+    AVStream *avcc = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, avcc_record(SPS, PPS));
+    AVStream *vp9 = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_VP9, Bytes());
+
+    CHECK(!BitstreamConverter(annexb, WEB_BITSTREAM_KEEP).active());
+    CHECK(!BitstreamConverter(avcc, WEB_BITSTREAM_AVCC).active());
+    CHECK(!BitstreamConverter(vp9, WEB_BITSTREAM_AVCC).active());
+    CHECK(!BitstreamConverter(vp9, WEB_BITSTREAM_ANNEXB).active());
+
+    BitstreamConverter converter(avcc, WEB_BITSTREAM_AVCC);
+    AVPacket *packet = make_packet(length_prefixed(IDR), 1, 0);
+
+    CHECK(converter.convert(packet) == 0);
+    CHECK(packet_bytes(packet) == length_prefixed(IDR));
+    CHECK(new_extradata(packet).empty());
+    av_packet_free(&packet);
+
+    avformat_free_context(fmt_ctx);
+}
+
+static void test_annexb_hevc_to_avcc_throws()
+{
+    AVFormatContext *fmt_ctx = alloc_context();
+    AVStream *stream = add_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_HEVC, concat({START_CODE, {0x40, 0x01, 0x0c, 0x01}}));
+
+    CHECK_THROWS(std::runtime_error, BitstreamConverter(stream, WEB_BITSTREAM_AVCC));
+    CHECK(BitstreamConverter(stream, WEB_BITSTREAM_ANNEXB).active());
+
+    avformat_free_context(fmt_ctx);
+}
+
+int main()
+{
+    test_avcc_from_annexb_extradata();
+    test_avcc_without_extradata();
+    test_annexb_from_avcc();
+    test_pass_through();
+    test_annexb_hevc_to_avcc_throws();
+
+    fprintf(stderr, "bitstream_converter_test: ok\n");
+
+    return 0;
+}
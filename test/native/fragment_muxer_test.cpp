@@ -0,0 +1,135 @@
+/**
+ * native tests of FragmentMuxer (lib/web-demuxer/fragment_muxer.cpp)
+ *
+ * usage: fragment_muxer_test
+ * exits non zero at the first failed check, logs go to stderr.
+ */
+#include <algorithm>
+#include <string>
+
+#include "native_test.h"
+#include "fragment_muxer.h"
+
+extern "C"
+{
+#include <libavutil/intreadwrite.h>
+};
+
+static const Bytes AVCC = {1, 0x64, 0x00, 0x1f, 0xff, 0xe1, 0, 8, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40, 0x50,
+                           1, 0, 4, 0x68, 0xeb, 0xe3, 0xcb};
+static const Bytes IDR = {0, 0, 0, 4, 0x65, 0x88, 0x84, 0x21};
+static const Bytes SLICE = {0, 0, 0, 4, 0x41, 0x9a, 0x02, 0x13};
+
+/** types of the top level boxes of an mp4 segment */
+static std::vector<std::string> box_types(const uint8_t *data, int size)
+{
+    std::vector<std::string> types;
+
+    for (int pos = 0; pos + 8 <= size;)
+    {
+        uint32_t box_size = AV_RB32(data + pos);
+
+        types.push_back(std::string((const char *)data + pos + 4, 4));
+        CHECK(box_size >= 8 && box_size <= (uint32_t)(size - pos));
+        pos += box_size;
+    }
+
+    return types;
+}
+
+static bool has_box(const FragmentMuxer &muxer, const char *type)
+{
+    std::vector<std::string> types = box_types(muxer.segment_data(), muxer.segment_size());
+
+    return std::find(types.begin(), types.end(), type) != types.end();
+}
+
+/** an input with an h264 stream (0) and a data stream (1) */
+static AVFormatContext *alloc_input()
+{
+    AVFormatContext *in_ctx = avformat_alloc_context();
+
+    CHECK(in_ctx);
+
+    AVStream *video = add_stream(in_ctx, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, AVCC);
+
+    video->codecpar->width = 320;
+    video->codecpar->height = 240;
+    video->codecpar->codec_tag = MKTAG('a', 'v', 'c', '1');
+    add_stream(in_ctx, AVMEDIA_TYPE_DATA, AV_CODEC_ID_NONE, Bytes());
+
+    return in_ctx;
+}
+
+static void test_mp4_fragments()
+{
+    AVFormatContext *in_ctx = alloc_input();
+    FragmentMuxer muxer(in_ctx, {0}, "mp4");
+
+    AVCodecParameters *par = muxer.output_codecpar(0);
+
+    CHECK(par);
+    CHECK(par->codec_id == AV_CODEC_ID_H264);
+    CHECK(par->codec_tag == 0);
+    CHECK(Bytes(par->extradata, par->extradata + par->extradata_size) == AVCC);
+    CHECK(!muxer.output_codecpar(1));
+    CHECK(!muxer.output_codecpar(2));
+    CHECK(!muxer.output_codecpar(-1));
+
+    CHECK(muxer.set_extradata(1, AVCC.data(), AVCC.size()) == AVERROR(EINVAL));
+    CHECK(muxer.set_extradata(0, AVCC.data(), AVCC.size()) >= 0);
+
+    CHECK(muxer.write_header() == 0);
+    CHECK(muxer.segment_size() > 0);
+    CHECK(box_types(muxer.segment_data(), muxer.segment_size())[0] == "ftyp");
+    CHECK(has_box(muxer, "moov"));
+    CHECK(!has_box(muxer, "mdat"));
+
+    // packets of streams that are not muxed are dropped
+    for (int i = 0; i < 3; i++)
+    {
+        AVPacket *packet = make_packet(i == 0 ? IDR : SLICE, 0, i * 3000);
+
+        packet->duration = 3000;
+        packet->flags |= i == 0 ? AV_PKT_FLAG_KEY : 0;
+        CHECK(muxer.write(packet) == 0);
+        CHECK(packet->size == 0);
+        av_packet_free(&packet);
+
+        packet = make_packet(SLICE, 1, i * 3000);
+        CHECK(muxer.write(packet) == 0);
+        av_packet_free(&packet);
+    }
+
+    CHECK(muxer.flush() == 0);
+    CHECK(has_box(muxer, "moof"));
+    CHECK(has_box(muxer, "mdat"));
+    CHECK(!has_box(muxer, "moov"));
+
+    // skip_trailer: no mfra index after the last fragment
+    CHECK(muxer.finish() == 0);
+    CHECK(!has_box(muxer, "mfra"));
+
+    avformat_free_context(in_ctx);
+}
+
+static void test_invalid_arguments_throw()
+{
+    AVFormatContext *in_ctx = alloc_input();
+
+    CHECK_THROWS(std::runtime_error, FragmentMuxer(in_ctx, {0}, "no-such-muxer"));
+    CHECK_THROWS(std::runtime_error, FragmentMuxer(in_ctx, {2}, "mp4"));
+    CHECK_THROWS(std::runtime_error, FragmentMuxer(in_ctx, {0, 0}, "mp4"));
+
+    avformat_free_context(in_ctx);
+}
+
+int main()
+{
+    test_mp4_fragments();
+    test_invalid_arguments_throw();
+
+    fprintf(stderr, "fragment_muxer_test: ok\n");
+
+    return 0;
+}
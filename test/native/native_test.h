@@ -0,0 +1,110 @@
+/**
+ * helpers of the native tests of the demux core (test/native), built and run
+ * by make web-demuxer-native-test
+ */
+#ifndef NATIVE_TEST_H
+#define NATIVE_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+};
+
+/** abort the test binary with the failed condition */
+#define CHECK(cond)                                                                   \
+    do                                                                                \
+    {                                                                                 \
+        if (!(cond))                                                                  \
+        {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                  \
+        }                                                                             \
+    } while (0)
+
+/** check that the expression throws E */
+#define CHECK_THROWS(E, ...)           \
+    do                                 \
+    {                                  \
+        bool thrown = false;           \
+        try                            \
+        {                              \
+            (void)(__VA_ARGS__);       \
+        }                              \
+        catch (const E &)              \
+        {                              \
+            thrown = true;             \
+        }                              \
+        CHECK(thrown && #__VA_ARGS__); \
+    } while (0)
+
+typedef std::vector<uint8_t> Bytes;
+
+static inline Bytes concat(std::vector<Bytes> parts)
+{
+    Bytes bytes;
+
+    for (const Bytes &part : parts)
+    {
+        bytes.insert(bytes.end(), part.begin(), part.end());
+    }
+
+    return bytes;
+}
+
+/** add a stream of codec_id with a copy of extradata to fmt_ctx */
+static inline AVStream *add_stream(AVFormatContext *fmt_ctx, AVMediaType type, AVCodecID codec_id, const Bytes &extradata)
+{
+    AVStream *stream = avformat_new_stream(fmt_ctx, NULL);
+
+    CHECK(stream);
+    stream->codecpar->codec_type = type;
+    stream->codecpar->codec_id = codec_id;
+    stream->time_base = {1, 90000};
+
+    if (!extradata.empty())
+    {
+        stream->codecpar->extradata = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        CHECK(stream->codecpar->extradata);
+        memcpy(stream->codecpar->extradata, extradata.data(), extradata.size());
+        stream->codecpar->extradata_size = extradata.size();
+    }
+
+    return stream;
+}
+
+/** a packet of stream_index holding a copy of data */
+static inline AVPacket *make_packet(const Bytes &data, int stream_index, int64_t pts)
+{
+    AVPacket *packet = av_packet_alloc();
+
+    CHECK(packet);
+    CHECK(av_new_packet(packet, data.size()) == 0);
+    memcpy(packet->data, data.data(), data.size());
+    packet->stream_index = stream_index;
+    packet->pts = pts;
+    packet->dts = pts;
+
+    return packet;
+}
+
+static inline Bytes packet_bytes(const AVPacket *packet)
+{
+    return Bytes(packet->data, packet->data + packet->size);
+}
+
+/** AV_PKT_DATA_NEW_EXTRADATA side data of packet, empty if it has none */
+static inline Bytes new_extradata(const AVPacket *packet)
+{
+    size_t size = 0;
+    const uint8_t *data = av_packet_get_side_data(packet, AV_PKT_DATA_NEW_EXTRADATA, &size);
+
+    return data ? Bytes(data, data + size) : Bytes();
+}
+
+#endif
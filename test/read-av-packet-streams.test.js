@@ -0,0 +1,64 @@
+import { beforeEach, describe, expect, it, vi } from 'vitest'
+import { FakeWorker, packetBatch, until } from './helpers/fake-worker.js'
+
+vi.mock('../src/ffmpeg.worker.ts?worker&inline', async () => ({
+  default: (await import('./helpers/fake-worker.js')).FakeWorker,
+}))
+
+const { WebDemuxer } = await import('../src/web-demuxer.ts')
+
+/** the next packet of reader, or undefined if none arrives within ms */
+function readWithin(reader, ms = 50) {
+  return Promise.race([
+    reader.read().then(({ value }) => value),
+    new Promise((resolve) => setTimeout(resolve, ms)),
+  ])
+}
+
+describe('readAVPacketStreams back-pressure', () => {
+  let reads
+
+  beforeEach(() => {
+    FakeWorker.reset()
+    reads = 0
+    // every read round trip of the worker demuxes one packet of stream 0 and one of stream 1
+    FakeWorker.onMessage = (worker, message) => {
+      if (message.type === 'ReadAVPacket' || message.type === 'ReadNextAVPacket') {
+        reads++
+        worker.emit({ type: 'AVPacketBatchStream', msgId: message.msgId, result: packetBatch([0, 1]) })
+      }
+    }
+  })
+
+  it('keeps reading for an active stream while another is stalled, up to maxBufferedPackets', async () => {
+    const demuxer = new WebDemuxer({ wasmLoaderPath: '/ffmpeg.js' })
+
+    await demuxer.load('https://example.com/media.ts')
+
+    const [stalled, active] = demuxer.readAVPacketStreams(0, 0, [0, 1], undefined, {
+      highWaterMark: 2,
+      maxBufferedPackets: 4,
+    })
+    const activeReader = active.getReader()
+
+    // stream 0 holds its 2 packets and 4 more past its high water mark: 6 round trips
+    for (let i = 0; i < 6; i++) {
+      expect((await readWithin(activeReader))?.stream_index).toBe(1)
+    }
+
+    const pending = readWithin(activeReader, 1000)
+
+    await new Promise((resolve) => setTimeout(resolve, 50))
+    expect(reads).toBe(6)
+
+    // reading the stalled stream below its high water mark resumes the read
+    const stalledReader = stalled.getReader()
+
+    for (let i = 0; i < 5; i++) {
+      expect((await readWithin(stalledReader))?.stream_index).toBe(0)
+    }
+
+    await until(() => reads > 6)
+    expect((await pending)?.stream_index).toBe(1)
+  })
+})
@@ -0,0 +1,80 @@
+import { describe, expect, it } from 'vitest'
+import { loadPostJs } from './helpers/post-js.js'
+
+function stream(index, codec_type) {
+  return { index, codec_type, codec_string: '', extradata: new Uint8Array(), tags: { size: () => 0 }, delete() {} }
+}
+
+// two video streams, the probe ranks the second one best, and one audio stream
+const STREAMS = [stream(0, 0), stream(1, 0), stream(2, 1)]
+const PROBED_DEFAULTS = { 0: 1, 1: 2 }
+
+/** native session: streamIndex -1 resolves to PROBED_DEFAULTS when probed, else to set_default_stream */
+class FakeSession {
+  constructor(source, options) {
+    this.options = options
+    this.defaults = options.header_only ? {} : { ...PROBED_DEFAULTS }
+    FakeSession.last = this
+  }
+
+  set_default_stream(type, streamIndex) {
+    this.defaults[type] = streamIndex
+  }
+
+  find_stream(type, streamIndex) {
+    if (streamIndex >= 0) return streamIndex
+    if (type in this.defaults) return this.defaults[type]
+    // a header only open picks the first stream of the type
+    const first = STREAMS.find((s) => s.codec_type === type)
+    if (!first) throw new Error('Cannot find wanted stream in the input file')
+    return first.index
+  }
+
+  get_streams_version() {
+    return 0
+  }
+
+  get_stream_version() {
+    return 0
+  }
+
+  get_av_streams() {
+    return { streams: { size: () => STREAMS.length, get: (i) => STREAMS[i], delete() {} } }
+  }
+
+  get_media_info() {
+    return { format_name: 'mpegts', duration: 10, bit_rate: '0', start_time: 0, nb_streams: STREAMS.length, streams: { delete() {} } }
+  }
+}
+
+// FileSource only creates its reader, the fake session reads nothing
+class FakeFileReaderSync {}
+
+describe('DemuxSession metadata, default streams', () => {
+  const { DemuxSession } = loadPostJs({ FileReaderSync: FakeFileReaderSync, Module: { WebDemuxerSession: FakeSession } })
+  const file = new File([new Uint8Array(16)], 'media.ts', { lastModified: 1 })
+
+  it('caches the default stream of each media type picked by the probe', () => {
+    const metadata = new DemuxSession(file, { cacheMetadata: true }).getMetadata()
+
+    expect(metadata.defaultStreams).toEqual(PROBED_DEFAULTS)
+  })
+
+  it('resolves streamIndex -1 from the cache on a header only session', () => {
+    const metadata = new DemuxSession(file, { cacheMetadata: true }).getMetadata()
+    const session = new DemuxSession(file, { cacheMetadata: true, metadata })
+
+    expect(FakeSession.last.options.header_only).toBe(true)
+    expect(session.getAVStream(0, -1).index).toBe(1)
+    expect(session.getAVStream(1, -1).index).toBe(2)
+  })
+
+  it('ignores the defaults of metadata of another source version', () => {
+    const metadata = new DemuxSession(file, { cacheMetadata: true }).getMetadata()
+    const changed = new File([new Uint8Array(16)], 'media.ts', { lastModified: 2 })
+    const session = new DemuxSession(changed, { cacheMetadata: true, metadata })
+
+    expect(FakeSession.last.options.header_only).toBe(false)
+    expect(session.getAVStream(0, -1).index).toBe(1)
+  })
+})
@@ -0,0 +1,191 @@
+import { afterAll, afterEach, beforeAll, describe, expect, it } from 'vitest'
+import { mkdtempSync, rmSync, utimesSync, writeFileSync } from 'node:fs'
+import { tmpdir } from 'node:os'
+import { join } from 'node:path'
+import { startRangeServer } from './helpers/range-server.js'
+import { loadPostJs } from './helpers/post-js.js'
+
+const SIZE = 1024 * 1024 + 123
+const BLOCK_SIZE = 64 * 1024
+
+const bytes = new Uint8Array(SIZE).map((_, i) => (i * 7 + (i >> 8)) & 0xff)
+let root
+let server
+
+beforeAll(async () => {
+  root = mkdtempSync(join(tmpdir(), 'web-demuxer-url-'))
+  writeFileSync(join(root, 'media.bin'), bytes)
+  server = await startRangeServer(root)
+})
+
+afterAll(async () => {
+  await server?.close()
+  rmSync(root, { recursive: true, force: true })
+})
+
+// concurrency 1 reads with sync XHR, 4 with the fetch engine
+describe.each([1, 4])('UrlSource, concurrency %i', (concurrency) => {
+  let post
+
+  async function open(url, options = {}) {
+    post = loadPostJs({ crossOriginIsolated: true })
+    await post.setUrlCacheOptions({ blockSize: BLOCK_SIZE, concurrency, retryDelay: 10, ...options })
+    expect(post.getUrlCacheStats().concurrency).toBe(concurrency)
+
+    return new post.UrlSource(url)
+  }
+
+  function read(source, position, length) {
+    const view = new Uint8Array(length)
+    const read = source.read(position, view)
+
+    return view.subarray(0, read)
+  }
+
+  // the server counts requests per url, keep them apart between the two runs
+  const fileUrl = (query) => server.url('media.bin', { concurrency, ...query })
+
+  afterEach(() => post?.dispose())
+
+  it('reads the file through the block cache', async () => {
+    const url = fileUrl({ test: 'sequential' })
+    const source = await open(url)
+    let position = 0
+
+    expect(source.size()).toBe(SIZE)
+    expect(source.identity()).toMatch(/^url:.+:".+"$/)
+
+    while (position < SIZE) {
+      const chunk = read(source, position, 32 * 1024)
+
+      expect(chunk).toEqual(bytes.subarray(position, position + 32 * 1024))
+      position += chunk.byteLength
+    }
+
+    expect(read(source, SIZE, 16).byteLength).toBe(0)
+
+    // the read-ahead grows on sequential reads, 33 reads take a few requests
+    const { hits, misses, requests, bytesFetched } = post.getUrlCacheStats()
+
+    expect(requests).toBeLessThan(10)
+    expect(bytesFetched).toBe(SIZE)
+    expect(hits).toBeGreaterThan(misses)
+    expect(await server.requests(url)).toBe(requests)
+
+    // cached blocks are not requested again
+    expect(read(source, 1000, 1000)).toEqual(bytes.subarray(1000, 2000))
+    expect(await server.requests(url)).toBe(requests)
+  })
+
+  it('reads at unaligned positions across blocks', async () => {
+    const source = await open(fileUrl({ test: 'random' }))
+
+    for (const position of [SIZE - 10, BLOCK_SIZE - 1, 5 * BLOCK_SIZE + 17, 3, SIZE - BLOCK_SIZE - 5]) {
+      expect(read(source, position, BLOCK_SIZE + 2)).toEqual(bytes.subarray(position, position + BLOCK_SIZE + 2))
+    }
+  })
+
+  it('rejects a range that starts elsewhere than asked, without retrying', async () => {
+    const url = fileUrl({ shiftStart: 4096 })
+    const source = await open(url)
+
+    expect(() => read(source, 4 * BLOCK_SIZE, 100)).toThrow(/another range|instead of/)
+    expect(await server.requests(url)).toBe(1)
+  })
+
+  it('stops a read at a block the server cut short', async () => {
+    const truncate = 2 * BLOCK_SIZE + 1000
+    const url = fileUrl({ truncate })
+    const source = await open(url)
+    const position = truncate - 100
+
+    // block 2 ends at the cut, block 3 must not be placed right after it
+    expect(read(source, position, BLOCK_SIZE)).toEqual(bytes.subarray(position, truncate))
+    expect(() => read(source, truncate, 100)).toThrow(/bytes of block 2/)
+
+    // the short block is not cached, each read asks for it again
+    const requests = await server.requests(url)
+
+    expect(read(source, position, 100)).toEqual(bytes.subarray(position, truncate))
+    expect(await server.requests(url)).toBe(requests + 1)
+  })
+
+  it('takes a 200 response as the file from its start', async () => {
+    const url = fileUrl({ ignoreRange: 1 })
+    const source = await open(url)
+
+    expect(read(source, 10, 100)).toEqual(bytes.subarray(10, 110))
+    expect(() => read(source, 4 * BLOCK_SIZE, 100)).toThrow(/another range|instead of/)
+  })
+
+  it('drops the cached blocks of a url whose file changed', async () => {
+    const path = join(root, `changing-${concurrency}.bin`)
+    const url = server.url(`changing-${concurrency}.bin`)
+
+    writeFileSync(path, bytes)
+    const source = await open(url)
+
+    expect(read(source, 0, 100)).toEqual(bytes.subarray(0, 100))
+
+    // the same content, cached blocks are kept
+    post.urlBlockCache.revalidate(url)
+    expect(read(source, 0, 100)).toEqual(bytes.subarray(0, 100))
+    expect(await server.requests(url)).toBe(1)
+
+    // same size, another ETag
+    const changed = bytes.map((byte) => byte ^ 0xff)
+
+    writeFileSync(path, changed)
+    utimesSync(path, new Date(), new Date(Date.now() + 10000))
+    post.urlBlockCache.revalidate(url)
+    expect(read(source, 0, 100)).toEqual(changed.subarray(0, 100))
+    expect(await server.requests(url)).toBe(2)
+  })
+
+  it('does not retry client errors', async () => {
+    const url = fileUrl({ status: 404 })
+    const source = await open(url)
+
+    expect(() => read(source, 0, 100)).toThrow()
+    expect(await server.requests(url)).toBe(1)
+  })
+
+  it('retries server errors', async () => {
+    const url = fileUrl({ fail: 2 })
+    const source = await open(url, { retries: 3 })
+
+    expect(read(source, 0, 100)).toEqual(bytes.subarray(0, 100))
+    expect(await server.requests(url)).toBe(3)
+  })
+
+  it('makes one attempt with retries 0', async () => {
+    const url = fileUrl({ fail: 1, test: 'retries' })
+    const source = await open(url, { retries: 0 })
+
+    expect(() => read(source, 0, 100)).toThrow()
+    expect(await server.requests(url)).toBe(1)
+    expect(read(source, 0, 100)).toEqual(bytes.subarray(0, 100))
+  })
+
+  it('keeps maxReadAhead 0 when later options leave it out', async () => {
+    const url = fileUrl({ test: 'readAhead' })
+    const source = await open(url, { maxReadAhead: 0 })
+
+    await post.setUrlCacheOptions({ retryDelay: 20 })
+
+    for (let position = 0; position < 4 * BLOCK_SIZE; position += BLOCK_SIZE) {
+      expect(read(source, position, BLOCK_SIZE)).toEqual(bytes.subarray(position, position + BLOCK_SIZE))
+    }
+
+    expect(post.getUrlCacheStats().bytesFetched).toBe(4 * BLOCK_SIZE)
+    expect(await server.requests(url)).toBe(4)
+  })
+
+  it('gives up after retries attempts', async () => {
+    const url = fileUrl({ fail: 10 })
+    const source = await open(url, { retries: 2 })
+
+    expect(() => read(source, 0, 100)).toThrow()
+    expect(await server.requests(url)).toBe(2)
+  })
+})
@@ -0,0 +1,48 @@
+import { afterEach, beforeEach, describe, expect, it, vi } from 'vitest'
+import { FakeWorker, until } from './helpers/fake-worker.js'
+
+vi.mock('../src/ffmpeg.worker.ts?worker&inline', async () => ({
+  default: (await import('./helpers/fake-worker.js')).FakeWorker,
+}))
+
+const { WebDemuxerPool } = await import('../src/web-demuxer-pool.ts')
+
+describe('WebDemuxerPool', () => {
+  beforeEach(() => {
+    FakeWorker.reset()
+    vi.stubGlobal('fetch', async () => new Response(new Uint8Array()))
+    vi.spyOn(WebAssembly, 'compileStreaming').mockResolvedValue({})
+  })
+
+  afterEach(() => {
+    vi.unstubAllGlobals()
+    vi.restoreAllMocks()
+  })
+
+  it('resolves concurrent same type requests on one worker with their own answers', async () => {
+    const pool = new WebDemuxerPool({ size: 1, wasmLoaderPath: '/ffmpeg.js' })
+    const source = 'https://example.com/media.mp4'
+
+    const first = pool.getAVPacket(source, 1)
+    const second = pool.getAVPacket(source, 2)
+
+    await until(() => FakeWorker.instances[0]?.held.length === 2)
+
+    const worker = FakeWorker.instances[0]
+    const [a, b] = worker.held
+    const ids = worker.posted.map((message) => message.msgId).filter((id) => id !== undefined)
+    const answer = (message) =>
+      worker.emit({ type: message.type, msgId: message.msgId, result: { timestamp: message.data.time } })
+
+    expect(FakeWorker.instances).toHaveLength(1)
+    expect(new Set(ids).size).toBe(ids.length)
+    expect(a.msgId).not.toBe(b.msgId)
+
+    // answer out of order, each request must still get its own packet
+    answer(b)
+    answer(a)
+
+    await expect(first).resolves.toEqual({ timestamp: 1 })
+    await expect(second).resolves.toEqual({ timestamp: 2 })
+  })
+})
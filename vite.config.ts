@@ -5,6 +5,14 @@ import babel from "@rollup/plugin-babel";
 import { viteStaticCopy } from "vite-plugin-static-copy";
 
 export default defineConfig(() => ({
+  server: {
+    // cross origin isolation for the dev and bench pages (SharedArrayBuffer: threads, PushSource, concurrent url fetches),
+    // credentialless still loads the cdn styles and scripts
+    headers: {
+      "Cross-Origin-Opener-Policy": "same-origin",
+      "Cross-Origin-Embedder-Policy": "credentialless",
+    },
+  },
   build: {
     lib: {
       entry: resolve(__dirname, "src/index.ts"),
@@ -2,6 +2,7 @@ import { defineConfig } from 'vitest/config'
 
 export default defineConfig({
   test: {
-    // ...
+    // the range server and the fetch engine run on worker threads
+    testTimeout: 30000,
   },
-})
\ No newline at end of file
+})